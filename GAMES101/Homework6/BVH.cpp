@@ -1,7 +1,58 @@
 #include <algorithm>
 #include <cassert>
+#include <thread>
 #include "BVH.hpp"
 
+namespace {
+
+// 少于这个数量的图元时 refit 不开线程
+constexpr size_t kParallelRefitPrimitives = 4096;
+
+void deleteTree(BVHBuildNode* node)
+{
+    if (!node)
+        return;
+    deleteTree(node->left);
+    deleteTree(node->right);
+    delete node;
+}
+
+// 重新计算 node 子树中所有节点的包围盒, 返回子树中所有节点的包围盒面积之和
+double refitSubtree(BVHBuildNode* node)
+{
+    if (!node->left && !node->right) {
+        node->bounds = node->object->getBounds();
+        return node->bounds.SurfaceArea();
+    }
+    double area = refitSubtree(node->left) + refitSubtree(node->right);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    return area + node->bounds.SurfaceArea();
+}
+
+// 深度 depth 处的子树 (或更浅的叶子) 按深度优先的顺序放入 out, 它们由各线程分别 refit
+void collectSubtrees(BVHBuildNode* node, int depth, std::vector<BVHBuildNode*>& out)
+{
+    if (depth == 0 || (!node->left && !node->right)) {
+        out.push_back(node);
+        return;
+    }
+    collectSubtrees(node->left, depth - 1, out);
+    collectSubtrees(node->right, depth - 1, out);
+}
+
+// 用已经 refit 的子树 (面积之和按 collectSubtrees 的顺序存放在 areas 中) 重新计算上面几层
+double refitTop(BVHBuildNode* node, int depth, const std::vector<double>& areas, size_t& next)
+{
+    if (depth == 0 || (!node->left && !node->right))
+        return areas[next++];
+    double area = refitTop(node->left, depth - 1, areas, next);
+    area += refitTop(node->right, depth - 1, areas, next);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    return area + node->bounds.SurfaceArea();
+}
+
+} // namespace
+
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
@@ -13,6 +64,7 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
         return;
 
     root = recursiveBuild(primitives);
+    buildCost = SAHCost();
 
     time(&stop);
     double diff = difftime(stop, start);
@@ -25,6 +77,82 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
         hrs, mins, secs);
 }
 
+BVHAccel::~BVHAccel()
+{
+    deleteTree(root);
+}
+
+double BVHAccel::SAHCost() const
+{
+    if (!root)
+        return 0;
+    double rootArea = root->bounds.SurfaceArea();
+    if (rootArea <= 0)
+        return 0;
+    double area = 0;
+    std::vector<const BVHBuildNode*> stack{root};
+    while (!stack.empty()) {
+        const BVHBuildNode* node = stack.back();
+        stack.pop_back();
+        area += node->bounds.SurfaceArea();
+        if (node->left)
+            stack.push_back(node->left);
+        if (node->right)
+            stack.push_back(node->right);
+    }
+    return area / rootArea;
+}
+
+bool BVHAccel::refit()
+{
+    if (!root)
+        return false;
+
+    double area;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads == 1 || primitives.size() < kParallelRefitPrimitives) {
+        area = refitSubtree(root);
+    }
+    else {
+        // 在能分出约 4 * threads 棵子树的深度切开, 子树之间互不相交, 各线程按原子计数领取
+        int depth = 0;
+        while ((1u << depth) < 4 * threads)
+            ++depth;
+        std::vector<BVHBuildNode*> subtrees;
+        collectSubtrees(root, depth, subtrees);
+        std::vector<double> areas(subtrees.size());
+        std::atomic<size_t> nextSubtree(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&]() {
+                for (size_t i = nextSubtree++; i < subtrees.size(); i = nextSubtree++)
+                    areas[i] = refitSubtree(subtrees[i]);
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        size_t next = 0;
+        area = refitTop(root, depth, areas, next);
+    }
+
+    double rootArea = root->bounds.SurfaceArea();
+    double cost = rootArea > 0 ? area / rootArea : 0;
+    if (buildCost > 0 && cost > buildCost * rebuildThreshold) {
+        printf("BVH refit: SAH cost %.2f exceeds %.2f x build cost %.2f, rebuilding\n", cost, rebuildThreshold,
+               buildCost);
+        rebuild();
+        return true;
+    }
+    return false;
+}
+
+void BVHAccel::rebuild()
+{
+    deleteTree(root);
+    root = recursiveBuild(primitives);
+    buildCost = SAHCost();
+}
+
 BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
 {
     BVHBuildNode* node = new BVHBuildNode();
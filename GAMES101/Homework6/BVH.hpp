@@ -35,10 +35,21 @@ public:
     Intersection Intersect(const Ray &ray) const;
     Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    BVHBuildNode* root = nullptr;
+
+    // 物体移动或网格形变之后调用: 树的结构不变, 自底向上用各物体新的 getBounds() 重新计算节点的包围盒,
+    // 代价是 O(n), 不同子树在多个线程中并行计算. 形变较大时包围盒之间的重叠会变多,
+    // refit 之后的 SAH 代价超过构建时的 rebuildThreshold 倍就改为重新构建, 此时返回 true
+    bool refit();
+    // 所有节点的包围盒面积之和除以根节点的面积, 即遍历与求交代价都取 1 时光线的期望求交代价
+    double SAHCost() const;
+    double rebuildThreshold = 1.5;
+    // 最近一次构建完成时的 SAHCost()
+    double buildCost = 0;
 
     // BVHAccel Private Methods
     BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    void rebuild();
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
@@ -10,6 +10,10 @@ void Scene::buildBVH() {
     this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
 }
 
+void Scene::refitBVH() {
+    this->bvh->refit();
+}
+
 Intersection Scene::intersect(const Ray &ray) const
 {
     return this->bvh->Intersect(ray);
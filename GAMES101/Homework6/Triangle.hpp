@@ -56,6 +56,17 @@ public:
         normal = normalize(crossProduct(e1, e2));
     }
 
+    // 移动顶点, 同时更新边与法线. 所在的 BVH 需要随后 refit
+    void setVertices(const Vector3f& _v0, const Vector3f& _v1, const Vector3f& _v2)
+    {
+        v0 = _v0;
+        v1 = _v1;
+        v2 = _v2;
+        e1 = v1 - v0;
+        e2 = v2 - v0;
+        normal = normalize(crossProduct(e1, e2));
+    }
+
     bool intersect(const Ray& ray) override;
     bool intersect(const Ray& ray, float& tnear,
                    uint32_t& index) const override;
@@ -126,6 +137,26 @@ public:
         bvh = new BVHAccel(ptrs);
     }
 
+    // 逐帧形变: positions 按加载时的顺序给出每个三角形的 3 个顶点, 替换后 refit 网格的 BVH.
+    // 返回 BVH 是否因为 SAH 代价变差而重新构建. 之后还需要 refit 包含这个网格的场景 BVH
+    bool updateVertices(const std::vector<Vector3f>& positions)
+    {
+        assert(positions.size() == triangles.size() * 3);
+        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
+                                     std::numeric_limits<float>::infinity(),
+                                     std::numeric_limits<float>::infinity()};
+        Vector3f max_vert = -min_vert;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            triangles[i].setVertices(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+            for (int j = 0; j < 3; j++) {
+                min_vert = Vector3f::Min(min_vert, positions[i * 3 + j]);
+                max_vert = Vector3f::Max(max_vert, positions[i * 3 + j]);
+            }
+        }
+        bounding_box = Bounds3(min_vert, max_vert);
+        return bvh->refit();
+    }
+
     bool intersect(const Ray& ray) { return true; }
 
     bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
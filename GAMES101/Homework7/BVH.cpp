@@ -1,18 +1,159 @@
 #include <algorithm>
 #include <cassert>
+#include <unordered_map>
 #include "BVH.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+// 空包围盒的表面积为 0
+float surfaceArea(const Bounds3& b)
+{
+    Vector3f d = b.Diagonal();
+    if (d.x < 0 || d.y < 0 || d.z < 0)
+        return 0;
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+}
+
+float axisMin(const Bounds3& b, int axis) { return (&b.pMin.x)[axis]; }
+float axisMax(const Bounds3& b, int axis) { return (&b.pMax.x)[axis]; }
+float axisCentroid(const Bounds3& b, int axis) { return 0.5f * (axisMin(b, axis) + axisMax(b, axis)); }
+
+Bounds3 intersectBounds(Bounds3 a, const Bounds3& b)
+{
+    a.pMin = Vector3f::Max(a.pMin, b.pMin);
+    a.pMax = Vector3f::Min(a.pMax, b.pMax);
+    return a;
+}
+
+// 光线与包围盒的交点在 [0, tMax] 内时返回 true, tEnter 为进入距离
+bool hitBounds(const Bounds3& b, const Ray& ray, float tMax, float& tEnter)
+{
+    float t0 = 0, t1 = tMax;
+    for (int axis = 0; axis < 3; ++axis) {
+        float inv = (&ray.direction_inv.x)[axis], o = (&ray.origin.x)[axis];
+        float tNear = (axisMin(b, axis) - o) * inv;
+        float tFar = (axisMax(b, axis) - o) * inv;
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        t0 = std::max(t0, tNear);
+        t1 = std::min(t1, tFar);
+    }
+    tEnter = t0;
+    return t0 <= t1;
+}
+
+inline void prefetchNode(const BVHBuildNode* node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#endif
+}
+
+constexpr int kObjectBins = 16;
+constexpr int kSpatialBins = 32;
+// 物体划分两侧的重叠面积占整个场景的比例低于该值时不尝试空间划分 (论文中的 alpha)
+constexpr float kOverlapThreshold = 1e-5f;
+// 遍历一个内部节点与求交一个图元的相对开销
+constexpr float kTraversalCost = 0.125f;
+
+// 重新计算叶子与内部节点的面积. 被切开的图元在多个叶子中出现, 每个叶子只计入 1 / 引用数
+void assignAreas(BVHBuildNode* node, const std::unordered_map<Object*, int>& counts)
+{
+    if (!node->left && !node->right) {
+        node->area = node->object->getArea() / counts.at(node->object);
+        return;
+    }
+    assignAreas(node->left, counts);
+    assignAreas(node->right, counts);
+    node->area = node->left->area + node->right->area;
+}
+
+// van Emde Boas 顺序: 把以 node 为根, 高度为 height 的一段树切成上下两半,
+// 先递归地排列上半部分, 再依次递归地排列上半部分下面挂着的每一棵子树.
+// 树不平衡时叶子可能在 height 之前出现; 低于这一段的子节点放入 frontier, 由调用者继续排列
+void vebOrder(BVHBuildNode* node, int height, std::vector<BVHBuildNode*>& order,
+              std::vector<BVHBuildNode*>& frontier)
+{
+    if (height == 1) {
+        order.push_back(node);
+        if (node->left && node->right) {
+            frontier.push_back(node->left);
+            frontier.push_back(node->right);
+        }
+        return;
+    }
+    int top = height / 2;
+    std::vector<BVHBuildNode*> middle;
+    vebOrder(node, top, order, middle);
+    for (auto* child : middle)
+        vebOrder(child, height - top, order, frontier);
+}
+
+int treeHeight(const BVHBuildNode* node)
+{
+    if (!node->left || !node->right)
+        return 1;
+    return 1 + std::max(treeHeight(node->left), treeHeight(node->right));
+}
+
+void countReferences(BVHBuildNode* node, std::unordered_map<Object*, int>& counts)
+{
+    if (!node->left && !node->right) {
+        ++counts[node->object];
+        return;
+    }
+    countReferences(node->left, counts);
+    countReferences(node->right, counts);
+}
+
+} // namespace
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+      primitives(std::move(p)),
+      arena(std::make_unique<MemoryArena>(MemoryCategory::BVHNodes,
+                                          std::max<size_t>(1, 2 * primitives.size()) * sizeof(BVHBuildNode)))
 {
+    RT_TRACE_SCOPE_ARG("BVHAccel build", primitives.size());
     time_t start, stop;
     time(&start);
     if (primitives.empty())
         return;
 
-    root = recursiveBuild(primitives);
+    lazy = defaultLazy && splitMethod != SplitMethod::SBVH;
+
+    if (splitMethod == SplitMethod::NAIVE) {
+        root = recursiveBuild(primitives, 0, *arena);
+    }
+    else {
+        std::vector<Reference> refs;
+        refs.reserve(primitives.size());
+        for (auto* obj : primitives) {
+            refs.push_back({obj, obj->getBounds()});
+            rootBounds = Union(rootBounds, refs.back().bounds);
+        }
+        duplicatesLeft = splitMethod == SplitMethod::SBVH ? (int)(duplicationBudget * primitives.size()) : 0;
+        root = sahBuild(refs, 0, *arena);
+
+        if (splitMethod == SplitMethod::SBVH) {
+            std::unordered_map<Object*, int> counts;
+            countReferences(root, counts);
+            assignAreas(root, counts);
+        }
+    }
+
+    if (lazy) {
+        if (!lazySubtrees.empty())
+            printf("Deferred %zu subtrees\n", lazySubtrees.size());
+    }
+    else if (defaultCompression) {
+        Compress();
+    }
+    else if (defaultLayout != Layout::DEPTH_FIRST) {
+        reorderNodes(defaultLayout);
+    }
 
     time(&stop);
     double diff = difftime(stop, start);
@@ -25,9 +166,17 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
         hrs, mins, secs);
 }
 
-BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
+BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects, int depth, MemoryArena& nodes)
 {
-    BVHBuildNode* node = new BVHBuildNode();
+    if (lazy && depth == lazyDepth && (int)objects.size() > lazyMinPrimitives) {
+        std::vector<Reference> refs;
+        refs.reserve(objects.size());
+        for (auto* obj : objects)
+            refs.push_back({obj, obj->getBounds()});
+        return makeLazy(std::move(refs), nodes);
+    }
+
+    BVHBuildNode* node = nodes.New<BVHBuildNode>();
 
     // Compute bounds of all primitives in BVH node
     Bounds3 bounds;
@@ -43,8 +192,8 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
         return node;
     }
     else if (objects.size() == 2) {
-        node->left = recursiveBuild(std::vector{objects[0]});
-        node->right = recursiveBuild(std::vector{objects[1]});
+        node->left = recursiveBuild(std::vector{objects[0]}, depth + 1, nodes);
+        node->right = recursiveBuild(std::vector{objects[1]}, depth + 1, nodes);
 
         node->bounds = Union(node->left->bounds, node->right->bounds);
         node->area = node->left->area + node->right->area;
@@ -86,8 +235,9 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
 
         assert(objects.size() == (leftshapes.size() + rightshapes.size()));
 
-        node->left = recursiveBuild(leftshapes);
-        node->right = recursiveBuild(rightshapes);
+        node->splitAxis = dim;
+        node->left = recursiveBuild(leftshapes, depth + 1, nodes);
+        node->right = recursiveBuild(rightshapes, depth + 1, nodes);
 
         node->bounds = Union(node->left->bounds, node->right->bounds);
         node->area = node->left->area + node->right->area;
@@ -96,9 +246,327 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
     return node;
 }
 
+BVHBuildNode* BVHAccel::makeLeaf(const Reference& ref, MemoryArena& nodes)
+{
+    BVHBuildNode* node = nodes.New<BVHBuildNode>();
+    node->bounds = ref.bounds;
+    node->object = ref.object;
+    node->area = ref.object->getArea();
+    node->nPrimitives = 1;
+    return node;
+}
+
+// 叶子只放一个图元, 遍历代码与 NAIVE 构建的树完全相同.
+// 每个节点分别求出最优的物体划分与空间划分, 取 SAH 代价较小的一个
+BVHBuildNode* BVHAccel::sahBuild(std::vector<Reference>& refs, int depth, MemoryArena& nodes)
+{
+    if (refs.size() == 1)
+        return makeLeaf(refs[0], nodes);
+    if (lazy && depth == lazyDepth && (int)refs.size() > lazyMinPrimitives)
+        return makeLazy(std::move(refs), nodes);
+
+    Bounds3 bounds, centroidBounds;
+    for (auto& ref : refs) {
+        bounds = Union(bounds, ref.bounds);
+        centroidBounds = Union(centroidBounds, ref.bounds.Centroid());
+    }
+    float invArea = 1 / std::max(surfaceArea(bounds), 1e-12f);
+    int n = refs.size();
+
+    // 1. 物体划分: 按质心分桶, 在桶的边界上求 SAH 代价
+    float bestCost = std::numeric_limits<float>::infinity();
+    int objectAxis = -1, objectBin = 0;
+    Bounds3 objectLeft, objectRight;
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = axisMin(centroidBounds, axis), hi = axisMax(centroidBounds, axis);
+        if (!(hi > lo))
+            continue;
+        Bounds3 binBounds[kObjectBins];
+        int binCount[kObjectBins] = {};
+        float scale = kObjectBins / (hi - lo);
+        for (auto& ref : refs) {
+            int b = std::min(kObjectBins - 1, (int)((axisCentroid(ref.bounds, axis) - lo) * scale));
+            binBounds[b] = Union(binBounds[b], ref.bounds);
+            ++binCount[b];
+        }
+        // 从右往左扫一遍得到每个划分右侧的包围盒与数量
+        Bounds3 rightBounds[kObjectBins];
+        int rightCount[kObjectBins] = {};
+        Bounds3 acc;
+        int count = 0;
+        for (int b = kObjectBins - 1; b > 0; --b) {
+            acc = Union(acc, binBounds[b]);
+            count += binCount[b];
+            rightBounds[b] = acc;
+            rightCount[b] = count;
+        }
+        acc = Bounds3();
+        count = 0;
+        for (int b = 1; b < kObjectBins; ++b) {
+            acc = Union(acc, binBounds[b - 1]);
+            count += binCount[b - 1];
+            if (count == 0 || rightCount[b] == 0)
+                continue;
+            float cost = kTraversalCost +
+                (surfaceArea(acc) * count + surfaceArea(rightBounds[b]) * rightCount[b]) * invArea;
+            if (cost < bestCost) {
+                bestCost = cost;
+                objectAxis = axis;
+                objectBin = b;
+                objectLeft = acc;
+                objectRight = rightBounds[b];
+            }
+        }
+    }
+
+    // 2. 空间划分: 只在物体划分的两侧明显重叠, 且还有复制预算时尝试
+    int spatialAxis = -1;
+    float spatialPosition = 0;
+    float overlap = objectAxis >= 0 ? surfaceArea(intersectBounds(objectLeft, objectRight)) : surfaceArea(bounds);
+    if (duplicatesLeft > 0 && depth < 64 &&
+        overlap / std::max(surfaceArea(rootBounds), 1e-12f) > kOverlapThreshold) {
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = axisMin(bounds, axis), hi = axisMax(bounds, axis);
+            if (!(hi > lo))
+                continue;
+            float binWidth = (hi - lo) / kSpatialBins;
+            Bounds3 binBounds[kSpatialBins];
+            int entries[kSpatialBins] = {}, exits[kSpatialBins] = {};
+            auto binOf = [&](float x) { return std::clamp((int)((x - lo) / binWidth), 0, kSpatialBins - 1); };
+
+            // 把每个引用依次在它跨越的桶边界上切开, 每一段的包围盒计入对应的桶
+            for (auto& ref : refs) {
+                int first = binOf(axisMin(ref.bounds, axis));
+                int last = binOf(axisMax(ref.bounds, axis));
+                Bounds3 rest = ref.bounds;
+                for (int b = first; b < last; ++b) {
+                    Bounds3 left, right;
+                    ref.object->splitBounds(axis, lo + (b + 1) * binWidth, left, right);
+                    binBounds[b] = Union(binBounds[b], intersectBounds(left, rest));
+                    rest = intersectBounds(right, rest);
+                }
+                binBounds[last] = Union(binBounds[last], rest);
+                ++entries[first];
+                ++exits[last];
+            }
+
+            Bounds3 rightBounds[kSpatialBins];
+            int rightCount[kSpatialBins] = {};
+            Bounds3 acc;
+            int count = 0;
+            for (int b = kSpatialBins - 1; b > 0; --b) {
+                acc = Union(acc, binBounds[b]);
+                count += exits[b];
+                rightBounds[b] = acc;
+                rightCount[b] = count;
+            }
+            acc = Bounds3();
+            count = 0;
+            for (int b = 1; b < kSpatialBins; ++b) {
+                acc = Union(acc, binBounds[b - 1]);
+                count += entries[b - 1];
+                // 一侧包含全部引用的划分没有进展
+                if (count == 0 || rightCount[b] == 0 || (count == n && rightCount[b] == n))
+                    continue;
+                float cost = kTraversalCost +
+                    (surfaceArea(acc) * count + surfaceArea(rightBounds[b]) * rightCount[b]) * invArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    spatialAxis = axis;
+                    spatialPosition = lo + b * binWidth;
+                }
+            }
+        }
+    }
+
+    std::vector<Reference> left, right;
+    if (spatialAxis >= 0) {
+        int axis = spatialAxis;
+        float pos = spatialPosition;
+        Bounds3 leftBounds, rightBounds;
+        for (auto& ref : refs) {
+            if (axisMax(ref.bounds, axis) <= pos)
+                leftBounds = Union(leftBounds, ref.bounds);
+            else if (axisMin(ref.bounds, axis) >= pos)
+                rightBounds = Union(rightBounds, ref.bounds);
+        }
+        int nl = 0, nr = 0;
+        for (auto& ref : refs) {
+            if (axisMax(ref.bounds, axis) <= pos) {
+                left.push_back(ref);
+                ++nl;
+            }
+            else if (axisMin(ref.bounds, axis) >= pos) {
+                right.push_back(ref);
+                ++nr;
+            }
+        }
+        // 跨越平面的引用: 比较切开与整个放到一侧 (unsplitting) 的代价, 选代价最小的
+        for (auto& ref : refs) {
+            if (axisMax(ref.bounds, axis) <= pos || axisMin(ref.bounds, axis) >= pos)
+                continue;
+            Bounds3 l, r;
+            ref.object->splitBounds(axis, pos, l, r);
+            l = intersectBounds(l, ref.bounds);
+            r = intersectBounds(r, ref.bounds);
+
+            float costSplit = surfaceArea(Union(leftBounds, l)) * (nl + 1) + surfaceArea(Union(rightBounds, r)) * (nr + 1);
+            float costLeft = surfaceArea(Union(leftBounds, ref.bounds)) * (nl + 1) + surfaceArea(rightBounds) * nr;
+            float costRight = surfaceArea(leftBounds) * nl + surfaceArea(Union(rightBounds, ref.bounds)) * (nr + 1);
+            if (duplicatesLeft > 0 && costSplit < costLeft && costSplit < costRight) {
+                left.push_back({ref.object, l});
+                right.push_back({ref.object, r});
+                leftBounds = Union(leftBounds, l);
+                rightBounds = Union(rightBounds, r);
+                ++nl;
+                ++nr;
+                --duplicatesLeft;
+            }
+            else if (costLeft <= costRight) {
+                left.push_back(ref);
+                leftBounds = Union(leftBounds, ref.bounds);
+                ++nl;
+            }
+            else {
+                right.push_back(ref);
+                rightBounds = Union(rightBounds, ref.bounds);
+                ++nr;
+            }
+        }
+        // unsplitting 之后也可能一侧为空或没有进展, 这时退回物体划分
+        if (left.empty() || right.empty() || ((int)left.size() == n && (int)right.size() == n)) {
+            left.clear();
+            right.clear();
+        }
+    }
+
+    if (left.empty() || right.empty()) {
+        left.clear();
+        right.clear();
+        if (objectAxis >= 0) {
+            float lo = axisMin(centroidBounds, objectAxis), hi = axisMax(centroidBounds, objectAxis);
+            float scale = kObjectBins / (hi - lo);
+            for (auto& ref : refs) {
+                int b = std::min(kObjectBins - 1, (int)((axisCentroid(ref.bounds, objectAxis) - lo) * scale));
+                (b < objectBin ? left : right).push_back(ref);
+            }
+        }
+        // 质心重合等无法按桶划分的情况, 按质心排序后取中位数
+        if (left.empty() || right.empty()) {
+            left.clear();
+            right.clear();
+            int axis = centroidBounds.maxExtent();
+            std::sort(refs.begin(), refs.end(), [axis](const Reference& a, const Reference& b) {
+                return axisCentroid(a.bounds, axis) < axisCentroid(b.bounds, axis);
+            });
+            left.assign(refs.begin(), refs.begin() + n / 2);
+            right.assign(refs.begin() + n / 2, refs.end());
+        }
+    }
+
+    // 子树构建完之前释放当前层的引用, 降低递归时的峰值内存
+    std::vector<Reference>().swap(refs);
+
+    BVHBuildNode* node = nodes.New<BVHBuildNode>();
+    node->splitAxis = spatialAxis >= 0 ? spatialAxis : std::max(objectAxis, 0);
+    node->left = sahBuild(left, depth + 1, nodes);
+    node->right = sahBuild(right, depth + 1, nodes);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
+
+BVHBuildNode* BVHAccel::makeLazy(std::vector<Reference> refs, MemoryArena& nodes)
+{
+    BVHBuildNode* node = nodes.New<BVHBuildNode>();
+    node->area = 0;
+    for (auto& ref : refs) {
+        node->bounds = Union(node->bounds, ref.bounds);
+        node->area += ref.object->getArea();
+    }
+    node->nPrimitives = -1;
+    node->firstPrimOffset = lazySubtrees.size();
+
+    auto subtree = std::make_unique<LazySubtree>();
+    subtree->refs = std::move(refs);
+    lazySubtrees.push_back(std::move(subtree));
+    return node;
+}
+
+BVHBuildNode* BVHAccel::expand(const BVHBuildNode* node) const
+{
+    LazySubtree& subtree = *lazySubtrees[node->firstPrimOffset];
+    if (BVHBuildNode* built = subtree.root.load(std::memory_order_acquire))
+        return built;
+    std::call_once(subtree.once, [&]() {
+        BVHBuildNode* built;
+        // 从 lazyDepth + 1 层开始构建, 子树内部不会再产生占位节点
+        auto* self = const_cast<BVHAccel*>(this);
+        subtree.arena = std::make_unique<MemoryArena>(MemoryCategory::BVHNodes,
+                                                      2 * subtree.refs.size() * sizeof(BVHBuildNode));
+        if (splitMethod == SplitMethod::NAIVE) {
+            std::vector<Object*> objects;
+            objects.reserve(subtree.refs.size());
+            for (auto& ref : subtree.refs)
+                objects.push_back(ref.object);
+            built = self->recursiveBuild(std::move(objects), lazyDepth + 1, *subtree.arena);
+        }
+        else {
+            built = self->sahBuild(subtree.refs, lazyDepth + 1, *subtree.arena);
+        }
+        std::vector<Reference>().swap(subtree.refs);
+        subtree.root.store(built, std::memory_order_release);
+    });
+    return subtree.root.load(std::memory_order_acquire);
+}
+
+BVHAccel::~BVHAccel() = default;
+
+void BVHAccel::reorderNodes(Layout layout)
+{
+    std::vector<BVHBuildNode*> order, frontier;
+    if (layout == Layout::VEB)
+        vebOrder(root, treeHeight(root), order, frontier);
+    assert(frontier.empty());
+
+    std::unordered_map<const BVHBuildNode*, BVHBuildNode*> remap;
+    auto nodes = std::make_unique<MemoryArena>(MemoryCategory::BVHNodes, order.size() * sizeof(BVHBuildNode));
+    auto* array = static_cast<BVHBuildNode*>(nodes->Alloc(order.size() * sizeof(BVHBuildNode), alignof(BVHBuildNode)));
+    for (size_t i = 0; i < order.size(); ++i) {
+        new (&array[i]) BVHBuildNode(*order[i]);
+        remap[order[i]] = &array[i];
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (array[i].left)
+            array[i].left = remap.at(array[i].left);
+        if (array[i].right)
+            array[i].right = remap.at(array[i].right);
+    }
+    root = remap.at(root);
+    arena = std::move(nodes);
+}
+
+void BVHAccel::Compress()
+{
+    if (!root)
+        return;
+    compressed = std::make_unique<CompressedBVH>(root);
+    root = nullptr;
+    arena.reset();
+}
+
+Bounds3 BVHAccel::WorldBound() const
+{
+    if (compressed)
+        return compressed->WorldBound();
+    return root ? root->bounds : Bounds3();
+}
+
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
     Intersection isect;
+    if (compressed)
+        return compressed->Intersect(ray);
     if (!root)
         return isect;
     isect = BVHAccel::getIntersection(root, ray);
@@ -121,12 +589,20 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
         return intersection;
     }
 
+    // 延迟构建的子树, 第一次被光线击中时才构建
+    if (node->nPrimitives < 0)
+        return getIntersection(expand(node), ray);
+
     // 叶子节点
     if (!node->left && !node->right) {
         // test intersection with all objs, return closest intersection
         return node->object->getIntersection(ray);
     }
 
+    // 先遍历左子树, 同时预取右子节点, 让它在左子树遍历期间进入缓存
+#if defined(__GNUC__)
+    __builtin_prefetch(node->right);
+#endif
     auto leftInters = getIntersection(node->left, ray);
     auto rightInters = getIntersection(node->right, ray);
 
@@ -134,11 +610,166 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
     return leftInters.distance < rightInters.distance ? leftInters : rightInters;
 }
 
+bool BVHAccel::IntersectP(const Ray& ray) const
+{
+    if (compressed)
+        return compressed->IntersectP(ray);
+    if (!root)
+        return false;
+
+    constexpr int kStackSize = 128;
+    const BVHBuildNode* stack[kStackSize];
+    int top = 0;
+    stack[top++] = root;
+    float tMax = (float)ray.t_max;
+    while (top > 0) {
+        const BVHBuildNode* node = stack[--top];
+        float tEnter;
+        if (!hitBounds(node->bounds, ray, tMax, tEnter))
+            continue;
+        if (node->nPrimitives < 0) {
+            stack[top++] = expand(node);
+        }
+        else if (!node->left && !node->right) {
+            if (node->object->IntersectP(ray))
+                return true;
+        }
+        else if (top + 2 > kStackSize) {
+            if (getIntersection(const_cast<BVHBuildNode*>(node), ray).happened)
+                return true;
+        }
+        else {
+            // 与 IntersectBatch 相同, 先访问光线方向上较近的子节点
+            bool leftFirst = (&ray.direction.x)[node->splitAxis] >= 0;
+            stack[top++] = leftFirst ? node->right : node->left;
+            stack[top++] = leftFirst ? node->left : node->right;
+        }
+    }
+    return false;
+}
+
+void BVHAccel::IntersectBatch(const Ray* rays, size_t count, Intersection* hits) const
+{
+    if (compressed || !root) {
+        for (size_t i = 0; i < count; ++i)
+            hits[i] = Intersect(rays[i]);
+        return;
+    }
+
+    // 每条光线的遍历状态: 显式的节点栈代替递归, 一次只处理一个节点.
+    // 处理完之后预取栈顶 (这条光线下一次要访问的节点), 然后切换到下一条光线,
+    // 等轮转回来时节点已经在缓存中
+    constexpr int kStackSize = 128;
+    struct Lane {
+        size_t ray;
+        int top;
+        const BVHBuildNode* stack[kStackSize];
+    };
+    Lane lanes[kInterleavedRays];
+    // 推迟求交的物体 (Object::defersBatch) 与到达它的光线
+    std::vector<std::pair<Object*, size_t>> deferred;
+
+    size_t next = 0;
+    auto start = [&](Lane& lane) {
+        if (next >= count)
+            return false;
+        lane.ray = next++;
+        hits[lane.ray] = Intersection();
+        lane.stack[0] = root;
+        lane.top = 1;
+        prefetchNode(root);
+        return true;
+    };
+
+    int active = 0;
+    while (active < kInterleavedRays && start(lanes[active]))
+        ++active;
+
+    int i = 0;
+    while (active > 0) {
+        Lane& lane = lanes[i];
+        const Ray& ray = rays[lane.ray];
+        Intersection& hit = hits[lane.ray];
+        const BVHBuildNode* node = lane.stack[--lane.top];
+
+        float tEnter;
+        if (hitBounds(node->bounds, ray, std::min((float)hit.distance, (float)ray.t_max), tEnter)) {
+            if (node->nPrimitives < 0) {
+                lane.stack[lane.top++] = expand(node);
+            }
+            else if (!node->left && !node->right) {
+                if (node->object->defersBatch()) {
+                    deferred.emplace_back(node->object, lane.ray);
+                }
+                else {
+                    Intersection isect = node->object->getIntersection(ray);
+                    if (isect.happened && isect.distance < hit.distance)
+                        hit = isect;
+                }
+            }
+            else if (lane.top + 2 > kStackSize) {
+                // 极不平衡的树: 剩下的部分退回递归遍历
+                Intersection isect = getIntersection(const_cast<BVHBuildNode*>(node), ray);
+                if (isect.happened && isect.distance < hit.distance)
+                    hit = isect;
+            }
+            else {
+                // 光线方向上较近的子节点后入栈, 先被访问, 找到交点后可以剔除较远的子树
+                bool leftFirst = (&ray.direction.x)[node->splitAxis] >= 0;
+                lane.stack[lane.top++] = leftFirst ? node->right : node->left;
+                lane.stack[lane.top++] = leftFirst ? node->left : node->right;
+            }
+        }
+
+        if (lane.top > 0) {
+            prefetchNode(lane.stack[lane.top - 1]);
+        }
+        else if (!start(lane)) {
+            // 这条通道没有光线了, 用最后一条通道填补
+            lane = lanes[--active];
+            if (i >= active)
+                i = 0;
+            continue;
+        }
+        i = i + 1 < active ? i + 1 : 0;
+    }
+
+    if (deferred.empty())
+        return;
+    // 按物体分组, 每个物体一次处理所有到达它的光线. SBVH 中同一物体可能出现在多个叶子里, 先去重.
+    // 光线的 t_max 收缩到已经找到的交点, 物体只需要寻找更近的交点
+    std::sort(deferred.begin(), deferred.end());
+    deferred.erase(std::unique(deferred.begin(), deferred.end()), deferred.end());
+    std::vector<Ray> batch;
+    std::vector<Intersection> batchHits;
+    for (size_t begin = 0, end; begin < deferred.size(); begin = end) {
+        Object* object = deferred[begin].first;
+        for (end = begin; end < deferred.size() && deferred[end].first == object; ++end)
+            ;
+        batch.clear();
+        for (size_t k = begin; k < end; ++k) {
+            size_t r = deferred[k].second;
+            batch.push_back(rays[r]);
+            batch.back().t_max = std::min(rays[r].t_max, hits[r].distance);
+        }
+        batchHits.assign(batch.size(), Intersection());
+        object->IntersectBatch(batch.data(), batch.size(), batchHits.data());
+        for (size_t k = begin; k < end; ++k) {
+            const Intersection& isect = batchHits[k - begin];
+            Intersection& hit = hits[deferred[k].second];
+            if (isect.happened && isect.distance < hit.distance)
+                hit = isect;
+        }
+    }
+}
 
 void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
+    if (node->nPrimitives < 0)
+        node = expand(node);
     if(node->left == nullptr || node->right == nullptr){
         node->object->Sample(pos, pdf);
-        pdf *= node->area;
+        // SBVH 中一个图元可能出现在多个叶子里, 按叶子选中它的总概率是图元面积 / 总面积
+        pdf *= node->object->getArea();
         return;
     }
     if(p < node->left->area) getSample(node->left, p, pos, pdf);
@@ -146,7 +777,11 @@ void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &
 }
 
 void BVHAccel::Sample(Intersection &pos, float &pdf){
-    float p = std::sqrt(get_random_float()) * root->area;
+    if (compressed) {
+        compressed->Sample(pos, pdf);
+        return;
+    }
+    float p = get_random_float() * root->area;
     getSample(root, p, pos, pdf);
     pdf /= root->area;
 }
\ No newline at end of file
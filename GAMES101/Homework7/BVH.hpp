@@ -6,6 +6,7 @@
 #define RAYTRACING_BVH_H
 
 #include <atomic>
+#include <mutex>
 #include <vector>
 #include <memory>
 #include <ctime>
@@ -14,6 +15,8 @@
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Vector.hpp"
+#include "MemoryArena.hpp"
+#include "CompressedBVH.hpp"
 
 struct BVHBuildNode;
 // BVHAccel Forward Declarations
@@ -25,7 +28,27 @@ class BVHAccel {
 
 public:
     // BVHAccel Public Types
-    enum class SplitMethod { NAIVE, SAH };
+    // NAIVE: 沿质心跨度最大的轴取中位数划分
+    // SAH:   按表面积启发式 (surface area heuristic) 在分桶的质心上选择最优的物体划分
+    // SBVH:  Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies".
+    //        在 SAH 物体划分之外还考虑空间划分: 跨越切分平面的图元被切开, 两侧各放一个引用,
+    //        对墙面地面这样的大三角形可以消除子节点包围盒的重叠. 引用的复制数量受 duplicationBudget 限制
+    enum class SplitMethod { NAIVE, SAH, SBVH };
+    // 构建完成后节点在内存中的排列方式
+    // DEPTH_FIRST: 构建时的分配顺序 (先序), 右子节点往往离父节点很远
+    // VEB:         van Emde Boas 布局, 递归地把上半棵树与下面的各个子树分别放在连续的内存中,
+    //              与缓存行/页的大小无关 (cache-oblivious), 每次下降都更可能落在已加载的缓存中
+    enum class Layout { DEPTH_FIRST, VEB };
+    // 之后构建的 BVH 使用的布局
+    static inline Layout defaultLayout = Layout::VEB;
+    // 之后构建的 BVH 是否在构建完成后转换为 CompressedBVH
+    static inline bool defaultCompression = false;
+    // 之后构建的 BVH 是否延迟构建: 只构建前 lazyDepth 层, 更深的子树在第一次有光线到达时才构建.
+    // 对 SBVH 无效 (复制引用之后叶子的面积需要整棵树的信息), 延迟构建的树也不做重排与压缩
+    static inline bool defaultLazy = false;
+    static inline int lazyDepth = 6;
+    // 图元数不超过该值的子树直接构建
+    static inline int lazyMinPrimitives = 64;
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
@@ -34,22 +57,67 @@ public:
 
     Intersection Intersect(const Ray &ray) const;
     Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
+    // 遮挡查询: ray 在 t_max 之前是否击中任何图元, 找到第一个交点就返回, 不需要最近的交点
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    // 批量求交, 结果与逐条调用 Intersect 相同. 每个线程交错遍历 kInterleavedRays 条光线:
+    // 一条光线访问一个节点之后预取它的下一个节点并切换到另一条光线, 让多次访存同时进行,
+    // 隐藏大场景中每个节点的缓存缺失延迟. 叶子中的物体 (例如 NAIVE 场景 BVH 中的网格) 仍逐条求交
+    void IntersectBatch(const Ray* rays, size_t count, Intersection* hits) const;
+    static constexpr int kInterleavedRays = 8;
+    BVHBuildNode* root = nullptr;
 
     // BVHAccel Private Methods
-    BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    // 节点从 nodes 中分配; depth 等于 lazyDepth 时 (且开启了延迟构建) 返回一个占位节点
+    BVHBuildNode* recursiveBuild(std::vector<Object*>objects, int depth, MemoryArena& nodes);
+
+    // SAH / SBVH 构建时的图元引用. 同一个图元被空间划分切开后会有多个引用, 各自带着被裁剪的包围盒
+    struct Reference {
+        Object* object;
+        Bounds3 bounds;
+    };
+    BVHBuildNode* sahBuild(std::vector<Reference>& refs, int depth, MemoryArena& nodes);
+    BVHBuildNode* makeLeaf(const Reference& ref, MemoryArena& nodes);
+    // 复制引用的上限为图元数的 duplicationBudget 倍, 用完之后只做物体划分
+    float duplicationBudget = 0.3f;
+    int duplicatesLeft = 0;
+    Bounds3 rootBounds;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<Object*> primitives;
+    // 所有节点都从 arena 中分配, 随 BVHAccel 一起释放.
+    // n 个图元的二叉树最多有 2n - 1 个节点, 第一个块按此预留, 所有节点连续存放
+    std::unique_ptr<MemoryArena> arena;
+    // 按 layout 把所有节点复制到一块新的连续内存中, 然后释放构建时的 arena
+    void reorderNodes(Layout layout);
+
+    // 延迟构建的子树. 占位节点的 nPrimitives 为 -1, firstPrimOffset 是它在 lazySubtrees 中的下标,
+    // bounds 与 area 已经算好. 第一个到达的线程在 once 下构建, 其他线程等待构建完成.
+    // 子树的节点放在它自己的 arena 中, 多个子树可以同时在不同线程中构建
+    struct LazySubtree {
+        std::once_flag once;
+        std::vector<Reference> refs;
+        std::unique_ptr<MemoryArena> arena;
+        // 构建完成后才写入, 之后的光线直接读取, 不再经过 once
+        std::atomic<BVHBuildNode*> root{nullptr};
+    };
+    std::vector<std::unique_ptr<LazySubtree>> lazySubtrees;
+    bool lazy = false;
+    BVHBuildNode* makeLazy(std::vector<Reference> refs, MemoryArena& nodes);
+    // 返回占位节点对应的子树, 需要时先构建
+    BVHBuildNode* expand(const BVHBuildNode* node) const;
+
+    // 转换为量化的 4 叉树并释放二叉树的节点, 之后 root 为空, 求交与采样都使用 compressed
+    void Compress();
+    std::unique_ptr<CompressedBVH> compressed;
 
     void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
     void Sample(Intersection &pos, float &pdf);
 };
 
-struct BVHBuildNode {
+// 每个节点恰好占一个缓存行
+struct alignas(64) BVHBuildNode {
     Bounds3 bounds;
     BVHBuildNode *left;
     BVHBuildNode *right;
@@ -65,6 +133,7 @@ public:
         object = nullptr;
     }
 };
+static_assert(sizeof(BVHBuildNode) == 64, "BVHBuildNode should fill exactly one cache line");
 
 
 
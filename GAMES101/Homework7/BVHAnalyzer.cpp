@@ -0,0 +1,204 @@
+// BVH 质量分析工具
+//
+// 加载场景, 把所有网格展开成三角形, 用每种 SplitMethod 各构建一棵 BVH, 输出
+//   - 构建时间与内存占用
+//   - SAH 代价: 内部节点按 kTraversalCost, 叶子按图元数, 以相对根节点的表面积加权求和
+//   - 叶子的平均/最大深度, 叶子图元数直方图
+//   - 兄弟节点重叠率: 两个子节点包围盒交集的表面积 / 父节点表面积, 对所有内部节点取平均
+//   - 转换为量化 4 叉树 (CompressedBVH) 之后的内存与遍历耗时
+//   - 主光线的遍历统计与耗时 (--bvh-layout 可以比较节点布局的影响), 并把每个像素访问的节点数写成热度图 <output>_<method>.ppm
+//
+// 用法: ./BVHAnalyzer [--scene bunny|cornellbox|caustics] [渲染器的相机/分辨率参数] [--output heatmap.ppm]
+
+#include <chrono>
+#include <map>
+#include "Options.hpp"
+#include "Scenes.hpp"
+
+namespace {
+
+constexpr float kTraversalCost = 0.125f;
+
+float surfaceArea(const Bounds3& b)
+{
+    Vector3f d = b.Diagonal();
+    if (d.x < 0 || d.y < 0 || d.z < 0)
+        return 0;
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+}
+
+struct TreeStats {
+    int nodes = 0, leaves = 0;
+    int maxDepth = 0;
+    double depthSum = 0;
+    double sahCost = 0;
+    double overlapSum = 0;
+    std::map<int, int> leafSizes;
+};
+
+void collect(const BVHBuildNode* node, int depth, float rootArea, TreeStats& stats)
+{
+    ++stats.nodes;
+    float area = surfaceArea(node->bounds) / rootArea;
+    if (!node->left && !node->right) {
+        int prims = std::max(1, node->nPrimitives);
+        ++stats.leaves;
+        ++stats.leafSizes[prims];
+        stats.depthSum += depth;
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+        stats.sahCost += area * prims;
+        return;
+    }
+    stats.sahCost += area * kTraversalCost;
+    Bounds3 overlap = node->left->bounds;
+    overlap.pMin = Vector3f::Max(overlap.pMin, node->right->bounds.pMin);
+    overlap.pMax = Vector3f::Min(overlap.pMax, node->right->bounds.pMax);
+    stats.overlapSum += surfaceArea(overlap) / std::max(surfaceArea(node->bounds), 1e-12f);
+    collect(node->left, depth + 1, rootArea, stats);
+    collect(node->right, depth + 1, rootArea, stats);
+}
+
+// 与 BVHAccel::getIntersection 相同的遍历, 额外统计访问的节点数与图元求交次数
+Intersection traverse(const BVHBuildNode* node, const Ray& ray, int& visited, int& primTests)
+{
+    ++visited;
+    std::array<int, 3> dirIsNeg = {ray.direction.x > 0, ray.direction.y > 0, ray.direction.z > 0};
+    if (!node->bounds.IntersectP(ray, ray.direction_inv, dirIsNeg))
+        return Intersection();
+    if (!node->left && !node->right) {
+        ++primTests;
+        return node->object->getIntersection(ray);
+    }
+    Intersection l = traverse(node->left, ray, visited, primTests);
+    Intersection r = traverse(node->right, ray, visited, primTests);
+    return l.distance < r.distance ? l : r;
+}
+
+// 蓝 -> 青 -> 绿 -> 黄 -> 红
+Vector3f heatColor(float t)
+{
+    static const Vector3f ramp[] = {Vector3f(0, 0, 0.5f), Vector3f(0, 0.6f, 1), Vector3f(0, 0.8f, 0),
+                                    Vector3f(1, 0.9f, 0), Vector3f(1, 0, 0)};
+    t = clamp(0, 1, t) * 4;
+    int i = std::min(3, (int)t);
+    return lerp(ramp[i], ramp[i + 1], t - i);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    RenderOptions options;
+    options.output = "bvh_heatmap.ppm";
+    std::string error;
+    if (!ParseOptions(args, options, error)) {
+        std::cerr << error << "\n";
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    BVHAccel::defaultLayout = options.bvhLayout;
+    // 分析工具需要遍历完整的二叉树, 压缩后的大小在统计完成后单独计算
+    BVHAccel::defaultCompression = false;
+    BVHAccel::defaultLazy = false;
+
+    Scene scene(784, 784);
+    BuildScene(options.sceneName, scene);
+
+    std::vector<Object*> prims;
+    for (auto* obj : scene.get_objects())
+        obj->getPrimitives(prims);
+
+    int width = std::max(1, (int)std::lround((options.width > 0 ? options.width : scene.width) * options.resolutionScale));
+    int height = std::max(1, (int)std::lround((options.height > 0 ? options.height : scene.height) * options.resolutionScale));
+    const Camera& camera = options.camera;
+    float scale = std::tan(camera.fov * 0.5f * M_PI / 180);
+    float aspect = width / (float)height;
+
+    struct Variant {
+        const char* name;
+        BVHAccel::SplitMethod method;
+    };
+    const Variant variants[] = {{"naive", BVHAccel::SplitMethod::NAIVE},
+                                {"sah", BVHAccel::SplitMethod::SAH},
+                                {"sbvh", BVHAccel::SplitMethod::SBVH}};
+
+    std::vector<std::vector<int>> heatmaps;
+    int maxVisited = 1;
+    printf("%zu primitives, %d x %d primary rays\n\n", prims.size(), width, height);
+    printf("%-6s %9s %8s %8s %9s %7s %9s %9s %10s %10s %9s %9s\n", "method", "build ms", "nodes", "leaves",
+           "memory KB", "SAH", "avg depth", "max depth", "overlap", "nodes/ray", "prims/ray", "trace ms");
+
+    for (auto& variant : variants) {
+        auto start = std::chrono::steady_clock::now();
+        BVHAccel bvh(prims, 1, variant.method);
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        TreeStats stats;
+        collect(bvh.root, 0, std::max(surfaceArea(bvh.root->bounds), 1e-12f), stats);
+
+        std::vector<int> heat(width * height);
+        long long visitedSum = 0, primSum = 0;
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                float x = (2 * (i + 0.5f) / width - 1) * aspect * scale;
+                float y = (1 - 2 * (j + 0.5f) / height) * scale;
+                int visited = 0, primTests = 0;
+                traverse(bvh.root, Ray(camera.eye, camera.Direction(x, y)), visited, primTests);
+                heat[j * width + i] = visited;
+                visitedSum += visited;
+                primSum += primTests;
+                maxVisited = std::max(maxVisited, visited);
+            }
+        }
+        double traceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        heatmaps.push_back(std::move(heat));
+
+        // 同一棵树转换为量化 4 叉树后的内存与遍历耗时
+        bvh.Compress();
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                float x = (2 * (i + 0.5f) / width - 1) * aspect * scale;
+                float y = (1 - 2 * (j + 0.5f) / height) * scale;
+                bvh.Intersect(Ray(camera.eye, camera.Direction(x, y)));
+            }
+        }
+        double compressedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-6s %9.1f %8d %8d %9.1f %7.2f %9.2f %9d %9.2f%% %10.2f %9.2f %9.1f\n", variant.name, buildMs,
+               stats.nodes, stats.leaves, stats.nodes * sizeof(BVHBuildNode) / 1024.0, stats.sahCost,
+               stats.depthSum / stats.leaves, stats.maxDepth,
+               100 * stats.overlapSum / std::max(1, stats.nodes - stats.leaves),
+               (double)visitedSum / (width * height), (double)primSum / (width * height), traceMs);
+        printf("       compressed: %zu nodes, %.1f KB, trace %.1f ms\n", bvh.compressed->NodeCount(),
+               bvh.compressed->MemoryBytes() / 1024.0, compressedMs);
+        printf("       leaf sizes:");
+        for (auto& [size, count] : stats.leafSizes)
+            printf(" %d:%d", size, count);
+        printf("\n");
+    }
+
+    // 所有热度图使用相同的色阶, 便于直接比较
+    std::string base = options.output.substr(0, options.output.find_last_of('.'));
+    for (size_t v = 0; v < heatmaps.size(); ++v) {
+        std::string filename = base + "_" + variants[v].name + ".ppm";
+        FILE* fp = fopen(filename.c_str(), "wb");
+        if (!fp) {
+            perror(filename.c_str());
+            continue;
+        }
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+        for (int value : heatmaps[v]) {
+            Vector3f c = heatColor((float)value / maxVisited);
+            unsigned char color[3] = {(unsigned char)(255 * c.x), (unsigned char)(255 * c.y),
+                                      (unsigned char)(255 * c.z)};
+            fwrite(color, 1, 3, fp);
+        }
+        fclose(fp);
+    }
+    printf("\nHeatmaps written to %s_*.ppm (max %d nodes per ray)\n", base.c_str(), maxVisited);
+    return 0;
+}
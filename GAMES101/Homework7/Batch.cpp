@@ -0,0 +1,174 @@
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "Batch.hpp"
+#include "MaterialOverride.hpp"
+#include "Renderer.hpp"
+
+bool LoadBatch(const std::string& filename, const RenderOptions& defaults,
+               std::vector<RenderOptions>& jobs, std::string& error)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        error = "Cannot open batch file " + filename;
+        return false;
+    }
+
+    RenderOptions base = defaults;
+    base.batchFile.clear();
+
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); ++lineNo) {
+        std::istringstream ss(line);
+        std::vector<std::string> args;
+        for (std::string token; ss >> token; )
+            args.push_back(token);
+        if (args.empty() || args[0][0] == '#')
+            continue;
+
+        RenderOptions job = base;
+        if (!ParseOptions(args, job, error)) {
+            error = filename + ":" + std::to_string(lineNo) + ": " + error;
+            return false;
+        }
+        if (!job.batchFile.empty()) {
+            error = filename + ":" + std::to_string(lineNo) + ": nested --batch is not supported";
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+std::unique_ptr<Scene> MakeJobScene(const Scene& base, const RenderOptions& job, std::string& error)
+{
+    auto scene = std::make_unique<Scene>(base.width, base.height);
+    scene->fov = job.camera.fov;
+    scene->backgroundColor = base.backgroundColor;
+    scene->maxDepth = base.maxDepth;
+    scene->RussianRoulette = base.RussianRoulette;
+    scene->useLightBVH = job.useLightBVH;
+    scene->solidAngleSampling = job.solidAngleSampling;
+    scene->splitMethod = job.bvhSplit;
+    scene->lodDepth = job.lodDepth;
+    scene->environment = base.environment;
+    scene->causticMap = base.causticMap;
+    scene->objects = base.objects;
+    scene->namedObjects = base.namedObjects;
+    scene->namedMaterials = base.namedMaterials;
+
+    for (auto& [name, value] : job.materialOverrides) {
+        auto it = base.namedObjects.find(name);
+        if (it == base.namedObjects.end()) {
+            error = "Unknown object " + name;
+            return nullptr;
+        }
+
+        Material* mt = nullptr;
+        Vector3f kd;
+        auto named = base.namedMaterials.find(value);
+        if (named != base.namedMaterials.end()) {
+            mt = named->second;
+        }
+        else if (sscanf(value.c_str(), "%f,%f,%f", &kd.x, &kd.y, &kd.z) == 3) {
+            // 复制原来的材质, 只替换漫反射颜色
+            mt = scene->CreateMaterial(*it->second.material);
+            mt->Kd = kd;
+            mt->diffuseTexture = nullptr;
+        }
+        else if (value.size() > 4 && value.compare(value.size() - 4, 4, ".ppm") == 0) {
+            // 复制原来的材质, 漫反射颜色改用纹理 (按物体的纹理坐标贴图)
+            auto texture = Texture::Load(value, error);
+            if (!texture)
+                return nullptr;
+            mt = scene->CreateMaterial(*it->second.material);
+            mt->diffuseTexture = texture;
+        }
+        else {
+            error = "Unknown material " + value;
+            return nullptr;
+        }
+
+        auto* wrapper = scene->Create<MaterialOverride>(it->second.object, mt);
+        for (auto& obj : scene->objects) {
+            if (obj == it->second.object)
+                obj = wrapper;
+        }
+        scene->namedObjects[name] = {wrapper, mt};
+    }
+
+    scene->buildBVH();
+    return scene;
+}
+
+void RenderBatch(const Scene& base, const std::vector<RenderOptions>& jobs, int threads, ThreadPinning pinning)
+{
+    struct Job {
+        std::unique_ptr<Scene> scene;
+        std::unique_ptr<Renderer> renderer;
+        std::unique_ptr<Film> film;
+        std::vector<Tile> tiles;
+        std::atomic<int> remaining{0};
+    };
+
+    // 先为所有任务建好场景与 film, 每个任务只需要为少量顶层物体构建 BVH
+    std::vector<std::unique_ptr<Job>> queue;
+    std::vector<std::pair<int, int>> items; // (任务, tile)
+    for (auto& options : jobs) {
+        std::string error;
+        auto job = std::make_unique<Job>();
+        job->scene = MakeJobScene(base, options, error);
+        if (!job->scene) {
+            std::cerr << options.output << ": " << error << ", skipped\n";
+            continue;
+        }
+        if (options.guidingIterations > 0 || options.timeBudget > 0 || options.workers > 0)
+            std::cerr << options.output << ": --guiding, --time-budget and --workers are ignored in batch mode\n";
+
+        job->renderer = std::make_unique<Renderer>(options);
+        job->film = std::make_unique<Film>(job->renderer->MakeFilm(*job->scene));
+        job->tiles = job->film->Tiles(options.tileSize);
+        job->remaining = job->tiles.size();
+        for (int t = 0; t < (int)job->tiles.size(); ++t)
+            items.emplace_back(queue.size(), t);
+        queue.push_back(std::move(job));
+    }
+    std::cout << "Batch: " << queue.size() << " jobs, " << items.size() << " tiles\n";
+
+    std::atomic<int> next(0);
+    std::atomic<int> finished(0);
+    std::mutex mtx;
+    auto threadFunc = [&](int index) {
+        PinWorkerThread(pinning, index);
+        TileBuffer buffer;
+        for (int k = next++; k < (int)items.size(); k = next++) {
+            Job& job = *queue[items[k].first];
+            const Tile& tile = job.tiles[items[k].second];
+            buffer.Reset(tile);
+            job.renderer->RenderTile(*job.scene, tile, job.renderer->options.spp, buffer);
+            job.film->AddTile(tile, buffer);
+
+            // 完成任务最后一个 tile 的线程负责写出图像并释放 film
+            if (--job.remaining == 0) {
+                job.renderer->WriteOutput(*job.scene, *job.film);
+                job.film.reset();
+                std::lock_guard<std::mutex> lock(mtx);
+                std::cout << "\nWrote " << job.renderer->options.output << "\n";
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            UpdateProgress(1.0 * ++finished / items.size());
+        }
+    };
+
+    int n = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    n = std::min(n, std::max(1, (int)items.size()));
+    std::vector<std::thread> th;
+    for (int i = 0; i < n; ++i)
+        th.emplace_back(threadFunc, i);
+    for (auto& t : th)
+        t.join();
+
+    UpdateProgress(1.f);
+}
@@ -0,0 +1,35 @@
+#ifndef RAYTRACING_BATCH_H
+#define RAYTRACING_BATCH_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Options.hpp"
+#include "Scene.hpp"
+
+// 批量渲染: 场景中的网格与它们的 BVH 只加载/构建一次, 之后所有任务只读地共享.
+//
+// 任务文件每行是一个任务, 语法与命令行参数相同, 在命令行参数的基础上修改, 例如
+//
+//   # 相机机位与材质的几种组合
+//   --output front.ppm --spp 64
+//   --output side.ppm --eye 0,273,-600 --lookat 278,200,300
+//   --output gold.ppm --material bunny=0.9,0.6,0.1 --width 512 --height 512
+//
+// 空行和 # 开头的行会被忽略.
+
+// 读取任务文件, 每个任务以 defaults 为初始值
+bool LoadBatch(const std::string& filename, const RenderOptions& defaults,
+               std::vector<RenderOptions>& jobs, std::string& error);
+
+// 为一个任务创建场景: 共享 base 中的物体, 按 job.materialOverrides 包装需要替换材质的物体,
+// 只为这些顶层物体重新构建 BVH 与 light BVH
+std::unique_ptr<Scene> MakeJobScene(const Scene& base, const RenderOptions& job, std::string& error);
+
+// 所有任务共用一个线程池, 线程从 (任务, tile) 队列中按顺序领取工作,
+// 所以前一个任务的最后几个 tile 与后一个任务的 tile 可以同时渲染.
+// threads 为 0 时使用 std::thread::hardware_concurrency()
+void RenderBatch(const Scene& base, const std::vector<RenderOptions>& jobs, int threads,
+                 ThreadPinning pinning = ThreadPinning::NONE);
+
+#endif //RAYTRACING_BATCH_H
@@ -111,7 +111,8 @@ inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
     float tEnter = std::max(tMinX, std::max(tMinY, tMinZ));
     float tExit = std::min(tMaxX, std::min(tMaxY, tMaxZ));
 
-    return tEnter <= tExit && tExit >= 0;
+    // 包围盒在 ray.t_max 之后时, 里面的交点都会被图元剔除, 不需要进入
+    return tEnter <= tExit && tExit >= 0 && tEnter <= ray.t_max;
 }
 
 inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
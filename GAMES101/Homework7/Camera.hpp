@@ -0,0 +1,24 @@
+#ifndef RAYTRACING_CAMERA_H
+#define RAYTRACING_CAMERA_H
+
+#include "Vector.hpp"
+
+// 针孔相机. 默认参数与原先写死在 Renderer 中的相机一致: 位于 (278, 273, -800), 沿 +z 方向观察
+struct Camera
+{
+    Vector3f eye = Vector3f(278, 273, -800);
+    Vector3f lookAt = Vector3f(278, 273, 0);
+    Vector3f up = Vector3f(0, 1, 0);
+    float fov = 40; // 竖直方向的视角, 单位为度
+
+    // (x, y) 是成像平面上的坐标, 成像平面位于相机前方距离为 1 处
+    Vector3f Direction(float x, float y) const
+    {
+        Vector3f forward = normalize(lookAt - eye);
+        Vector3f right = normalize(crossProduct(forward, up));
+        Vector3f trueUp = crossProduct(right, forward);
+        return normalize(right * x + trueUp * y + forward);
+    }
+};
+
+#endif //RAYTRACING_CAMERA_H
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "BVH.hpp"
+#include "CompressedBVH.hpp"
+#include "MemoryArena.hpp"
+
+namespace {
+
+// 遍历的显式栈深度
+constexpr int kStackSize = 256;
+
+float surfaceArea(const Bounds3& b)
+{
+    Vector3f d = b.Diagonal();
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+}
+
+bool isLeaf(const BVHBuildNode* node) { return !node->left || !node->right; }
+
+void collectLeaves(const BVHBuildNode* node, std::vector<const BVHBuildNode*>& leaves)
+{
+    if (isLeaf(node)) {
+        leaves.push_back(node);
+        return;
+    }
+    collectLeaves(node->left, leaves);
+    collectLeaves(node->right, leaves);
+}
+
+} // namespace
+
+CompressedBVH::CompressedBVH(const BVHBuildNode* root)
+{
+    bounds = root->bounds;
+    collectLeaves(root, leafNodes);
+    float sum = 0;
+    for (auto* leaf : leafNodes) {
+        leafIndex[leaf] = leaves.size();
+        leaves.push_back(leaf->object);
+        sum += leaf->area;
+        leafCdf.push_back(sum);
+    }
+
+    nodes.reserve(leafNodes.size() / 3 + 1);
+    build(root);
+    nodes.shrink_to_fit();
+    leafNodes.clear();
+    leafNodes.shrink_to_fit();
+    leafIndex.clear();
+    TrackMemory(MemoryCategory::BVHNodes, MemoryBytes());
+}
+
+CompressedBVH::~CompressedBVH()
+{
+    TrackMemory(MemoryCategory::BVHNodes, -(long long)MemoryBytes());
+}
+
+uint32_t CompressedBVH::build(const BVHBuildNode* node)
+{
+    // 从 node 的两个子节点开始, 反复展开表面积最大的内部节点, 直到凑满 4 个
+    const BVHBuildNode* children[4];
+    int count = 0;
+    if (isLeaf(node)) {
+        children[count++] = node;
+    }
+    else {
+        children[count++] = node->left;
+        children[count++] = node->right;
+        while (count < 4) {
+            int best = -1;
+            float bestArea = -1;
+            for (int i = 0; i < count; ++i) {
+                if (!isLeaf(children[i]) && surfaceArea(children[i]->bounds) > bestArea) {
+                    best = i;
+                    bestArea = surfaceArea(children[i]->bounds);
+                }
+            }
+            if (best < 0)
+                break;
+            const BVHBuildNode* expanded = children[best];
+            children[best] = expanded->left;
+            children[count++] = expanded->right;
+        }
+    }
+
+    uint32_t index = nodes.size();
+    nodes.emplace_back();
+
+    Bounds3 childBounds[4];
+    uint32_t childIndex[4] = {CompressedNode::kEmpty, CompressedNode::kEmpty, CompressedNode::kEmpty,
+                              CompressedNode::kEmpty};
+    for (int i = 0; i < count; ++i) {
+        childBounds[i] = children[i]->bounds;
+        if (isLeaf(children[i])) {
+            // 叶子在中序列表中的位置
+            childIndex[i] = CompressedNode::kLeaf | leafIndex.at(children[i]);
+        }
+        else {
+            childIndex[i] = build(children[i]);
+        }
+    }
+
+    // build 可能让 nodes 重新分配, 最后再写入当前节点
+    CompressedNode& out = nodes[index];
+    quantize(out, node->bounds, childBounds, count);
+    for (int i = 0; i < 4; ++i)
+        out.child[i] = childIndex[i];
+    return index;
+}
+
+void CompressedBVH::quantize(CompressedNode& node, const Bounds3& parent, const Bounds3* children, int count)
+{
+    node.childCount = count;
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = (&parent.pMin.x)[axis];
+        float extent = (&parent.pMax.x)[axis] - lo;
+        // 2^exponent * 254 >= extent, 留出一格给向外取整
+        int e = extent > 0 ? (int)std::ceil(std::log2(extent / 254)) : -100;
+        e = std::clamp(e, -100, 100);
+        node.origin[axis] = lo;
+        node.exponent[axis] = e;
+        float scale = std::ldexp(1.0f, e);
+
+        for (int i = 0; i < 4; ++i) {
+            if (i >= count) {
+                // 空槽位: 解码后 min > max, 光线永远不会与之相交
+                node.qmin[axis][i] = 255;
+                node.qmax[axis][i] = 0;
+                continue;
+            }
+            float cmin = (&children[i].pMin.x)[axis], cmax = (&children[i].pMax.x)[axis];
+            int qlo = std::clamp((int)std::floor((cmin - lo) / scale), 0, 255);
+            int qhi = std::clamp((int)std::ceil((cmax - lo) / scale), 0, 255);
+            // 浮点舍入可能让解码结果略微偏内, 逐格向外修正
+            while (qlo > 0 && node.Decode(axis, qlo) > cmin)
+                --qlo;
+            while (qhi < 255 && node.Decode(axis, qhi) < cmax)
+                ++qhi;
+            assert(node.Decode(axis, qlo) <= cmin && node.Decode(axis, qhi) >= cmax);
+            node.qmin[axis][i] = qlo;
+            node.qmax[axis][i] = qhi;
+        }
+    }
+}
+
+Intersection CompressedBVH::Intersect(const Ray& ray) const
+{
+    Intersection result;
+    if (!nodes.empty())
+        intersectFrom(0, ray, result);
+    return result;
+}
+
+void CompressedBVH::intersectFrom(uint32_t start, const Ray& ray, Intersection& result) const
+{
+    const float* orig = &ray.origin.x;
+    const float* invDir = &ray.direction_inv.x;
+    float tClosest = std::min((float)ray.t_max, (float)result.distance);
+
+    uint32_t stack[kStackSize];
+    int top = 0;
+    stack[top++] = start;
+    while (top > 0) {
+        const CompressedNode& node = nodes[stack[--top]];
+        float scale[3] = {node.Scale(0), node.Scale(1), node.Scale(2)};
+        for (int i = 0; i < node.childCount; ++i) {
+            float tEnter = 0, tExit = tClosest;
+            for (int axis = 0; axis < 3; ++axis) {
+                float t0 = (node.origin[axis] + node.qmin[axis][i] * scale[axis] - orig[axis]) * invDir[axis];
+                float t1 = (node.origin[axis] + node.qmax[axis][i] * scale[axis] - orig[axis]) * invDir[axis];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                tEnter = std::max(tEnter, t0);
+                tExit = std::min(tExit, t1);
+            }
+            if (tEnter > tExit)
+                continue;
+
+            uint32_t child = node.child[i];
+            if (child & CompressedNode::kLeaf) {
+                Intersection inter = leaves[child & ~CompressedNode::kLeaf]->getIntersection(ray);
+                if (inter.happened && inter.distance < result.distance) {
+                    result = inter;
+                    tClosest = std::min(tClosest, (float)inter.distance);
+                }
+            }
+            else if (top == kStackSize) {
+                // 极不平衡的树: 栈满时这棵子树改为递归遍历
+                intersectFrom(child, ray, result);
+                tClosest = std::min(tClosest, (float)result.distance);
+            }
+            else {
+                stack[top++] = child;
+            }
+        }
+    }
+}
+
+bool CompressedBVH::IntersectP(const Ray& ray) const
+{
+    return !nodes.empty() && occludedFrom(0, ray);
+}
+
+bool CompressedBVH::occludedFrom(uint32_t start, const Ray& ray) const
+{
+    const float* orig = &ray.origin.x;
+    const float* invDir = &ray.direction_inv.x;
+    float tMax = (float)ray.t_max;
+
+    uint32_t stack[kStackSize];
+    int top = 0;
+    stack[top++] = start;
+    while (top > 0) {
+        const CompressedNode& node = nodes[stack[--top]];
+        float scale[3] = {node.Scale(0), node.Scale(1), node.Scale(2)};
+        for (int i = 0; i < node.childCount; ++i) {
+            float tEnter = 0, tExit = tMax;
+            for (int axis = 0; axis < 3; ++axis) {
+                float t0 = (node.origin[axis] + node.qmin[axis][i] * scale[axis] - orig[axis]) * invDir[axis];
+                float t1 = (node.origin[axis] + node.qmax[axis][i] * scale[axis] - orig[axis]) * invDir[axis];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                tEnter = std::max(tEnter, t0);
+                tExit = std::min(tExit, t1);
+            }
+            if (tEnter > tExit)
+                continue;
+
+            uint32_t child = node.child[i];
+            if (child & CompressedNode::kLeaf) {
+                if (leaves[child & ~CompressedNode::kLeaf]->IntersectP(ray))
+                    return true;
+            }
+            else if (top == kStackSize) {
+                if (occludedFrom(child, ray))
+                    return true;
+            }
+            else {
+                stack[top++] = child;
+            }
+        }
+    }
+    return false;
+}
+
+void CompressedBVH::Sample(Intersection& pos, float& pdf) const
+{
+    float total = leafCdf.back();
+    float p = get_random_float() * total;
+    // 与二叉树上的 getSample 一致: 第一个累计面积大于 p 的叶子
+    size_t i = std::min(leaves.size() - 1,
+                        (size_t)(std::upper_bound(leafCdf.begin(), leafCdf.end(), p) - leafCdf.begin()));
+    leaves[i]->Sample(pos, pdf);
+    pdf *= leaves[i]->getArea();
+    pdf /= total;
+}
@@ -0,0 +1,79 @@
+#ifndef RAYTRACING_COMPRESSEDBVH_H
+#define RAYTRACING_COMPRESSEDBVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "Bounds3.hpp"
+#include "Intersection.hpp"
+#include "Object.hpp"
+#include "Ray.hpp"
+
+struct BVHBuildNode;
+
+// 压缩的 4 叉 BVH: 把二叉树每两层合并成一个最多 4 个子节点的节点,
+// 子节点的包围盒用 8 位整数存储, 相对于父节点的量化坐标系:
+//
+//   box = origin + q * 2^exponent,   q in [0, 255]
+//
+// 量化时下界向下取整, 上界向上取整, 并用与遍历时完全相同的解码公式检验,
+// 保证解码出的包围盒一定包含原来的包围盒 (只会多访问节点, 不会漏掉交点).
+// 每个节点 56 字节描述 4 个子节点, 而二叉树每个节点 64 字节, 总内存约为原来的 1/4.
+struct CompressedNode
+{
+    static constexpr uint32_t kLeaf = 0x80000000u;  // child 的最高位表示叶子, 其余位是 leaves 的下标
+    static constexpr uint32_t kEmpty = 0xffffffffu;
+
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t childCount;
+    uint8_t qmin[3][4];  // [轴][子节点]
+    uint8_t qmax[3][4];
+    uint32_t child[4];
+
+    float Scale(int axis) const { return std::ldexp(1.0f, exponent[axis]); }
+    // 遍历时每个节点只计算一次 Scale, 按同样的公式解码
+    float Decode(int axis, uint8_t q) const { return origin[axis] + q * Scale(axis); }
+};
+static_assert(sizeof(CompressedNode) == 56, "unexpected CompressedNode size");
+
+class CompressedBVH
+{
+public:
+    // 从构建好的二叉 BVH 转换, 之后二叉树可以释放
+    explicit CompressedBVH(const BVHBuildNode* root);
+    ~CompressedBVH();
+
+    Intersection Intersect(const Ray& ray) const;
+    // 与 BVHAccel::IntersectP 相同, 找到任意一个交点就返回
+    bool IntersectP(const Ray& ray) const;
+    // 与 BVHAccel::Sample 相同: 按叶子面积选一个图元, 再在图元上均匀采样
+    void Sample(Intersection& pos, float& pdf) const;
+
+    Bounds3 WorldBound() const { return bounds; }
+    size_t NodeCount() const { return nodes.size(); }
+    size_t MemoryBytes() const
+    {
+        return nodes.capacity() * sizeof(CompressedNode) + leaves.capacity() * sizeof(Object*) +
+               leafCdf.capacity() * sizeof(float);
+    }
+
+private:
+    uint32_t build(const BVHBuildNode* node);
+    void quantize(CompressedNode& node, const Bounds3& parent, const Bounds3* children, int count);
+    // 从节点 start 开始遍历, 显式栈满时对剩下的子树递归调用自身
+    void intersectFrom(uint32_t start, const Ray& ray, Intersection& result) const;
+    bool occludedFrom(uint32_t start, const Ray& ray) const;
+
+    Bounds3 bounds;
+    std::vector<CompressedNode> nodes;
+    // 叶子按二叉树的中序排列, leafCdf[i] 是前 i + 1 个叶子的面积之和, 用于按面积采样
+    std::vector<Object*> leaves;
+    std::vector<float> leafCdf;
+    // 只在构建时使用
+    std::vector<const BVHBuildNode*> leafNodes;
+    std::unordered_map<const BVHBuildNode*, uint32_t> leafIndex;
+};
+
+#endif //RAYTRACING_COMPRESSEDBVH_H
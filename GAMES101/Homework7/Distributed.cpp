@@ -0,0 +1,256 @@
+// 多进程分布式渲染
+//
+// coordinator 进程在场景和 BVH 构建完成之后 fork 出若干 worker 进程,
+// worker 通过 copy-on-write 共享场景数据, 不需要重新加载模型.
+// 双方通过 Unix domain socket 通信, 协议是定长的二进制消息:
+//
+//   coordinator -> worker : TileRequest
+//   worker -> coordinator : TileResultHeader + pixelCount 个 float[3] (radiance 之和)
+//                           + pixelCount 个 float (亮度平方和) + pixelCount 个 uint32 (样本数)
+//
+// 协议只依赖一个字节流, 以后把 socketpair 换成 TCP 连接即可扩展到多台机器.
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Renderer.hpp"
+
+namespace {
+
+struct TileRequest {
+    int32_t index; // < 0 表示 worker 应当退出
+    int32_t x0, y0, x1, y1;
+    int32_t spp;
+    uint32_t seed;
+};
+
+struct TileResultHeader {
+    int32_t index;
+    int32_t pixelCount;
+};
+
+bool writeFull(int fd, const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readFull(int fd, void* data, size_t size)
+{
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// worker 进程的主循环: 不断接收 tile, 渲染后把浮点累加结果发回
+void workerLoop(const Renderer& renderer, const Scene& scene, int fd)
+{
+    TileBuffer buffer;
+    std::vector<float> rgb;
+    TileRequest req;
+    while (readFull(fd, &req, sizeof(req)) && req.index >= 0) {
+        Tile tile;
+        tile.index = req.index;
+        tile.x0 = req.x0; tile.y0 = req.y0;
+        tile.x1 = req.x1; tile.y1 = req.y1;
+
+        // 每个 tile 使用固定的种子, 结果与由哪个 worker 渲染无关
+        seed_random(req.seed);
+        buffer.Reset(tile);
+        renderer.RenderTile(scene, tile, req.spp, buffer);
+
+        rgb.resize(3 * tile.pixelCount());
+        for (int i = 0; i < tile.pixelCount(); ++i) {
+            rgb[3 * i + 0] = buffer.sum[i].x;
+            rgb[3 * i + 1] = buffer.sum[i].y;
+            rgb[3 * i + 2] = buffer.sum[i].z;
+        }
+
+        TileResultHeader header{req.index, tile.pixelCount()};
+        if (!writeFull(fd, &header, sizeof(header)) ||
+            !writeFull(fd, rgb.data(), rgb.size() * sizeof(float)) ||
+            !writeFull(fd, buffer.sumSq.data(), buffer.sumSq.size() * sizeof(float)) ||
+            !writeFull(fd, buffer.samples.data(), buffer.samples.size() * sizeof(uint32_t)))
+            break;
+    }
+}
+
+struct Worker {
+    pid_t pid = -1;
+    int fd = -1;
+    int tile = -1; // 正在渲染的 tile, -1 表示空闲
+};
+
+} // namespace
+
+void Renderer::MultiProcessRender(const Scene& scene)
+{
+    // 在 fork 之前训练, worker 进程继承训练好的 guide
+    if (scene.guide && options.guidingIterations > 0)
+        TrainGuide(scene);
+
+    Film film = MakeFilm(scene);
+
+    int spp = options.spp;
+    std::cout << "SPP: " << spp << "\n";
+
+    std::vector<Tile> tiles = film.Tiles(options.tileSize);
+    std::deque<int> pending;
+    for (auto& tile : tiles)
+        pending.push_back(tile.index);
+
+    // 先把缓冲区中的输出刷出去, 否则 fork 之后子进程会重复输出
+    std::cout.flush();
+    fflush(stdout);
+
+    auto spawn = [&](Worker& w) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            perror("socketpair");
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            workerLoop(*this, scene, fds[1]);
+            close(fds[1]);
+            _exit(0);
+        }
+        close(fds[1]);
+        w.pid = pid;
+        w.fd = fds[0];
+        w.tile = -1;
+        return true;
+    };
+
+    auto dispatch = [&](Worker& w) {
+        if (pending.empty() || w.fd < 0)
+            return;
+        const Tile& tile = tiles[pending.front()];
+        TileRequest req{tile.index, tile.x0, tile.y0, tile.x1, tile.y1, spp,
+                        options.seed + (uint32_t)tile.index};
+        pending.pop_front();
+        w.tile = tile.index;
+        // 写失败说明 worker 已经退出, 稍后由 poll 检测到并重新排队
+        writeFull(w.fd, &req, sizeof(req));
+    };
+
+    // worker 异常退出时, 把它手上的 tile 放回队列, 并重新启动一个 worker
+    int respawnBudget = 2 * options.workers;
+    auto retire = [&](Worker& w) {
+        if (w.tile >= 0) {
+            std::cerr << "\nWorker " << w.pid << " died, re-queueing tile " << w.tile << "\n";
+            pending.push_front(w.tile);
+        }
+        close(w.fd);
+        waitpid(w.pid, nullptr, 0);
+        w = Worker();
+        if (respawnBudget-- > 0 && !pending.empty() && spawn(w))
+            dispatch(w);
+    };
+
+    std::vector<Worker> workers(std::max(1, options.workers));
+    for (auto& w : workers) {
+        if (spawn(w))
+            dispatch(w);
+    }
+
+    TileBuffer buffer;
+    std::vector<float> rgb;
+    size_t finished = 0;
+    while (finished < tiles.size()) {
+        std::vector<pollfd> pfds;
+        std::vector<Worker*> owners;
+        for (auto& w : workers) {
+            if (w.fd >= 0) {
+                pfds.push_back({w.fd, POLLIN, 0});
+                owners.push_back(&w);
+            }
+        }
+        if (pfds.empty()) {
+            std::cerr << "\nAll workers died, " << tiles.size() - finished << " tiles left unrendered\n";
+            break;
+        }
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            if (!pfds[i].revents)
+                continue;
+            Worker& w = *owners[i];
+
+            TileResultHeader header;
+            if (!readFull(w.fd, &header, sizeof(header)) || header.index != w.tile) {
+                retire(w);
+                continue;
+            }
+            const Tile& tile = tiles[header.index];
+            rgb.resize(3 * tile.pixelCount());
+            buffer.Reset(tile);
+            if (header.pixelCount != tile.pixelCount() ||
+                !readFull(w.fd, rgb.data(), rgb.size() * sizeof(float)) ||
+                !readFull(w.fd, buffer.sumSq.data(), buffer.sumSq.size() * sizeof(float)) ||
+                !readFull(w.fd, buffer.samples.data(), buffer.samples.size() * sizeof(uint32_t))) {
+                retire(w);
+                continue;
+            }
+            for (int k = 0; k < tile.pixelCount(); ++k)
+                buffer.sum[k] = Vector3f(rgb[3 * k], rgb[3 * k + 1], rgb[3 * k + 2]);
+
+            // 每个 tile 只会被完整地合并一次, 合并顺序不影响最终结果
+            film.AddTile(tile, buffer);
+            w.tile = -1;
+            ++finished;
+            UpdateProgress(1.0 * finished / tiles.size());
+
+            dispatch(w);
+        }
+    }
+
+    // 通知所有 worker 退出
+    for (auto& w : workers) {
+        if (w.fd < 0)
+            continue;
+        TileRequest quit{-1, 0, 0, 0, 0, 0, 0};
+        writeFull(w.fd, &quit, sizeof(quit));
+        close(w.fd);
+        waitpid(w.pid, nullptr, 0);
+    }
+
+    UpdateProgress(1.f);
+
+    // save framebuffer to file
+    WriteOutput(scene, film);
+}
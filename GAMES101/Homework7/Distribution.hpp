@@ -0,0 +1,87 @@
+#ifndef RAYTRACING_DISTRIBUTION_H
+#define RAYTRACING_DISTRIBUTION_H
+
+#include <algorithm>
+#include <vector>
+#include "Vector.hpp"
+
+// [0, 1) 上的分段常数分布, 按 func 的值成比例采样, 二分查找 CDF, O(log n)
+class Distribution1D
+{
+public:
+    Distribution1D() = default;
+    explicit Distribution1D(std::vector<float> f) : func(std::move(f)), cdf(func.size() + 1)
+    {
+        int n = (int)func.size();
+        cdf[0] = 0;
+        for (int i = 0; i < n; ++i)
+            cdf[i + 1] = cdf[i] + func[i] / n;
+        integral = cdf[n];
+        // 全为 0 时退化为均匀分布
+        for (int i = 1; i <= n; ++i)
+            cdf[i] = integral > 0 ? cdf[i] / integral : (float)i / n;
+    }
+
+    int Count() const { return (int)func.size(); }
+    float Integral() const { return integral; }
+
+    // 返回 [0, 1) 中的连续样本, pdf 为该点的概率密度, index 为所在的分段
+    float Sample(float u, float& pdf, int& index) const
+    {
+        index = std::clamp((int)(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1, 0, Count() - 1);
+        float width = cdf[index + 1] - cdf[index];
+        float du = width > 0 ? (u - cdf[index]) / width : 0.5f;
+        pdf = integral > 0 ? func[index] / integral : 1;
+        return std::min((index + du) / Count(), 0x1.fffffep-1f);
+    }
+
+    float Pdf(float x) const
+    {
+        int index = std::clamp((int)(x * Count()), 0, Count() - 1);
+        return integral > 0 ? func[index] / integral : 1;
+    }
+
+private:
+    std::vector<float> func, cdf;
+    float integral = 0;
+};
+
+// [0, 1)^2 上的分段常数分布: 先按边缘分布选行 (v), 再按该行的条件分布选列 (u)
+class Distribution2D
+{
+public:
+    Distribution2D() = default;
+    // func 按行存储, width x height
+    Distribution2D(const std::vector<float>& func, int width, int height)
+    {
+        std::vector<float> marginalFunc(height);
+        for (int v = 0; v < height; ++v) {
+            conditional.emplace_back(std::vector<float>(func.begin() + v * width, func.begin() + (v + 1) * width));
+            marginalFunc[v] = conditional.back().Integral();
+        }
+        marginal = Distribution1D(std::move(marginalFunc));
+    }
+
+    // 返回 (u, v), pdf 为 [0, 1)^2 上的概率密度
+    Vector2f Sample(float u0, float u1, float& pdf) const
+    {
+        float pdfV, pdfU;
+        int row, column;
+        float v = marginal.Sample(u1, pdfV, row);
+        float u = conditional[row].Sample(u0, pdfU, column);
+        pdf = pdfU * pdfV;
+        return Vector2f(u, v);
+    }
+
+    float Pdf(float u, float v) const
+    {
+        int row = std::clamp((int)(v * marginal.Count()), 0, marginal.Count() - 1);
+        return marginal.Pdf(v) * conditional[row].Pdf(u);
+    }
+
+private:
+    std::vector<Distribution1D> conditional;
+    Distribution1D marginal;
+};
+
+#endif //RAYTRACING_DISTRIBUTION_H
@@ -0,0 +1,218 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "EnvironmentLight.hpp"
+#include "global.hpp"
+
+namespace {
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// PFM: "PF" (RGB) 或 "Pf" (灰度), scale < 0 表示 little-endian, 扫描线从下往上存储
+bool readPFM(FILE* fp, std::vector<Vector3f>& pixels, int& width, int& height, std::string& error)
+{
+    char type[3] = {};
+    float scale;
+    if (fscanf(fp, "%2s %d %d %f", type, &width, &height, &scale) != 4 || fgetc(fp) == EOF ||
+        type[0] != 'P' || (type[1] != 'F' && type[1] != 'f') || width <= 0 || height <= 0) {
+        error = "bad PFM header";
+        return false;
+    }
+    int channels = type[1] == 'F' ? 3 : 1;
+    std::vector<float> data((size_t)width * height * channels);
+    if (fread(data.data(), sizeof(float), data.size(), fp) != data.size()) {
+        error = "truncated PFM";
+        return false;
+    }
+    bool little = scale < 0;
+    uint16_t probe = 1;
+    bool hostLittle = *reinterpret_cast<unsigned char*>(&probe) == 1;
+    if (little != hostLittle) {
+        for (auto& f : data) {
+            unsigned char* b = reinterpret_cast<unsigned char*>(&f);
+            std::swap(b[0], b[3]);
+            std::swap(b[1], b[2]);
+        }
+    }
+
+    pixels.resize((size_t)width * height);
+    for (int y = 0; y < height; ++y) {
+        const float* row = &data[(size_t)(height - 1 - y) * width * channels];
+        for (int x = 0; x < width; ++x) {
+            const float* p = row + x * channels;
+            pixels[(size_t)y * width + x] = channels == 3 ? Vector3f(p[0], p[1], p[2]) : Vector3f(p[0]);
+        }
+    }
+    return true;
+}
+
+// Radiance RGBE, 支持未压缩与新式的逐扫描线游程编码
+bool readHDR(FILE* fp, std::vector<Vector3f>& pixels, int& width, int& height, std::string& error)
+{
+    char line[256];
+    bool rgbe = false;
+    // 文件头以空行结束
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '\n')
+            break;
+        if (!strncmp(line, "FORMAT=32-bit_rle_rgbe", 22))
+            rgbe = true;
+    }
+    char ySign, xSign, yAxis, xAxis;
+    if (!rgbe || fscanf(fp, " %c%c %d %c%c %d", &ySign, &yAxis, &height, &xSign, &xAxis, &width) != 6 ||
+        fgetc(fp) == EOF || ySign != '-' || yAxis != 'Y' || xSign != '+' || xAxis != 'X' || width <= 0 ||
+        height <= 0) {
+        error = "unsupported HDR header (only -Y +X RGBE images are supported)";
+        return false;
+    }
+
+    pixels.resize((size_t)width * height);
+    std::vector<unsigned char> scanline(4 * width);
+    for (int y = 0; y < height; ++y) {
+        unsigned char head[4];
+        if (fread(head, 1, 4, fp) != 4) {
+            error = "truncated HDR";
+            return false;
+        }
+        if (head[0] == 2 && head[1] == 2 && ((head[2] << 8) | head[3]) == width && width >= 8 && width < 32768) {
+            // 新式游程编码: 四个分量分别编码
+            for (int c = 0; c < 4; ++c) {
+                for (int x = 0; x < width;) {
+                    int count = fgetc(fp);
+                    if (count == EOF) {
+                        error = "truncated HDR";
+                        return false;
+                    }
+                    if (count > 128) {
+                        count -= 128;
+                        int value = fgetc(fp);
+                        if (value == EOF || x + count > width) {
+                            error = "corrupt HDR";
+                            return false;
+                        }
+                        while (count--)
+                            scanline[4 * x++ + c] = (unsigned char)value;
+                    }
+                    else {
+                        if (count == 0 || x + count > width) {
+                            error = "corrupt HDR";
+                            return false;
+                        }
+                        while (count--) {
+                            int value = fgetc(fp);
+                            if (value == EOF) {
+                                error = "truncated HDR";
+                                return false;
+                            }
+                            scanline[4 * x++ + c] = (unsigned char)value;
+                        }
+                    }
+                }
+            }
+        }
+        else {
+            // 未压缩: 已经读入的 4 字节就是第一个像素
+            memcpy(scanline.data(), head, 4);
+            if (fread(scanline.data() + 4, 1, 4 * (width - 1), fp) != 4 * (size_t)(width - 1)) {
+                error = "truncated HDR";
+                return false;
+            }
+        }
+
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* p = &scanline[4 * x];
+            float f = p[3] ? std::ldexp(1.0f, p[3] - (128 + 8)) : 0;
+            pixels[(size_t)y * width + x] = Vector3f(p[0] * f, p[1] * f, p[2] * f);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<EnvironmentLight> EnvironmentLight::Load(const std::string& filename, float scale, float rotation,
+                                                         std::string& error)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        error = "Cannot open " + filename;
+        return nullptr;
+    }
+    std::vector<Vector3f> pixels;
+    int width = 0, height = 0;
+    bool ok = endsWith(filename, ".pfm") ? readPFM(fp, pixels, width, height, error)
+                                         : readHDR(fp, pixels, width, height, error);
+    fclose(fp);
+    if (!ok) {
+        error = filename + ": " + error;
+        return nullptr;
+    }
+    for (auto& p : pixels) {
+        p = p * scale;
+        // NaN / 负值会破坏分布
+        if (!(p.x >= 0 && p.y >= 0 && p.z >= 0 && std::isfinite(p.x + p.y + p.z)))
+            p = Vector3f(0.0f);
+    }
+    return std::make_unique<EnvironmentLight>(std::move(pixels), width, height, rotation * M_PI / 180);
+}
+
+EnvironmentLight::EnvironmentLight(std::vector<Vector3f> p, int w, int h, float rot)
+    : pixels(std::move(p)), width(w), height(h), rotation(rot)
+{
+    std::vector<float> func((size_t)width * height);
+    for (int y = 0; y < height; ++y) {
+        float sinTheta = std::sin(M_PI * (y + 0.5f) / height);
+        for (int x = 0; x < width; ++x)
+            func[(size_t)y * width + x] = luminance(pixels[(size_t)y * width + x]) * sinTheta;
+    }
+    distribution = Distribution2D(func, width, height);
+}
+
+Vector2f EnvironmentLight::toUV(const Vector3f& dir, float& sinTheta) const
+{
+    float cosTheta = clamp(-1, 1, dir.y);
+    sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    float phi = std::atan2(dir.z, dir.x) + rotation;
+    phi -= 2 * M_PI * std::floor(phi / (2 * M_PI));
+    return Vector2f(std::min(phi / (2 * M_PI), 0x1.fffffep-1f), std::acos(cosTheta) / M_PI);
+}
+
+Vector3f EnvironmentLight::fromUV(const Vector2f& uv, float& sinTheta) const
+{
+    float theta = uv.y * M_PI, phi = uv.x * 2 * M_PI - rotation;
+    sinTheta = std::sin(theta);
+    return Vector3f(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+}
+
+const Vector3f& EnvironmentLight::texel(const Vector2f& uv) const
+{
+    int x = std::clamp((int)(uv.x * width), 0, width - 1);
+    int y = std::clamp((int)(uv.y * height), 0, height - 1);
+    return pixels[(size_t)y * width + x];
+}
+
+Vector3f EnvironmentLight::Le(const Vector3f& dir) const
+{
+    float sinTheta;
+    return texel(toUV(dir, sinTheta));
+}
+
+Vector3f EnvironmentLight::Sample(Vector3f& dir, float& pdf) const
+{
+    float pdfUV;
+    Vector2f uv = distribution.Sample(get_random_float(), get_random_float(), pdfUV);
+    float sinTheta;
+    dir = fromUV(uv, sinTheta);
+    pdf = sinTheta > 0 ? pdfUV / (2 * M_PI * M_PI * sinTheta) : 0;
+    return texel(uv);
+}
+
+float EnvironmentLight::Pdf(const Vector3f& dir) const
+{
+    float sinTheta;
+    Vector2f uv = toUV(dir, sinTheta);
+    return sinTheta > 0 ? distribution.Pdf(uv.x, uv.y) / (2 * M_PI * M_PI * sinTheta) : 0;
+}
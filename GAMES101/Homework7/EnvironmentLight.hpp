@@ -0,0 +1,47 @@
+#ifndef RAYTRACING_ENVIRONMENTLIGHT_H
+#define RAYTRACING_ENVIRONMENTLIGHT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Distribution.hpp"
+#include "Vector.hpp"
+
+// 无穷远处的环境光, 经纬度 (equirectangular) 格式的 HDR 图像, +y 朝上.
+// 图像的第 0 行对应正上方 (theta = 0), 列坐标 u 对应方位角 phi = 2 * pi * u.
+//
+// 按 亮度 * sin(theta) 建立二维分段常数分布 (sin(theta) 抵消了经纬度映射在两极的面积压缩),
+// 采样先在边缘分布中选行, 再在该行的条件分布中选列, 各一次二分查找.
+// 立体角上的 pdf = pdf(u, v) / (2 * pi^2 * sin(theta))
+class EnvironmentLight
+{
+public:
+    // 读取 PFM 或 Radiance HDR (.hdr / .pic) 文件, 失败时返回空并设置 error.
+    // scale 乘在所有像素上, rotation 是绕 y 轴的旋转角 (度)
+    static std::unique_ptr<EnvironmentLight> Load(const std::string& filename, float scale, float rotation,
+                                                  std::string& error);
+
+    EnvironmentLight(std::vector<Vector3f> pixels, int width, int height, float rotation);
+
+    // 沿方向 dir (从场景指向无穷远) 到达的 radiance
+    Vector3f Le(const Vector3f& dir) const;
+    // 按亮度采样一个方向, 返回该方向的 radiance, pdf 为立体角测度
+    Vector3f Sample(Vector3f& dir, float& pdf) const;
+    float Pdf(const Vector3f& dir) const;
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    // 方向与 [0, 1)^2 之间的转换
+    Vector2f toUV(const Vector3f& dir, float& sinTheta) const;
+    Vector3f fromUV(const Vector2f& uv, float& sinTheta) const;
+    const Vector3f& texel(const Vector2f& uv) const;
+
+    std::vector<Vector3f> pixels;
+    int width, height;
+    float rotation; // 弧度
+    Distribution2D distribution;
+};
+
+#endif //RAYTRACING_ENVIRONMENTLIGHT_H
@@ -0,0 +1,201 @@
+#ifndef RAYTRACING_FILM_H
+#define RAYTRACING_FILM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+#include "global.hpp"
+
+// 成像平面上的一个矩形块, 像素范围为 [x0, x1) x [y0, y1)
+struct Tile {
+    int index = 0;
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixelCount() const { return width() * height(); }
+};
+
+// 按 tileSize 把像素范围 [x0, x1) x [y0, y1) 切分成若干 tile, 按行优先编号
+inline std::vector<Tile> MakeTiles(int x0, int y0, int x1, int y1, int tileSize)
+{
+    std::vector<Tile> tiles;
+    for (int y = y0; y < y1; y += tileSize) {
+        for (int x = x0; x < x1; x += tileSize) {
+            Tile t;
+            t.index = (int)tiles.size();
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = std::min(x + tileSize, x1);
+            t.y1 = std::min(y + tileSize, y1);
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+inline std::vector<Tile> MakeTiles(int width, int height, int tileSize)
+{
+    return MakeTiles(0, 0, width, height, tileSize);
+}
+
+// 一个 tile 的浮点累加结果: 每个像素的 radiance 之和, 亮度平方和以及样本数
+struct TileBuffer {
+    std::vector<Vector3f> sum;
+    std::vector<float> sumSq;
+    std::vector<uint32_t> samples;
+
+    void Reset(const Tile& tile)
+    {
+        sum.assign(tile.pixelCount(), Vector3f(0.0f));
+        sumSq.assign(tile.pixelCount(), 0.0f);
+        samples.assign(tile.pixelCount(), 0);
+    }
+};
+
+// 图像的累加缓冲. 保存 radiance 之和与样本数而不是平均值,
+// 这样不同线程/进程/批次的结果可以直接相加合并.
+// 只渲染一个裁剪窗口时, film 只覆盖该窗口, (x0, y0) 是它在整幅图像中的位置,
+// tile 的坐标始终是整幅图像中的像素坐标
+class Film
+{
+public:
+    int width, height;
+    int x0 = 0, y0 = 0;
+    std::vector<Vector3f> sum;
+    std::vector<float> sumSq;
+    std::vector<uint32_t> samples;
+
+    Film(int w, int h) : width(w), height(h), sum(w * h), sumSq(w * h, 0.0f), samples(w * h, 0) {}
+    Film(int x0, int y0, int x1, int y1) : Film(x1 - x0, y1 - y0)
+    {
+        this->x0 = x0;
+        this->y0 = y0;
+    }
+
+    std::vector<Tile> Tiles(int tileSize) const
+    {
+        return MakeTiles(x0, y0, x0 + width, y0 + height, tileSize);
+    }
+
+    void AddTile(const Tile& tile, const TileBuffer& buffer)
+    {
+        int k = 0;
+        for (int y = tile.y0 - y0; y < tile.y1 - y0; ++y) {
+            for (int x = tile.x0 - x0; x < tile.x1 - x0; ++x, ++k) {
+                sum[y * width + x] += buffer.sum[k];
+                sumSq[y * width + x] += buffer.sumSq[k];
+                samples[y * width + x] += buffer.samples[k];
+            }
+        }
+    }
+
+    Vector3f Pixel(int i) const
+    {
+        return samples[i] ? sum[i] / (float)samples[i] : Vector3f(0.0f);
+    }
+
+    // 像素均值的相对标准误差 sqrt(Var[L] / n) / E[L], 用来估计该像素的噪声
+    float Noise(int i) const
+    {
+        if (samples[i] < 2)
+            return 1.0f;
+        float n = (float)samples[i];
+        float mean = luminance(sum[i]) / n;
+        float var = std::max(0.0f, sumSq[i] / n - mean * mean);
+        return std::sqrt(var / n) / (mean + 0.01f);
+    }
+
+    float TileNoise(const Tile& tile) const
+    {
+        float total = 0;
+        for (int y = tile.y0 - y0; y < tile.y1 - y0; ++y)
+            for (int x = tile.x0 - x0; x < tile.x1 - x0; ++x)
+                total += Noise(y * width + x);
+        return total / tile.pixelCount();
+    }
+
+    // 把每个像素的噪声估计写成单通道 PFM
+    void WriteNoisePFM(const std::string& filename) const
+    {
+        FILE* fp = fopen(filename.c_str(), "wb");
+        if (!fp) {
+            std::cerr << "Cannot open " << filename << " for writing\n";
+            return;
+        }
+        // 负的 scale 表示 little-endian, PFM 的扫描线从下往上存储
+        (void)fprintf(fp, "Pf\n%d %d\n-1.0\n", width, height);
+        for (int y = height - 1; y >= 0; --y) {
+            for (int x = 0; x < width; ++x) {
+                float v = Noise(y * width + x);
+                fwrite(&v, sizeof(float), 1, fp);
+            }
+        }
+        fclose(fp);
+    }
+
+    // gamma 校正后量化为 8 bit
+    static void ToRGB8(const Vector3f& c, unsigned char* color)
+    {
+        color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, c.x), 0.6f));
+        color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, c.y), 0.6f));
+        color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, c.z), 0.6f));
+    }
+
+    void WritePPM(const std::string& filename) const
+    {
+        FILE* fp = fopen(filename.c_str(), "wb");
+        if (!fp) {
+            std::cerr << "Cannot open " << filename << " for writing\n";
+            return;
+        }
+        (void)fprintf(fp, "P6\n%d %d\n255\n", width, height);
+        for (int i = 0; i < width * height; ++i) {
+            unsigned char color[3];
+            ToRGB8(Pixel(i), color);
+            fwrite(color, 1, 3, fp);
+        }
+        fclose(fp);
+    }
+
+    // 把 film 覆盖的区域贴到一张已有的 frameWidth x frameHeight 的 PPM 图像上, 结果写到 filename.
+    // base 不存在或尺寸不符时, 以黑色的整幅图像为底
+    void WriteIntoPPM(const std::string& base, const std::string& filename,
+                      int frameWidth, int frameHeight) const
+    {
+        std::vector<unsigned char> image(3 * frameWidth * frameHeight, 0);
+        if (FILE* in = fopen(base.c_str(), "rb")) {
+            int w = 0, h = 0, maxval = 0;
+            if (fscanf(in, "P6 %d %d %d", &w, &h, &maxval) == 3 && fgetc(in) != EOF &&
+                w == frameWidth && h == frameHeight && maxval == 255) {
+                if (fread(image.data(), 1, image.size(), in) != image.size())
+                    std::cerr << "Truncated image " << base << "\n";
+            }
+            else {
+                std::cerr << base << " is not a " << frameWidth << "x" << frameHeight
+                          << " binary PPM, writing crop onto black\n";
+            }
+            fclose(in);
+        }
+        else {
+            std::cerr << "Cannot open " << base << ", writing crop onto black\n";
+        }
+
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                ToRGB8(Pixel(y * width + x), &image[3 * ((y0 + y) * frameWidth + x0 + x)]);
+
+        FILE* fp = fopen(filename.c_str(), "wb");
+        if (!fp) {
+            std::cerr << "Cannot open " << filename << " for writing\n";
+            return;
+        }
+        (void)fprintf(fp, "P6\n%d %d\n255\n", frameWidth, frameHeight);
+        fwrite(image.data(), 1, image.size(), fp);
+        fclose(fp);
+    }
+};
+
+#endif //RAYTRACING_FILM_H
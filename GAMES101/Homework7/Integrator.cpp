@@ -0,0 +1,177 @@
+#include "Integrator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include "Scene.hpp"
+#include "SphericalSampling.hpp"
+
+namespace {
+
+// 预览积分器沿镜面最多反弹的次数
+constexpr int kMaxSpecularBounces = 8;
+
+// 从主光线的交点开始沿镜面反射/折射继续, 直到第一个非镜面的交点. ray 与 inter 更新为最后一段光线与它的交点,
+// 超过反弹次数或者 sample 没有给出方向时返回 false
+bool skipSpecular(const Scene& scene, Ray& ray, Intersection& inter)
+{
+    for (int bounce = 0; inter.happened && inter.m->isSpecular(); ++bounce) {
+        if (bounce == kMaxSpecularBounces)
+            return false;
+        Vector3f outDir = inter.m->sample(ray.direction, inter.normal);
+        if (outDir.norm() == 0)
+            return false;
+        outDir = outDir.normalized();
+        Ray outRay(offsetRayOrigin(inter.coords, inter.pError, inter.normal, outDir), outDir);
+        outRay.coneWidth = ray.coneWidth + ray.coneSpread * (float)inter.distance;
+        outRay.coneSpread = ray.coneSpread;
+        ray = outRay;
+        inter = scene.intersect(ray);
+    }
+    return true;
+}
+
+// 与 Scene::castRay 相同, 按光线锥在交点处的宽度选择 mip 层
+Vector3f diffuseColor(const Ray& ray, const Intersection& inter)
+{
+    float footprint = ray.coneWidth + ray.coneSpread * (float)inter.distance;
+    return inter.m->getColorAt(inter.tcoords.x, inter.tcoords.y, footprint * inter.uvScale);
+}
+
+class PathIntegrator : public Integrator
+{
+public:
+    Vector3f Li(const Scene& scene, const Ray& ray, const Intersection& inter) const override
+    {
+        return scene.castRay(ray, 0, inter);
+    }
+};
+
+// 直接光照: 击中的光源本身, 加上非镜面点上对光源与环境光各一次的采样. 没有 BSDF 方向的采样, 不需要 MIS
+class DirectIntegrator : public Integrator
+{
+public:
+    Vector3f Li(const Scene& scene, const Ray& primary, const Intersection& primaryInter) const override
+    {
+        Ray ray = primary;
+        Intersection inter = primaryInter;
+        if (!skipSpecular(scene, ray, inter))
+            return Vector3f(0);
+        if (!inter.happened)
+            return scene.environment ? scene.environment->Le(ray.direction) : Vector3f(0);
+        if (inter.m->hasEmission())
+            return inter.m->getEmission();
+
+        const Vector3f& N = inter.normal;
+        Vector3f kd = diffuseColor(ray, inter);
+        Vector3f L(0);
+
+        Intersection lightInter;
+        float pdf_light = 0.0f;
+        scene.sampleLight(inter, lightInter, pdf_light);
+        if (pdf_light > 0) {
+            Vector3f toLight = lightInter.coords - inter.coords;
+            float dist = toLight.norm();
+            Vector3f dir = toLight / dist;
+            float cosLight = dotProduct(-dir, lightInter.normal);
+            float cosSurface = dotProduct(dir, N);
+            if (cosLight > 0 && cosSurface > 0) {
+                Ray shadow(offsetRayOrigin(inter.coords, inter.pError, N, dir), dir);
+                shadow.t_max = dist * (1 - kShadowEpsilon);
+                if (!scene.IntersectP(shadow))
+                    L += lightInter.emit * inter.m->eval(ray.direction, dir, N, kd) * cosSurface * cosLight /
+                         (dist * dist) / pdf_light;
+            }
+        }
+
+        if (scene.environment) {
+            Vector3f envDir;
+            float pdf_env = 0.0f;
+            Vector3f Le = scene.environment->Sample(envDir, pdf_env);
+            float cosTheta = dotProduct(envDir, N);
+            if (pdf_env > 0 && cosTheta > 0) {
+                Ray envRay(offsetRayOrigin(inter.coords, inter.pError, N, envDir), envDir);
+                if (!scene.IntersectP(envRay))
+                    L += Le * inter.m->eval(ray.direction, envDir, N, kd) * cosTheta / pdf_env;
+            }
+        }
+        return L;
+    }
+};
+
+// 环境光遮蔽: 在交点的法线半球上按余弦采样一个方向, 只问 radius 之内有没有遮挡, 不需要最近的交点
+class AmbientOcclusionIntegrator : public Integrator
+{
+public:
+    explicit AmbientOcclusionIntegrator(float radius) : radius(radius) {}
+
+    Vector3f Li(const Scene& scene, const Ray&, const Intersection& inter) const override
+    {
+        if (!inter.happened)
+            return Vector3f(0);
+        float u = get_random_float(), v = get_random_float();
+        float sinTheta = std::sqrt(u), cosTheta = std::sqrt(1 - u);
+        Vector3f dir = sphericalDirection(inter.normal, sinTheta, cosTheta, 2 * M_PI * v);
+        Ray aoRay(offsetRayOrigin(inter.coords, inter.pError, inter.normal, dir), dir);
+        aoRay.t_max = radius;
+        return scene.IntersectP(aoRay) ? Vector3f(0) : Vector3f(1);
+    }
+
+private:
+    float radius;
+};
+
+class AlbedoIntegrator : public Integrator
+{
+public:
+    Vector3f Li(const Scene& scene, const Ray& primary, const Intersection& primaryInter) const override
+    {
+        Ray ray = primary;
+        Intersection inter = primaryInter;
+        if (!skipSpecular(scene, ray, inter) || !inter.happened)
+            return Vector3f(0);
+        if (inter.m->hasEmission())
+            return Vector3f(1);
+        return diffuseColor(ray, inter);
+    }
+};
+
+class NormalIntegrator : public Integrator
+{
+public:
+    Vector3f Li(const Scene& scene, const Ray& primary, const Intersection& primaryInter) const override
+    {
+        Ray ray = primary;
+        Intersection inter = primaryInter;
+        if (!skipSpecular(scene, ray, inter) || !inter.happened)
+            return Vector3f(0);
+        return inter.normal * 0.5f + Vector3f(0.5f);
+    }
+};
+
+class DepthIntegrator : public Integrator
+{
+public:
+    Vector3f Li(const Scene& scene, const Ray&, const Intersection& inter) const override
+    {
+        if (!inter.happened)
+            return Vector3f(0);
+        Bounds3 bounds = scene.bvh->WorldBound();
+        float diagonal = bounds.Diagonal().norm();
+        return Vector3f(diagonal > 0 ? std::min(1.0f, (float)inter.distance / diagonal) : 0.0f);
+    }
+};
+
+} // namespace
+
+std::unique_ptr<Integrator> MakeIntegrator(IntegratorType type, float aoRadius)
+{
+    switch (type) {
+        case IntegratorType::DIRECT: return std::make_unique<DirectIntegrator>();
+        case IntegratorType::AO: return std::make_unique<AmbientOcclusionIntegrator>(aoRadius);
+        case IntegratorType::ALBEDO: return std::make_unique<AlbedoIntegrator>();
+        case IntegratorType::NORMAL: return std::make_unique<NormalIntegrator>();
+        case IntegratorType::DEPTH: return std::make_unique<DepthIntegrator>();
+        case IntegratorType::PATH: break;
+    }
+    return std::make_unique<PathIntegrator>();
+}
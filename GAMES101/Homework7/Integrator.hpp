@@ -0,0 +1,30 @@
+#ifndef RAYTRACING_INTEGRATOR_H
+#define RAYTRACING_INTEGRATOR_H
+
+#include <memory>
+#include "Vector.hpp"
+
+class Scene;
+struct Intersection;
+struct Ray;
+
+// 每个像素样本的值由积分器计算, Renderer 只负责生成主光线与调度 tile.
+// PATH 是完整的路径追踪 (Scene::castRay), 其余是快速预览用的近似, 只需要很少的光线:
+//   DIRECT: 只有直接光照, 光源与环境光各采样一次, 不追踪间接光
+//   AO:     环境光遮蔽, 余弦加权的方向在 aoRadius 之内被遮挡的比例, 只用遮挡查询
+//   ALBEDO / NORMAL / DEPTH: 第一个交点的漫反射颜色, 法线 (映射到 [0, 1]) 与距离 (除以场景包围盒的对角线),
+//                            可以作为降噪的引导图像. 输出与渲染结果一样经过 Film 的 gamma
+// 镜面 (DIELECTRIC) 没有漫反射颜色, DIRECT / ALBEDO / NORMAL 沿镜面反射/折射继续, 取之后第一个非镜面的交点
+enum class IntegratorType { PATH, DIRECT, AO, ALBEDO, NORMAL, DEPTH };
+
+class Integrator
+{
+public:
+    virtual ~Integrator() = default;
+    // ray 是主光线, inter 是它与场景的交点 (没有击中时 happened 为 false). 多个线程同时调用
+    virtual Vector3f Li(const Scene& scene, const Ray& ray, const Intersection& inter) const = 0;
+};
+
+std::unique_ptr<Integrator> MakeIntegrator(IntegratorType type, float aoRadius);
+
+#endif //RAYTRACING_INTEGRATOR_H
@@ -0,0 +1,146 @@
+// 交互式渐进渲染
+//
+// 每次相机或参数变化后重新开始累加: 先以 1/8, 1/4, 1/2 的分辨率各渲染 1 spp 得到快速的预览,
+// 然后在全分辨率上每轮 1 spp 地累加到 options.spp, 之后空闲等待新的命令.
+// 每一轮结束后把当前图像发布到共享内存 (见 LivePreview.hpp), 渲染线程每完成一个 tile
+// 检查一次命令管道, 有新命令时放弃这一轮剩下的 tile, 已完成的 tile 仍然有效
+// (film 按像素记录样本数, 各像素样本数不同也能正确求平均).
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include "LivePreview.hpp"
+#include "Renderer.hpp"
+
+namespace {
+
+constexpr int kPreviewBlocks[] = {8, 4, 2, 1};
+constexpr int kLevels = sizeof(kPreviewBlocks) / sizeof(kPreviewBlocks[0]);
+
+// 把 film 按最近邻放大到 width x height
+void blit(const Film& film, unsigned char* rgb, int width, int height)
+{
+    for (int y = 0; y < height; ++y) {
+        int fy = std::min(film.height - 1, y * film.height / height);
+        for (int x = 0; x < width; ++x) {
+            int fx = std::min(film.width - 1, x * film.width / width);
+            Film::ToRGB8(film.Pixel(fy * film.width + fx), rgb + 3 * (y * width + x));
+        }
+    }
+}
+
+} // namespace
+
+void Renderer::InteractiveRender(const Scene& scene)
+{
+    // 裁剪窗口与贴图输出只对离线渲染有意义
+    RenderOptions current = options;
+    current.cropX0 = current.cropY0 = current.cropX1 = current.cropY1 = 0;
+    current.baseImage.clear();
+
+    PreviewPublisher preview;
+    if (!preview.Create(options.interactive, FrameWidth(scene), FrameHeight(scene)))
+        return;
+    CommandPipe commands;
+    std::string pipePath = "/tmp/" + options.interactive + ".cmd";
+    if (!commands.Open(pipePath))
+        return;
+    std::cout << "Interactive: image in shared memory /" << options.interactive << ", commands from " << pipePath
+              << "\n  e.g. echo \"--eye 278,273,-600 --fov 30\" > " << pipePath << "; echo quit > " << pipePath
+              << "\n";
+
+    std::mutex pipeMutex;
+    uint64_t generation = 0;
+    int level = 0, done = 0;
+    std::unique_ptr<Renderer> pass;
+    std::unique_ptr<Film> film;
+    std::vector<Tile> tiles;
+
+    bool quit = false;
+    while (!quit) {
+        bool changed = false;
+        std::string line;
+        commands.Pending();
+        while (commands.Next(line)) {
+            std::istringstream in(line);
+            std::vector<std::string> args;
+            for (std::string arg; in >> arg;)
+                args.push_back(arg);
+            if (args.empty())
+                continue;
+
+            if (args[0] == "quit") {
+                quit = true;
+            }
+            else if (args[0] == "save") {
+                if (film)
+                    film->WritePPM(current.output);
+            }
+            else if (args[0] == "reset") {
+                changed = true;
+            }
+            else {
+                RenderOptions next = current;
+                std::string error;
+                if (ParseOptions(args, next, error)) {
+                    current = next;
+                    changed = true;
+                }
+                else {
+                    std::cerr << "Ignoring command \"" << line << "\": " << error << "\n";
+                }
+            }
+        }
+        if (quit)
+            break;
+        if (changed) {
+            ++generation;
+            level = done = 0;
+            film.reset();
+        }
+
+        // 全分辨率已经达到目标样本数, 等待命令
+        if (level == kLevels - 1 && done >= current.spp) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+
+        int block = kPreviewBlocks[level];
+        if (!film) {
+            pass = std::make_unique<Renderer>(current);
+            pass->options.resolutionScale = current.resolutionScale / block;
+            pass->replicas = replicas;
+            film = std::make_unique<Film>(pass->MakeFilm(scene));
+            tiles = film->Tiles(current.tileSize);
+        }
+
+        std::atomic<bool> cancelled(false);
+        pass->ParallelTiles(tiles.size(), [&](int t, TileBuffer& buffer) {
+            if (cancelled)
+                return;
+            buffer.Reset(tiles[t]);
+            pass->RenderTile(scene, tiles[t], 1, buffer);
+            film->AddTile(tiles[t], buffer);
+
+            std::unique_lock<std::mutex> lock(pipeMutex, std::try_to_lock);
+            if (lock.owns_lock() && commands.Pending())
+                cancelled = true;
+        });
+        if (!cancelled)
+            ++done;
+
+        blit(*film, preview.BeginFrame(), preview.Width(), preview.Height());
+        preview.EndFrame(done, block, generation);
+
+        // 低分辨率的每一级只渲染 1 spp
+        if (block > 1 && done >= 1) {
+            ++level;
+            done = 0;
+            film.reset();
+        }
+    }
+
+    if (film)
+        film->WritePPM(current.output);
+}
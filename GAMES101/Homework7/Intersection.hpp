@@ -21,7 +21,11 @@ struct Intersection
     }
     bool happened;
     Vector3f coords;
+    // coords 每个分量的浮点误差上界, 从交点发出光线时按它偏移起点 (offsetRayOrigin)
+    Vector3f pError;
     Vector3f tcoords;
+    // 纹理坐标对表面长度的变化率 (纹理坐标单位 / 世界单位), 用于把光线锥的宽度换算成纹理的查找宽度
+    float uvScale = 0;
     Vector3f normal;
     Vector3f emit;
     double distance;
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <numeric>
+#include "LightBVH.hpp"
+
+LightBVH::LightBVH(const std::vector<Object*>& objects)
+{
+    for (auto* obj : objects) {
+        LightBounds lb = obj->getLightBounds();
+        if (lb.phi > 0) {
+            emitters.push_back(obj);
+            emitterBounds.push_back(lb);
+        }
+    }
+    if (emitters.empty())
+        return;
+
+    std::vector<int> ids(emitters.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    nodes.reserve(2 * emitters.size() - 1);
+    build(ids, 0, ids.size(), 0, 0);
+}
+
+// 与 BVHAccel 的 NAIVE 划分一样, 沿包围盒中心跨度最大的轴按中位数划分
+int LightBVH::build(std::vector<int>& ids, int begin, int end, uint64_t bits, int depth)
+{
+    int index = nodes.size();
+    nodes.emplace_back();
+
+    if (end - begin == 1) {
+        nodes[index].lb = emitterBounds[ids[begin]];
+        nodes[index].emitter = ids[begin];
+        emitterBits[emitters[ids[begin]]] = bits;
+        return index;
+    }
+
+    Bounds3 centroidBounds;
+    for (int i = begin; i < end; ++i)
+        centroidBounds = Union(centroidBounds, emitterBounds[ids[i]].bounds.Centroid());
+    int dim = centroidBounds.maxExtent();
+
+    int mid = (begin + end) / 2;
+    auto centroid = [&](int id) -> const Vector3f { return emitterBounds[id].bounds.Centroid(); };
+    std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end, [&](int a, int b) {
+        return centroid(a)[dim] < centroid(b)[dim];
+    });
+
+    // 路径只能记录 64 层, 光源数量远小于 2^64, 中位数划分不会超过这个深度
+    build(ids, begin, mid, bits, depth + 1);
+    int second = build(ids, mid, end, bits | (1ull << depth), depth + 1);
+
+    nodes[index].secondChild = second;
+    nodes[index].lb = Union(nodes[index + 1].lb, nodes[second].lb);
+    return index;
+}
+
+bool LightBVH::Sample(const Vector3f& p, const Vector3f& n, Object*& light, float& pmf) const
+{
+    if (nodes.empty())
+        return false;
+
+    int index = 0;
+    pmf = 1;
+    while (true) {
+        const Node& node = nodes[index];
+        if (node.emitter >= 0) {
+            if (node.lb.Importance(p, n) <= 0)
+                return false;
+            light = emitters[node.emitter];
+            return true;
+        }
+
+        float c0 = nodes[index + 1].lb.Importance(p, n);
+        float c1 = nodes[node.secondChild].lb.Importance(p, n);
+        if (c0 <= 0 && c1 <= 0)
+            return false;
+
+        float p0 = c0 / (c0 + c1);
+        if (get_random_float() < p0) {
+            index = index + 1;
+            pmf *= p0;
+        }
+        else {
+            index = node.secondChild;
+            pmf *= 1 - p0;
+        }
+    }
+}
+
+float LightBVH::Pmf(const Vector3f& p, const Vector3f& n, Object* light) const
+{
+    auto it = emitterBits.find(light);
+    if (it == emitterBits.end())
+        return 0;
+
+    uint64_t bits = it->second;
+    int index = 0;
+    float pmf = 1;
+    while (nodes[index].emitter < 0) {
+        const Node& node = nodes[index];
+        float c0 = nodes[index + 1].lb.Importance(p, n);
+        float c1 = nodes[node.secondChild].lb.Importance(p, n);
+        if (c0 <= 0 && c1 <= 0)
+            return 0;
+        if (bits & 1) {
+            pmf *= c1 / (c0 + c1);
+            index = node.secondChild;
+        }
+        else {
+            pmf *= c0 / (c0 + c1);
+            index = index + 1;
+        }
+        bits >>= 1;
+    }
+    if (nodes[index].lb.Importance(p, n) <= 0)
+        return 0;
+    return pmf;
+}
@@ -0,0 +1,41 @@
+#ifndef RAYTRACING_LIGHTBVH_H
+#define RAYTRACING_LIGHTBVH_H
+
+#include <unordered_map>
+#include <vector>
+#include "Object.hpp"
+#include "LightBounds.hpp"
+
+// 建立在所有发光图元之上的二叉树 (light BVH / light tree).
+// 采样时从根节点开始, 按两个子节点对着色点的重要性随机选择一侧向下走,
+// 到达叶子时选中一个发光图元, 选择概率 pmf 是沿途各次选择概率的乘积.
+// 这样离着色点近, 朝向着色点, 功率大的光源被选中的概率更高
+class LightBVH
+{
+public:
+    explicit LightBVH(const std::vector<Object*>& emitters);
+
+    bool empty() const { return nodes.empty(); }
+
+    // 为位于 p, 法线为 n 的着色点选择一个发光图元, 返回 false 表示没有可能有贡献的光源
+    bool Sample(const Vector3f& p, const Vector3f& n, Object*& light, float& pmf) const;
+    // Sample 选中 light 的概率, 用于 MIS
+    float Pmf(const Vector3f& p, const Vector3f& n, Object* light) const;
+
+private:
+    struct Node {
+        LightBounds lb;
+        int secondChild = -1; // 第一个子节点紧跟在父节点之后
+        int emitter = -1;     // 叶子节点对应的发光图元, 内部节点为 -1
+    };
+
+    int build(std::vector<int>& ids, int begin, int end, uint64_t bits, int depth);
+
+    std::vector<Object*> emitters;
+    std::vector<LightBounds> emitterBounds;
+    std::vector<Node> nodes;
+    // 每个发光图元从根到叶子的路径, 第 i 位为 1 表示第 i 层走向第二个子节点
+    std::unordered_map<Object*, uint64_t> emitterBits;
+};
+
+#endif //RAYTRACING_LIGHTBVH_H
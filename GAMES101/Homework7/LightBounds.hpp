@@ -0,0 +1,132 @@
+#ifndef RAYTRACING_LIGHTBOUNDS_H
+#define RAYTRACING_LIGHTBOUNDS_H
+
+#include "Bounds3.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+
+// 一组发光图元的空间范围, 法线方向范围与总功率, 用于 light BVH 估计光源对着色点的贡献.
+// 法线方向范围用一个圆锥表示: 所有发光面的法线与 axis 的夹角不超过 theta_o,
+// 发光面向法线两侧 theta_e 以内的方向发光 (漫反射面光源 theta_e = pi / 2)
+struct LightBounds
+{
+    Bounds3 bounds;
+    Vector3f axis = Vector3f(0, 0, 1);
+    float phi = 0;          // 总功率, 取亮度
+    float cosThetaO = -1;   // -1 表示法线可以朝任意方向 (例如球面光源)
+    float cosThetaE = 0;
+
+    // 该组光源对位于 p, 法线为 n 的着色点的重要性 (Conty Estevez & Kulla 2018).
+    // 对 bounds 内的任意点和 cone 内的任意法线都取最乐观的角度, 所以只会高估贡献,
+    // 不会把可能有贡献的光源判为 0
+    float Importance(const Vector3f& p, const Vector3f& n) const
+    {
+        if (phi <= 0)
+            return 0;
+
+        Vector3f pc = 0.5f * (bounds.pMin + bounds.pMax);
+        Vector3f d = p - pc;
+        float d2 = dotProduct(d, d);
+        // 着色点离光源很近时 1 / d^2 没有意义, 用包围盒尺寸限制
+        Vector3f diag = bounds.Diagonal();
+        float r2 = 0.25f * dotProduct(diag, diag);
+        d2 = std::max(d2, std::sqrt(r2));
+        Vector3f wi = normalize(d);
+
+        // 从着色点看包围盒所张的最大角度 theta_b
+        float cosThetaB = -1;
+        if (dotProduct(d, d) > r2)
+            cosThetaB = std::sqrt(std::max(0.0f, 1 - r2 / dotProduct(d, d)));
+        float sinThetaB = safeSqrt(1 - cosThetaB * cosThetaB);
+
+        // 着色点方向与圆锥轴的夹角 theta_w, 减去 theta_o 和 theta_b 之后取余弦
+        float cosThetaW = dotProduct(axis, wi);
+        float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+        float sinThetaO = safeSqrt(1 - cosThetaO * cosThetaO);
+        float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+        if (cosThetaP <= cosThetaE)
+            return 0;
+
+        float importance = phi * cosThetaP / d2;
+
+        // 着色点一侧的入射角
+        if (n.x != 0 || n.y != 0 || n.z != 0) {
+            float cosThetaI = std::fabs(dotProduct(wi, n));
+            float sinThetaI = safeSqrt(1 - cosThetaI * cosThetaI);
+            importance *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+        }
+        return std::max(importance, 0.0f);
+    }
+
+    static float safeSqrt(float x) { return std::sqrt(std::max(0.0f, x)); }
+
+    // cos(max(0, a - b))
+    static float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+    {
+        if (cosA > cosB)
+            return 1;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    // sin(max(0, a - b))
+    static float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+    {
+        if (cosA > cosB)
+            return 0;
+        return sinA * cosB - cosA * sinB;
+    }
+};
+
+// 合并两组光源: 包围盒取并, 功率相加, 法线圆锥取能同时包含两个圆锥的最小圆锥
+inline LightBounds Union(const LightBounds& a, const LightBounds& b)
+{
+    if (a.phi <= 0)
+        return b;
+    if (b.phi <= 0)
+        return a;
+
+    LightBounds ret;
+    ret.bounds = Union(a.bounds, b.bounds);
+    ret.phi = a.phi + b.phi;
+    ret.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+    float thetaA = std::acos(clamp(-1, 1, a.cosThetaO));
+    float thetaB = std::acos(clamp(-1, 1, b.cosThetaO));
+    float thetaD = std::acos(clamp(-1, 1, dotProduct(a.axis, b.axis)));
+    // 一个圆锥已经包含另一个
+    if (std::min(thetaD + thetaB, M_PI) <= thetaA) {
+        ret.axis = a.axis;
+        ret.cosThetaO = a.cosThetaO;
+        return ret;
+    }
+    if (std::min(thetaD + thetaA, M_PI) <= thetaB) {
+        ret.axis = b.axis;
+        ret.cosThetaO = b.cosThetaO;
+        return ret;
+    }
+
+    float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+    if (thetaO >= M_PI) {
+        ret.axis = a.axis;
+        ret.cosThetaO = -1;
+        return ret;
+    }
+
+    // 把 a 的轴朝 b 的轴旋转 thetaO - thetaA
+    float thetaR = thetaO - thetaA;
+    Vector3f wr = crossProduct(a.axis, b.axis);
+    if (dotProduct(wr, wr) < 1e-12f) {
+        ret.axis = a.axis;
+        ret.cosThetaO = -1;
+        return ret;
+    }
+    wr = normalize(wr);
+    // Rodrigues 旋转公式, a.axis 与 wr 垂直
+    ret.axis = normalize(a.axis * std::cos(thetaR) + crossProduct(wr, a.axis) * std::sin(thetaR));
+    ret.cosThetaO = std::cos(thetaO);
+    return ret;
+}
+
+#endif //RAYTRACING_LIGHTBOUNDS_H
@@ -0,0 +1,186 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "LivePreview.hpp"
+
+namespace {
+
+constexpr char kMagic[8] = "RTLIVE1";
+
+size_t segmentSize(int width, int height)
+{
+    return sizeof(PreviewHeader) + 2 * (size_t)width * height * 3;
+}
+
+} // namespace
+
+PreviewPublisher::~PreviewPublisher()
+{
+    if (header) {
+        munmap(header, mappedSize);
+        shm_unlink(shmName.c_str());
+    }
+}
+
+bool PreviewPublisher::Create(const std::string& name, int width, int height)
+{
+    shmName = "/" + name;
+    mappedSize = segmentSize(width, height);
+    int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, mappedSize) != 0) {
+        perror(shmName.c_str());
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    memset(p, 0, mappedSize);
+    header = new (p) PreviewHeader();
+    header->width = width;
+    header->height = height;
+    header->sequence.store(0, std::memory_order_relaxed);
+    // magic 最后写入, 查看器看到 magic 时其他字段已经有效
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, kMagic, sizeof(kMagic));
+    return true;
+}
+
+unsigned char* PreviewPublisher::buffer(uint32_t index) const
+{
+    return reinterpret_cast<unsigned char*>(header + 1) + (size_t)index * header->width * header->height * 3;
+}
+
+unsigned char* PreviewPublisher::BeginFrame()
+{
+    return buffer(header->front ^ 1);
+}
+
+void PreviewPublisher::EndFrame(uint32_t spp, uint32_t blockSize, uint64_t generation)
+{
+    uint64_t seq = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(seq + 1, std::memory_order_relaxed);
+    // 奇数的 sequence 必须在修改头信息之前可见, 缓冲的内容必须在 front 切换之前可见
+    std::atomic_thread_fence(std::memory_order_release);
+    header->front ^= 1;
+    header->spp = spp;
+    header->blockSize = blockSize;
+    header->generation = generation;
+    header->sequence.store(seq + 2, std::memory_order_release);
+}
+
+PreviewReader::~PreviewReader()
+{
+    if (header)
+        munmap(const_cast<PreviewHeader*>(header), mappedSize);
+}
+
+bool PreviewReader::Open(const std::string& name)
+{
+    std::string shmName = "/" + name;
+    int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PreviewHeader)) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    header = static_cast<const PreviewHeader*>(p);
+    mappedSize = st.st_size;
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        mappedSize < segmentSize(header->width, header->height)) {
+        munmap(p, mappedSize);
+        header = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool PreviewReader::Read(std::vector<unsigned char>& rgb, PreviewHeader& info) const
+{
+    if (!header)
+        return false;
+    size_t frameBytes = (size_t)header->width * header->height * 3;
+    rgb.resize(frameBytes);
+    const unsigned char* buffers = reinterpret_cast<const unsigned char*>(header + 1);
+
+    while (true) {
+        uint64_t before = header->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        uint32_t front = header->front;
+        memcpy(rgb.data(), buffers + front * frameBytes, frameBytes);
+        memcpy(info.magic, header->magic, sizeof(info.magic));
+        info.width = header->width;
+        info.height = header->height;
+        info.front = front;
+        info.spp = header->spp;
+        info.blockSize = header->blockSize;
+        info.generation = header->generation;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) == before) {
+            info.sequence.store(before, std::memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+CommandPipe::~CommandPipe()
+{
+    if (fd >= 0) {
+        close(fd);
+        unlink(path.c_str());
+    }
+}
+
+bool CommandPipe::Open(const std::string& pipePath)
+{
+    path = pipePath;
+    if (mkfifo(path.c_str(), 0644) != 0 && errno != EEXIST) {
+        perror(path.c_str());
+        return false;
+    }
+    // 以读写方式打开: 自己也算一个写端, 没有外部写端时 read 返回 EAGAIN 而不是 EOF
+    fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CommandPipe::Pending()
+{
+    if (fd >= 0) {
+        char chunk[256];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            buffered.append(chunk, n);
+    }
+    return buffered.find('\n') != std::string::npos;
+}
+
+bool CommandPipe::Next(std::string& line)
+{
+    size_t eol = buffered.find('\n');
+    if (eol == std::string::npos)
+        return false;
+    line = buffered.substr(0, eol);
+    buffered.erase(0, eol + 1);
+    return true;
+}
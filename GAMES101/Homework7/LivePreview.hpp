@@ -0,0 +1,90 @@
+#ifndef RAYTRACING_LIVEPREVIEW_H
+#define RAYTRACING_LIVEPREVIEW_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 交互模式下渲染器与查看器之间的通信.
+//
+// 图像: POSIX 共享内存 /NAME 中的两块 8 bit RGB 缓冲, 用序号 (seqlock) 同步, 双方都不加锁.
+// 渲染器总是写入当前不可读的那一块, 写完后把 sequence 加 1 (变为奇数), 切换 front, 再加 1.
+// 查看器读取前后各读一次 sequence, 两次相同且为偶数时说明读到的是一帧完整的画面, 否则重读.
+// 渲染器发布一帧只需要一次拷贝, 永远不会等待查看器.
+//
+// 命令: 命名管道 /tmp/NAME.cmd, 每行一条命令, 格式与命令行参数相同 (例如 "--eye 0,300,-600 --fov 30"),
+// 另外支持 "reset" (重新开始累加), "save" (把当前图像写到 --output) 与 "quit".
+
+struct PreviewHeader {
+    char magic[8];
+    uint32_t width, height;
+    std::atomic<uint64_t> sequence;
+    uint32_t front;
+    // 当前画面的每像素样本数与预览块大小 (1 表示全分辨率)
+    uint32_t spp;
+    uint32_t blockSize;
+    uint32_t pad;
+    // 累加重新开始的次数, 查看器可以据此判断相机是否变化过
+    uint64_t generation;
+};
+
+// 渲染器一侧
+class PreviewPublisher
+{
+public:
+    ~PreviewPublisher();
+
+    // 创建 width x height 的共享内存段, 已存在时覆盖
+    bool Create(const std::string& name, int width, int height);
+
+    // 返回可以写入的缓冲 (width * height * 3 字节), 写完后调用 EndFrame 发布
+    unsigned char* BeginFrame();
+    void EndFrame(uint32_t spp, uint32_t blockSize, uint64_t generation);
+
+    int Width() const { return header ? (int)header->width : 0; }
+    int Height() const { return header ? (int)header->height : 0; }
+
+private:
+    unsigned char* buffer(uint32_t index) const;
+
+    std::string shmName;
+    PreviewHeader* header = nullptr;
+    size_t mappedSize = 0;
+};
+
+// 查看器一侧
+class PreviewReader
+{
+public:
+    ~PreviewReader();
+
+    bool Open(const std::string& name);
+    // 读取最新的一帧, 与渲染器的切换冲突时重试. 成功时 info 中是这一帧的头信息 (sequence 之外)
+    bool Read(std::vector<unsigned char>& rgb, PreviewHeader& info) const;
+
+private:
+    const PreviewHeader* header = nullptr;
+    size_t mappedSize = 0;
+};
+
+// 渲染器一侧的命令管道, 所有读取都不阻塞
+class CommandPipe
+{
+public:
+    ~CommandPipe();
+
+    // 创建 (如果不存在) 并打开命名管道
+    bool Open(const std::string& path);
+    // 把管道中已有的数据读入缓冲, 有完整的一行时返回 true
+    bool Pending();
+    // 取出一行完整的命令
+    bool Next(std::string& line);
+
+private:
+    std::string path;
+    int fd = -1;
+    std::string buffered;
+};
+
+#endif //RAYTRACING_LIVEPREVIEW_H
@@ -5,9 +5,13 @@
 #ifndef RAYTRACING_MATERIAL_H
 #define RAYTRACING_MATERIAL_H
 
+#include <memory>
+#include "Texture.hpp"
 #include "Vector.hpp"
 
-enum MaterialType { DIFFUSE, MICROFACET };
+// DIELECTRIC 是光滑的玻璃: 按 Fresnel 系数随机选择镜面反射或折射 (折射率 ior), 是 delta 分布,
+// pdf 与 eval 都返回 0, 由 castRay 单独处理
+enum MaterialType { DIFFUSE, MICROFACET, DIELECTRIC };
 
 class Material{
 private:
@@ -125,16 +129,23 @@ public:
     //Vector3f m_color;
     Vector3f m_emission;
     float ior;
+    // 三角形默认只能从正面 (法线一侧) 击中, 为 true 时背面也可以击中. 玻璃之类光线会从背面穿出的网格需要打开.
+    // 非镜面材质从背面击中时交点的法线翻转到入射的一侧, 镜面保留原本的法线来区分射入与射出
+    bool twoSided = false;
     Vector3f Kd, Ks;
     float specularExponent;
-    //Texture tex;
+    // 非空时漫反射颜色取自纹理, 代替 Kd
+    std::shared_ptr<const Texture> diffuseTexture;
 
     inline Material(MaterialType t=DIFFUSE, Vector3f e=Vector3f(0,0,0));
     inline MaterialType getType();
     //inline Vector3f getColor();
-    inline Vector3f getColorAt(double u, double v);
+    // 纹理坐标 (u, v) 处的漫反射颜色, width 是查找区域在纹理坐标下的宽度 (决定 mip 层). 没有纹理时返回 Kd
+    inline Vector3f getColorAt(double u, double v, float width = 0);
     inline Vector3f getEmission();
     inline bool hasEmission();
+    // 只能沿 sample 给出的离散方向散射 (DIELECTRIC), 无法做光源采样
+    bool isSpecular() const { return m_type == DIELECTRIC; }
 
     // sample a ray by Material properties
     inline Vector3f sample(const Vector3f &wi, const Vector3f &N);
@@ -142,9 +153,18 @@ public:
     inline float pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
     // given a ray, calculate the contribution of this ray
     inline Vector3f eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
+    // 同上, 漫反射颜色使用 kd (例如 getColorAt 的结果) 代替 Kd
+    inline Vector3f eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N, const Vector3f &kd);
 
 };
 
+// 没有指定材质的物体共用的默认材质
+inline Material* DefaultMaterial()
+{
+    static Material material;
+    return &material;
+}
+
 Material::Material(MaterialType t, Vector3f e){
     m_type = t;
     //m_color = c;
@@ -159,8 +179,8 @@ bool Material::hasEmission() {
     else return false;
 }
 
-Vector3f Material::getColorAt(double u, double v) {
-    return Vector3f();
+Vector3f Material::getColorAt(double u, double v, float width) {
+    return diffuseTexture ? diffuseTexture->Lookup(u, v, width) : Kd;
 }
 
 // 按照该材质的性质，给定入射方向与法向量，用某种分布采样一个出射方向
@@ -178,6 +198,15 @@ Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
             
             break;
         }
+        case DIELECTRIC:
+        {
+            // 按 Fresnel 反射率在反射与折射中选择一个, 全反射时 kr = 1
+            float kr;
+            fresnel(wi, N, ior, kr);
+            if (get_random_float() < kr)
+                return reflect(wi, N);
+            return refract(wi, N, ior);
+        }
     }
 }
 
@@ -194,11 +223,17 @@ float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
                 return 0.0f;
             break;
         }
+        case DIELECTRIC:
+            return 0.0f;
     }
 }
 
 // 给定一对入射、出射方向与法向量，计算这种情况下的 f_r 值
 Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
+    return eval(wi, wo, N, Kd);
+}
+
+Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N, const Vector3f &Kd){
     switch(m_type){
         case DIFFUSE:
         {
@@ -245,6 +280,8 @@ Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &
                 return Vector3f(0.0f);
             break;
         }
+        case DIELECTRIC:
+            return Vector3f(0.0f);
     }
 }
 
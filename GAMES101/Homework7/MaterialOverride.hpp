@@ -0,0 +1,72 @@
+#ifndef RAYTRACING_MATERIALOVERRIDE_H
+#define RAYTRACING_MATERIALOVERRIDE_H
+
+#include "Object.hpp"
+#include "Material.hpp"
+
+// 以另一种材质引用一个已有的物体. 几何与 BVH 都来自 inner, 只读共享, 不会复制网格,
+// 所以批量渲染时每个任务可以各自替换材质而不必重新加载模型
+class MaterialOverride : public Object
+{
+public:
+    MaterialOverride(Object* inner, Material* mt) : inner(inner), m(mt) {}
+
+    bool intersect(const Ray& ray) { return inner->intersect(ray); }
+    bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
+    {
+        return inner->intersect(ray, tnear, index);
+    }
+    Intersection getIntersection(Ray ray)
+    {
+        Intersection inter = inner->getIntersection(ray);
+        if (inter.happened)
+            inter.m = m;
+        return inter;
+    }
+    bool IntersectP(const Ray& ray) override { return inner->IntersectP(ray); }
+    bool defersBatch() override { return inner->defersBatch(); }
+    void IntersectBatch(const Ray* rays, size_t count, Intersection* hits) override
+    {
+        inner->IntersectBatch(rays, count, hits);
+        for (size_t i = 0; i < count; ++i) {
+            if (hits[i].happened)
+                hits[i].m = m;
+        }
+    }
+    void getSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index,
+                              const Vector2f& uv, Vector3f& N, Vector2f& st) const
+    {
+        inner->getSurfaceProperties(P, I, index, uv, N, st);
+    }
+    Vector3f evalDiffuseColor(const Vector2f& st) const { return inner->evalDiffuseColor(st); }
+    Bounds3 getBounds() { return inner->getBounds(); }
+    float getArea() { return inner->getArea(); }
+    void Sample(Intersection& pos, float& pdf)
+    {
+        inner->Sample(pos, pdf);
+        pos.emit = m->getEmission();
+    }
+    void SampleSolidAngle(const Vector3f& ref, Intersection& pos, float& pdf)
+    {
+        inner->SampleSolidAngle(ref, pos, pdf);
+        pos.emit = m->getEmission();
+    }
+    bool hasEmit() { return m->hasEmission(); }
+
+    // 替换后的材质发光时, 整个物体作为一个光源按面积采样.
+    // 不知道 inner 各部分的朝向, 法线圆锥取整个球面
+    LightBounds getLightBounds() override
+    {
+        LightBounds lb;
+        lb.bounds = getBounds();
+        lb.cosThetaO = -1;
+        lb.cosThetaE = 0;
+        lb.phi = hasEmit() ? luminance(m->getEmission()) * getArea() * M_PI : 0;
+        return lb;
+    }
+
+    Object* inner;
+    Material* m;
+};
+
+#endif //RAYTRACING_MATERIALOVERRIDE_H
@@ -0,0 +1,124 @@
+#ifndef RAYTRACING_MEMORYARENA_H
+#define RAYTRACING_MEMORYARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 按子系统统计的内存占用 (字节)
+enum class MemoryCategory { Triangles, BVHNodes, Materials, Objects, GeometryCache, Textures, Count };
+
+inline std::atomic<long long> memoryBytes[(int)MemoryCategory::Count];
+
+inline void TrackMemory(MemoryCategory category, long long bytes)
+{
+    memoryBytes[(int)category].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void ReportMemory()
+{
+    static const char* names[] = {"Triangles", "BVH nodes", "Materials", "Objects", "Geo cache", "Textures"};
+    long long total = 0;
+    printf("Memory usage:\n");
+    for (int i = 0; i < (int)MemoryCategory::Count; ++i) {
+        long long bytes = memoryBytes[i].load(std::memory_order_relaxed);
+        total += bytes;
+        printf("  %-10s %10.2f KB\n", names[i], bytes / 1024.0);
+    }
+    printf("  %-10s %10.2f KB\n\n", "Total", total / 1024.0);
+}
+
+// 场景生命周期内使用的 bump allocator.
+// 从大块内存中顺序分配, 不支持单独释放, 整个 arena 析构 (或 Reset) 时一次性释放.
+// 同一批对象在内存中连续存放, 也不会因为反复 new/delete 产生碎片.
+// 非平凡析构的对象会记录析构函数, 在 Reset 或析构时按分配的逆序调用
+class MemoryArena
+{
+public:
+    static constexpr size_t kBlockAlign = 64;
+
+    explicit MemoryArena(MemoryCategory category, size_t blockSize = 256 * 1024)
+        : category(category), blockSize(blockSize) {}
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    ~MemoryArena()
+    {
+        Reset();
+        for (auto& block : blocks) {
+            ::operator delete(block.data, std::align_val_t(kBlockAlign));
+            TrackMemory(category, -(long long)block.size);
+        }
+    }
+
+    // align 不能超过 kBlockAlign
+    void* Alloc(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        while (current < blocks.size()) {
+            size_t aligned = (offset + align - 1) & ~(align - 1);
+            if (aligned + size <= blocks[current].size) {
+                offset = aligned + size;
+                return blocks[current].data + aligned;
+            }
+            // 当前块放不下, 换到下一个已分配的块 (Reset 之后复用)
+            ++current;
+            offset = 0;
+        }
+
+        Block block;
+        block.size = std::max(blockSize, size + align);
+        block.data = static_cast<char*>(::operator new(block.size, std::align_val_t(kBlockAlign)));
+        TrackMemory(category, block.size);
+        blocks.push_back(block);
+        current = blocks.size() - 1;
+        offset = size;
+        return block.data;
+    }
+
+    template <typename T, typename... Args>
+    T* New(Args&&... args)
+    {
+        static_assert(alignof(T) <= kBlockAlign, "over-aligned type");
+        T* obj = new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            destructors.push_back({[](void* p) { static_cast<T*>(p)->~T(); }, obj});
+        return obj;
+    }
+
+    // 析构所有对象, 保留已分配的内存块, 以便下一次构建 (例如动画的下一帧) 直接复用
+    void Reset()
+    {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+            it->first(it->second);
+        destructors.clear();
+        current = 0;
+        offset = 0;
+    }
+
+    size_t BytesReserved() const
+    {
+        size_t total = 0;
+        for (auto& block : blocks)
+            total += block.size;
+        return total;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    MemoryCategory category;
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0, offset = 0;
+    std::vector<std::pair<void (*)(void*), void*>> destructors;
+};
+
+#endif //RAYTRACING_MEMORYARENA_H
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include "Numa.hpp"
+
+namespace {
+
+thread_local int currentNode = -1;
+
+// 解析 sysfs 的 CPU 列表, 例如 "0-3,8-11"
+std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && isdigit((unsigned char)range[0])) {
+            int lo = std::stoi(range);
+            int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+            for (int c = lo; c <= hi; ++c)
+                cpus.push_back(c);
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+bool setAffinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace
+
+NumaTopology::NumaTopology()
+{
+    // 只保留进程允许使用的 CPU (例如被 taskset 或 cgroup 限制时)
+    cpu_set_t allowed;
+    bool haveMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        std::vector<std::pair<int, std::vector<int>>> found;
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit((unsigned char)name[4]))
+                continue;
+            std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus;
+            for (int c : parseCpuList(list))
+                if (!haveMask || CPU_ISSET(c, &allowed))
+                    cpus.push_back(c);
+            // 没有 CPU 的节点 (只有内存) 不能放线程
+            if (!cpus.empty())
+                found.emplace_back(std::stoi(name.substr(4)), std::move(cpus));
+        }
+        closedir(dir);
+        std::sort(found.begin(), found.end());
+        for (auto& node : found)
+            nodes.push_back(std::move(node.second));
+    }
+
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int c = 0; c < n; ++c)
+            if (!haveMask || CPU_ISSET(c, &allowed))
+                cpus.push_back(c);
+        nodes.push_back(cpus);
+    }
+}
+
+const NumaTopology& NumaTopology::Get()
+{
+    static NumaTopology topology;
+    return topology;
+}
+
+int NumaTopology::CpuCount() const
+{
+    int n = 0;
+    for (auto& cpus : nodes)
+        n += cpus.size();
+    return n;
+}
+
+int PinWorkerThread(ThreadPinning mode, int index)
+{
+    if (mode == ThreadPinning::NONE)
+        return currentNode;
+
+    const NumaTopology& topo = NumaTopology::Get();
+    int node = index % topo.NodeCount();
+    if (mode == ThreadPinning::NODE) {
+        if (setAffinity(topo.Cpus(node)))
+            currentNode = node;
+        return currentNode;
+    }
+
+    // 第 k 轮给每个节点各分配一个 CPU, 线程多于 CPU 时从节点的第一个 CPU 重新开始
+    int round = index / topo.NodeCount();
+    const std::vector<int>& cpus = topo.Cpus(node);
+    int cpu = cpus[round % cpus.size()];
+    if (setAffinity({cpu}))
+        currentNode = node;
+    return currentNode;
+}
+
+int CurrentNumaNode()
+{
+    return currentNode;
+}
+
+void RunOnNode(int node, const std::function<void()>& func)
+{
+    std::thread th([&]() {
+        if (setAffinity(NumaTopology::Get().Cpus(node)))
+            currentNode = node;
+        func();
+    });
+    th.join();
+}
@@ -0,0 +1,39 @@
+#ifndef RAYTRACING_NUMA_H
+#define RAYTRACING_NUMA_H
+
+#include <functional>
+#include <vector>
+
+// NUMA 拓扑与线程绑定 (Linux). 拓扑从 /sys/devices/system/node 读取, 绑定用 pthread_setaffinity_np,
+// 不依赖 libnuma. 内存不显式按节点分配, 而是依靠内核的 first-touch 策略:
+// 页面在第一次被写入时分配在写入线程所在的节点上, 所以只要在绑定好的线程中分配并初始化即可
+
+// NONE: 由操作系统调度
+// CORE: 每个线程绑定到一个 CPU, 线程按节点轮流分配, 线程数少于 CPU 数时各节点的负载也均衡
+// NODE: 每个线程绑定到一个节点的所有 CPU, 节点内部仍由操作系统调度
+enum class ThreadPinning { NONE, CORE, NODE };
+
+class NumaTopology
+{
+public:
+    // 进程第一次调用时读取. 没有 NUMA 信息的机器视为只有一个节点
+    static const NumaTopology& Get();
+
+    int NodeCount() const { return (int)nodes.size(); }
+    const std::vector<int>& Cpus(int node) const { return nodes[node]; }
+    int CpuCount() const;
+
+private:
+    NumaTopology();
+    std::vector<std::vector<int>> nodes;
+};
+
+// 按 mode 绑定当前线程, index 是它在线程池中的编号. 返回线程所在的节点, 之后可以用 CurrentNumaNode 查询
+int PinWorkerThread(ThreadPinning mode, int index);
+// 当前线程绑定的节点, 没有绑定时为 -1
+int CurrentNumaNode();
+
+// 在一个绑定到 node 的新线程中执行 func 并等待它完成, func 中首次写入的内存都在该节点上
+void RunOnNode(int node, const std::function<void()>& func);
+
+#endif //RAYTRACING_NUMA_H
@@ -10,6 +10,8 @@
 #include "Bounds3.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
+#include "LightBounds.hpp"
+#include <vector>
 
 class Object
 {
@@ -19,12 +21,43 @@ public:
     virtual bool intersect(const Ray& ray) = 0;
     virtual bool intersect(const Ray& ray, float &, uint32_t &) const = 0;
     virtual Intersection getIntersection(Ray _ray) = 0;
+    // 遮挡查询: ray 在 t_max 之前是否击中这个物体. 默认求最近交点, 包含 BVH 的物体找到任意交点即可返回
+    virtual bool IntersectP(const Ray& ray) { return getIntersection(ray).happened; }
+    // 批量求交 (BVHAccel::IntersectBatch) 时是否把到达这个物体的光线留到遍历结束后, 用 IntersectBatch 一起求交.
+    // 适合单条光线求交代价很高, 批量处理可以分摊的物体, 例如需要从磁盘换入几何数据的网格
+    virtual bool defersBatch() { return false; }
+    virtual void IntersectBatch(const Ray* rays, size_t count, Intersection* hits)
+    {
+        for (size_t i = 0; i < count; ++i)
+            hits[i] = getIntersection(rays[i]);
+    }
     virtual void getSurfaceProperties(const Vector3f &, const Vector3f &, const uint32_t &, const Vector2f &, Vector3f &, Vector2f &) const = 0;
     virtual Vector3f evalDiffuseColor(const Vector2f &) const =0;
     virtual Bounds3 getBounds()=0;
     virtual float getArea()=0;
     virtual void Sample(Intersection &pos, float &pdf)=0;
+    // 从着色点 ref 看去, 按立体角均匀地采样图元上的一点. pdf 与 Sample 一样换算成面积测度, 看不到图元时为 0.
+    // 默认退回与 ref 无关的 Sample
+    virtual void SampleSolidAngle(const Vector3f &, Intersection &pos, float &pdf) { Sample(pos, pdf); }
     virtual bool hasEmit()=0;
+    // 发光图元的包围盒, 法线圆锥与功率, 不发光时 phi 为 0
+    virtual LightBounds getLightBounds()=0;
+    // 把可以单独作为光源采样的发光图元加入 emitters, 网格会展开成其中的三角形
+    virtual void getEmitters(std::vector<Object*>& emitters)
+    {
+        if (hasEmit())
+            emitters.push_back(this);
+    }
+    // 把可以单独放进 BVH 的图元加入 prims, 网格会展开成其中的三角形
+    virtual void getPrimitives(std::vector<Object*>& prims) { prims.push_back(this); }
+    // 用 axis 轴上坐标为 position 的平面把图元切成两部分, 分别求包围盒 (SBVH 的空间划分).
+    // 默认直接切开整个包围盒, 三角形可以按实际的边求出更紧的包围盒
+    virtual void splitBounds(int axis, float position, Bounds3& left, Bounds3& right)
+    {
+        left = right = getBounds();
+        (&left.pMax.x)[axis] = std::min((&left.pMax.x)[axis], position);
+        (&right.pMin.x)[axis] = std::max((&right.pMin.x)[axis], position);
+    }
 };
 
 
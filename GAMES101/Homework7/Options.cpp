@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "Options.hpp"
+
+void PrintUsage(const char* prog)
+{
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --spp N         samples per pixel (default 16)\n"
+              << "  --threads N     render threads (default: all cores)\n"
+              << "  --tile N        tile size in pixels (default 32)\n"
+              << "  --workers N     render with N worker processes\n"
+              << "  --seed N        base random seed of the tiles\n"
+              << "  --time-budget S render progressively for S seconds instead of a fixed spp\n"
+              << "  --scene bunny|cornellbox|caustics\n"
+              << "                  scene to render (default bunny)\n"
+              << "  --integrator path|direct|ao|albedo|normal|depth\n"
+              << "                  full path tracing (default), direct light only, ambient occlusion, or the\n"
+              << "                  first non-specular hit's albedo, normal or distance as a fast preview\n"
+              << "  --ao-radius R   occlusion distance of --integrator ao in scene units (default 100)\n"
+              << "  --output FILE   output image (default binary.ppm)\n"
+              << "  --width N, --height N\n"
+              << "                  output resolution (default: the scene's)\n"
+              << "  --eye X,Y,Z, --lookat X,Y,Z, --up X,Y,Z, --fov DEG\n"
+              << "                  camera (default: eye 278,273,-800 looking down +z, fov 40)\n"
+              << "  --scale F       render at F times the scene resolution\n"
+              << "  --crop X0 Y0 X1 Y1\n"
+              << "                  only render the pixels [X0, X1) x [Y0, Y1) of the full-res image\n"
+              << "  --into FILE     paste the crop into this full-size PPM instead of writing it alone\n"
+              << "  --light-sampler bvh|uniform\n"
+              << "                  pick lights by importance (default) or by area\n"
+              << "  --light-sampling solid-angle|area\n"
+              << "                  sample points on the chosen light uniformly in solid angle (default) or area\n"
+              << "  --bvh naive|sah|sbvh\n"
+              << "                  scene BVH builder: median split, SAH, or SAH with spatial splits\n"
+              << "  --bvh-layout dfs|veb\n"
+              << "                  BVH node order in memory: build order or van Emde Boas (default)\n"
+              << "  --bvh-compress  store BVHs as 4-wide nodes with 8-bit quantized child boxes\n"
+              << "  --bvh-lazy      build BVH subtrees on demand when a ray first reaches them\n"
+              << "  --interactive NAME\n"
+              << "                  render progressively into shared memory /NAME, reading option\n"
+              << "                  lines, reset, save or quit from the pipe /tmp/NAME.cmd\n"
+              << "  --pin none|core|node\n"
+              << "                  pin render threads to single CPUs or to NUMA nodes (round-robin)\n"
+              << "  --replicate-scene\n"
+              << "                  with --pin, load a private copy of the scene on every NUMA node\n"
+              << "  --batched-traversal\n"
+              << "                  intersect each tile's primary rays together, interleaving BVH walks\n"
+              << "  --lod-levels N  build N quadric-simplified levels for large meshes, each half the size\n"
+              << "  --lod-depth N   trace bounces N and deeper against progressively coarser levels\n"
+              << "  --out-of-core DIR\n"
+              << "                  convert meshes into DIR and page their geometry in on demand\n"
+              << "  --ooc-budget MB resident geometry budget for --out-of-core (default 256)\n"
+              << "  --env FILE      light the scene with a lat-long environment map (.pfm or .hdr)\n"
+              << "  --env-scale S   multiply the environment map by S\n"
+              << "  --env-rotate DEG\n"
+              << "                  rotate the environment map around the y axis\n"
+              << "  --caustic-photons N\n"
+              << "                  estimate caustics from a photon map of N emitted photons (default 0: off)\n"
+              << "  --caustic-k K   photons gathered per caustic estimate (default 50)\n"
+              << "  --caustic-radius R\n"
+              << "                  maximum caustic gather radius in scene units (default 10)\n"
+              << "  --guiding N     train a path guiding SD-tree for N progressive passes first\n"
+              << "                  (not counted in --time-budget; ignored with --interactive)\n"
+              << "  --material OBJECT=MATERIAL, --material OBJECT=R,G,B, --material OBJECT=IMAGE.ppm\n"
+              << "                  replace an object's material, its diffuse color or its diffuse texture\n"
+              << "  --two-sided MATERIAL\n"
+              << "                  let rays hit the back faces of triangles using MATERIAL (repeatable)\n"
+              << "  --texture-cache DIR\n"
+              << "                  directory for the tiled mip pyramids of textures (default /tmp)\n"
+              << "  --texture-budget MB\n"
+              << "                  resident texture tile budget shared by all textures (default 64)\n"
+              << "  --batch FILE    render every line of FILE as a job (same options as above)\n"
+              << "                  sharing the loaded meshes and BVHs\n"
+              << "  --trace FILE    write a Chrome trace-event timeline of loading, BVH builds, tiles and\n"
+              << "                  output (needs a build configured with -DRAYTRACING_TRACE=ON)\n";
+}
+
+static bool parseVector(const std::string& s, Vector3f& v)
+{
+    return sscanf(s.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+bool ParseOptions(const std::vector<std::string>& args, RenderOptions& options, std::string& error)
+{
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        auto has = [&](const char* name, size_t count = 1) {
+            if (arg != name)
+                return false;
+            if (i + count >= args.size()) {
+                error = std::string("Missing value for ") + name;
+                return false;
+            }
+            return true;
+        };
+        auto next = [&]() { return args[++i]; };
+
+        if (has("--spp")) options.spp = atoi(next().c_str());
+        else if (has("--threads")) options.threads = atoi(next().c_str());
+        else if (has("--tile")) options.tileSize = std::max(1, atoi(next().c_str()));
+        else if (has("--workers")) options.workers = atoi(next().c_str());
+        else if (has("--seed")) options.seed = (uint32_t)strtoul(next().c_str(), nullptr, 10);
+        else if (has("--time-budget")) options.timeBudget = atof(next().c_str());
+        else if (has("--output")) options.output = next();
+        else if (has("--scene")) {
+            options.sceneName = next();
+            if (options.sceneName != "bunny" && options.sceneName != "cornellbox" && options.sceneName != "caustics") {
+                error = "Unknown scene " + options.sceneName;
+                return false;
+            }
+        }
+        else if (has("--integrator")) {
+            std::string name = next();
+            if (name == "path") options.integrator = IntegratorType::PATH;
+            else if (name == "direct") options.integrator = IntegratorType::DIRECT;
+            else if (name == "ao") options.integrator = IntegratorType::AO;
+            else if (name == "albedo") options.integrator = IntegratorType::ALBEDO;
+            else if (name == "normal") options.integrator = IntegratorType::NORMAL;
+            else if (name == "depth") options.integrator = IntegratorType::DEPTH;
+            else {
+                error = "Unknown integrator " + name;
+                return false;
+            }
+        }
+        else if (has("--ao-radius")) options.aoRadius = atof(next().c_str());
+        else if (has("--width")) options.width = atoi(next().c_str());
+        else if (has("--height")) options.height = atoi(next().c_str());
+        else if (has("--fov")) options.camera.fov = atof(next().c_str());
+        else if (has("--eye") || has("--lookat") || has("--up")) {
+            Vector3f& v = arg == "--eye" ? options.camera.eye
+                        : arg == "--lookat" ? options.camera.lookAt : options.camera.up;
+            if (!parseVector(next(), v)) {
+                error = "Expected X,Y,Z after " + arg;
+                return false;
+            }
+        }
+        else if (has("--scale")) options.resolutionScale = atof(next().c_str());
+        else if (has("--crop", 4)) {
+            options.cropX0 = atoi(next().c_str());
+            options.cropY0 = atoi(next().c_str());
+            options.cropX1 = atoi(next().c_str());
+            options.cropY1 = atoi(next().c_str());
+        }
+        else if (has("--into")) options.baseImage = next();
+        else if (has("--bvh")) {
+            std::string method = next();
+            if (method == "naive") options.bvhSplit = BVHAccel::SplitMethod::NAIVE;
+            else if (method == "sah") options.bvhSplit = BVHAccel::SplitMethod::SAH;
+            else if (method == "sbvh") options.bvhSplit = BVHAccel::SplitMethod::SBVH;
+            else {
+                error = "Unknown BVH method " + method;
+                return false;
+            }
+        }
+        else if (has("--bvh-layout")) {
+            std::string layout = next();
+            if (layout == "dfs") options.bvhLayout = BVHAccel::Layout::DEPTH_FIRST;
+            else if (layout == "veb") options.bvhLayout = BVHAccel::Layout::VEB;
+            else {
+                error = "Unknown BVH layout " + layout;
+                return false;
+            }
+        }
+        else if (has("--bvh-compress", 0)) options.bvhCompression = true;
+        else if (has("--bvh-lazy", 0)) options.bvhLazy = true;
+        else if (has("--interactive")) options.interactive = next();
+        else if (has("--pin")) {
+            std::string mode = next();
+            if (mode == "none") options.pinning = ThreadPinning::NONE;
+            else if (mode == "core") options.pinning = ThreadPinning::CORE;
+            else if (mode == "node") options.pinning = ThreadPinning::NODE;
+            else {
+                error = "Unknown pinning mode " + mode;
+                return false;
+            }
+        }
+        else if (has("--replicate-scene", 0)) options.replicateScene = true;
+        else if (has("--batched-traversal", 0)) options.batchedTraversal = true;
+        else if (has("--lod-levels")) options.lodLevels = atoi(next().c_str());
+        else if (has("--lod-depth")) options.lodDepth = atoi(next().c_str());
+        else if (has("--out-of-core")) options.outOfCoreDir = next();
+        else if (has("--ooc-budget")) options.outOfCoreBudgetMB = atoi(next().c_str());
+        else if (has("--env")) options.environment = next();
+        else if (has("--env-scale")) options.environmentScale = atof(next().c_str());
+        else if (has("--env-rotate")) options.environmentRotation = atof(next().c_str());
+        else if (has("--texture-cache")) options.textureCacheDir = next();
+        else if (has("--texture-budget")) options.textureBudgetMB = atoi(next().c_str());
+        else if (has("--caustic-photons")) options.causticPhotons = atoi(next().c_str());
+        else if (has("--caustic-k")) options.causticK = atoi(next().c_str());
+        else if (has("--caustic-radius")) options.causticRadius = atof(next().c_str());
+        else if (has("--guiding")) options.guidingIterations = atoi(next().c_str());
+        else if (has("--light-sampler")) options.useLightBVH = next() != "uniform";
+        else if (has("--light-sampling")) {
+            std::string mode = next();
+            if (mode == "area") options.solidAngleSampling = false;
+            else if (mode == "solid-angle") options.solidAngleSampling = true;
+            else {
+                error = "Unknown light sampling " + mode;
+                return false;
+            }
+        }
+        else if (has("--material")) {
+            std::string spec = next();
+            size_t eq = spec.find('=');
+            if (eq == std::string::npos) {
+                error = "Expected OBJECT=MATERIAL after --material";
+                return false;
+            }
+            options.materialOverrides.emplace_back(spec.substr(0, eq), spec.substr(eq + 1));
+        }
+        else if (has("--two-sided")) options.twoSidedMaterials.push_back(next());
+        else if (has("--batch")) options.batchFile = next();
+        else if (has("--trace")) options.traceFile = next();
+        else {
+            if (error.empty())
+                error = "Unknown option " + arg;
+            return false;
+        }
+    }
+    return true;
+}
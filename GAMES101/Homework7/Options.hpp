@@ -0,0 +1,116 @@
+#ifndef RAYTRACING_OPTIONS_H
+#define RAYTRACING_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "BVH.hpp"
+#include "Camera.hpp"
+#include "Integrator.hpp"
+#include "Numa.hpp"
+
+struct RenderOptions
+{
+    int spp = 16;
+    int tileSize = 32;
+    // 渲染线程数, 0 表示使用 std::thread::hardware_concurrency()
+    int threads = 0;
+    // 多进程渲染的 worker 进程数, 0 表示不启用多进程渲染
+    int workers = 0;
+    // tile 的随机数种子 = seed + tile.index, 保证多进程渲染的结果可复现
+    uint32_t seed = 0;
+    // 渲染的时间预算(秒), > 0 时忽略 spp, 在截止时间之前渐进地增加样本
+    double timeBudget = 0;
+    std::string output = "binary.ppm";
+    // 渲染的场景 (BuildScene): bunny, cornellbox 或 caustics. 批量任务共享同一个场景, 任务中设置无效
+    std::string sceneName = "bunny";
+
+    // 计算每个样本的积分器, 非 PATH 时是快速预览 (Integrator.hpp)
+    IntegratorType integrator = IntegratorType::PATH;
+    // AO 积分器的遮挡距离, 场景单位
+    float aoRadius = 100.0f;
+
+    Camera camera;
+    // 输出图像的分辨率, 0 表示使用 Scene 中的 width / height
+    int width = 0, height = 0;
+
+    // 分辨率缩放, 例如 0.25 表示以 1/4 的宽高快速预览, 相机参数不变
+    float resolutionScale = 1.0f;
+    // 裁剪窗口 [cropX0, cropX1) x [cropY0, cropY1), 以全分辨率图像的像素为单位; cropX1 <= 0 表示整幅图像
+    int cropX0 = 0, cropY0 = 0, cropX1 = 0, cropY1 = 0;
+    // 非空时, 把裁剪窗口的结果贴到这张已有的整幅图像上再输出
+    std::string baseImage;
+
+    // 直接光照使用 light BVH 选择光源, 否则按面积均匀选择 (对应 Scene::useLightBVH)
+    bool useLightBVH = true;
+    // 在选中的光源上按立体角采样, 否则按面积采样 (对应 Scene::solidAngleSampling)
+    bool solidAngleSampling = true;
+    // 场景顶层 BVH 的构建方法 (对应 Scene::splitMethod)
+    BVHAccel::SplitMethod bvhSplit = BVHAccel::SplitMethod::NAIVE;
+    // 所有 BVH 节点的内存布局 (对应 BVHAccel::defaultLayout), 需要在加载场景之前设置
+    BVHAccel::Layout bvhLayout = BVHAccel::Layout::VEB;
+    // 构建完成后把 BVH 转换为量化的 4 叉树 (对应 BVHAccel::defaultCompression)
+    bool bvhCompression = false;
+    // 只构建 BVH 的前几层, 其余子树在第一次被光线击中时构建 (对应 BVHAccel::defaultLazy)
+    bool bvhLazy = false;
+
+    // 非空时进入交互模式, 图像发布到共享内存 /interactive, 命令从 /tmp/<interactive>.cmd 读取
+    std::string interactive;
+
+    // 渲染线程的绑定方式
+    ThreadPinning pinning = ThreadPinning::NONE;
+    // 为每个 NUMA 节点加载一份场景 (网格, BVH, 材质), 线程只读取所在节点上的副本. 需要同时设置 pinning
+    bool replicateScene = false;
+
+    // 每个 tile 的主光线用交错遍历批量求交 (BVHAccel::IntersectBatch)
+    bool batchedTraversal = false;
+
+    // 大网格额外生成的简化层数 (对应 Scene::lodLevels), 需要在加载场景之前设置
+    int lodLevels = 0;
+    // 从第几次反弹开始使用简化网格 (对应 Scene::lodDepth)
+    int lodDepth = 0;
+
+    // 非空时网格转换为该目录下的磁盘格式, 按需换入内存 (对应 OutOfCoreMesh::cacheDirectory)
+    std::string outOfCoreDir;
+    // 换入内存的几何数据上限, 单位 MB (对应 OutOfCoreMesh::residentBudget)
+    int outOfCoreBudgetMB = 256;
+
+    // 纹理转换成的 mip 金字塔缓存文件所在的目录 (对应 Texture::cacheDirectory)
+    std::string textureCacheDir = "/tmp";
+    // 常驻内存的纹理 tile 上限, 单位 MB (对应 Texture::residentBudget)
+    int textureBudgetMB = 64;
+
+    // 环境光的经纬度 HDR 图像 (.pfm / .hdr), 空表示没有环境光. 只加载一次, 批量任务共享
+    std::string environment;
+    // 环境光的亮度缩放, 以及绕 y 轴旋转的角度 (度)
+    float environmentScale = 1.0f;
+    float environmentRotation = 0.0f;
+
+    // 焦散光子图发射的光子数, 0 表示不使用光子图, 焦散完全由路径追踪计算 (对应 Scene::causticMap)
+    int causticPhotons = 0;
+    // 焦散密度估计使用的最近光子数与最大搜索半径 (对应 PhotonMap::k / maxRadius)
+    int causticK = 50;
+    float causticRadius = 10.0f;
+
+    // path guiding 的训练轮数, 第 i 轮使用 2^i spp, 0 表示不使用 path guiding
+    int guidingIterations = 0;
+
+    // 非空时把各阶段的耗时写成 Chrome trace-event JSON, 需要用 -DRAYTRACING_TRACE=ON 构建
+    std::string traceFile;
+
+    // 这些具名材质的三角形背面也可以被击中 (Material::twoSided), 需要在加载场景之前设置
+    std::vector<std::string> twoSidedMaterials;
+
+    // 批量渲染的任务列表文件, 每行是一个任务的参数
+    std::string batchFile;
+    // 按物体名替换材质, 值为材质名, 或者 "r,g,b" 表示复制原材质并替换其 Kd, 或者 .ppm 图像表示替换为漫反射纹理
+    std::vector<std::pair<std::string, std::string>> materialOverrides;
+};
+
+// 在 options 的基础上解析参数 args, 例如 {"--spp", "64", "--output", "bunny.ppm"}.
+// 出错时把原因写到 error 并返回 false
+bool ParseOptions(const std::vector<std::string>& args, RenderOptions& options, std::string& error);
+void PrintUsage(const char* prog);
+
+#endif //RAYTRACING_OPTIONS_H
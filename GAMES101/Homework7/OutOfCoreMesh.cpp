@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MemoryArena.hpp"
+#include "OutOfCoreMesh.hpp"
+#include "PageCache.hpp"
+#include "RayTriangle.hpp"
+
+namespace {
+
+constexpr char kMagic[8] = "RTOOC01";
+constexpr uint64_t kPageSize = 4096;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t clusterCount, topNodeCount, triangleCount, pad;
+    float bmin[3], bmax[3];
+    float area;
+    uint32_t pad2;
+};
+
+using Node = OutOfCoreMesh::Node;
+using PackedTriangle = OutOfCoreMesh::PackedTriangle;
+
+Vector3f vertex(const PackedTriangle& t, int i) { return Vector3f(t.v[i][0], t.v[i][1], t.v[i][2]); }
+
+float triangleArea(const PackedTriangle& t)
+{
+    return crossProduct(vertex(t, 1) - vertex(t, 0), vertex(t, 2) - vertex(t, 0)).norm() * 0.5f;
+}
+
+Bounds3 triangleBounds(const PackedTriangle& t)
+{
+    return Union(Bounds3(vertex(t, 0), vertex(t, 1)), vertex(t, 2));
+}
+
+void setBounds(float* bmin, float* bmax, const Bounds3& b)
+{
+    bmin[0] = b.pMin.x; bmin[1] = b.pMin.y; bmin[2] = b.pMin.z;
+    bmax[0] = b.pMax.x; bmax[1] = b.pMax.y; bmax[2] = b.pMax.z;
+}
+
+// 按质心中位数递归划分 tris[begin, end), 图元数不超过 leafSize 时生成叶子.
+// 节点按先序存放, 左子节点紧跟父节点; onLeaf 返回叶子的 (offset, count)
+template <typename OnLeaf>
+void buildNodes(std::vector<PackedTriangle>& tris, size_t begin, size_t end, size_t leafSize,
+                std::vector<Node>& nodes, OnLeaf&& onLeaf)
+{
+    Bounds3 bounds, centroids;
+    for (size_t i = begin; i < end; ++i) {
+        Bounds3 b = triangleBounds(tris[i]);
+        bounds = Union(bounds, b);
+        centroids = Union(centroids, b.Centroid());
+    }
+
+    size_t index = nodes.size();
+    nodes.emplace_back();
+    setBounds(nodes[index].bmin, nodes[index].bmax, bounds);
+
+    if (end - begin <= leafSize) {
+        auto [offset, count] = onLeaf(begin, end);
+        nodes[index].offset = offset;
+        nodes[index].count = count;
+        return;
+    }
+
+    int axis = centroids.maxExtent();
+    size_t mid = (begin + end) / 2;
+    std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end,
+                     [axis](const PackedTriangle& a, const PackedTriangle& b) {
+                         float ca = a.v[0][axis] + a.v[1][axis] + a.v[2][axis];
+                         float cb = b.v[0][axis] + b.v[1][axis] + b.v[2][axis];
+                         return ca < cb;
+                     });
+    buildNodes(tris, begin, mid, leafSize, nodes, onLeaf);
+    nodes[index].offset = nodes.size();
+    nodes[index].count = 0;
+    buildNodes(tris, mid, end, leafSize, nodes, onLeaf);
+}
+
+bool hitBox(const Node& node, const Ray& ray, float tMax, float& tEnter)
+{
+    const float* o = &ray.origin.x;
+    const float* inv = &ray.direction_inv.x;
+    float t0 = 0, t1 = tMax;
+    for (int a = 0; a < 3; ++a) {
+        float tn = (node.bmin[a] - o[a]) * inv[a];
+        float tf = (node.bmax[a] - o[a]) * inv[a];
+        if (tn > tf)
+            std::swap(tn, tf);
+        t0 = std::max(t0, tn);
+        t1 = std::min(t1, tf);
+    }
+    tEnter = t0;
+    return t0 <= t1;
+}
+
+} // namespace
+
+// 所有 OutOfCoreMesh 共享的常驻 cluster 缓存
+static PageCache& geometryCache()
+{
+    static PageCache cache("Geometry cache", "cluster", OutOfCoreMesh::residentBudget, MemoryCategory::GeometryCache);
+    return cache;
+}
+
+bool OutOfCoreMesh::Write(const std::string& path, const std::vector<Vector3f>& vertices)
+{
+    std::vector<PackedTriangle> tris(vertices.size() / 3);
+    float totalArea = 0;
+    Bounds3 totalBounds;
+    for (size_t i = 0; i < tris.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            tris[i].v[k][0] = vertices[3 * i + k].x;
+            tris[i].v[k][1] = vertices[3 * i + k].y;
+            tris[i].v[k][2] = vertices[3 * i + k].z;
+        }
+        totalArea += triangleArea(tris[i]);
+        totalBounds = Union(totalBounds, triangleBounds(tris[i]));
+    }
+    if (tris.empty())
+        return false;
+
+    // 顶层: 每个叶子是一个 cluster
+    std::vector<Node> topNodes;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    buildNodes(tris, 0, tris.size(), kClusterTriangles, topNodes, [&](size_t begin, size_t end) {
+        ranges.emplace_back(begin, end);
+        return std::make_pair((uint32_t)ranges.size() - 1, 1u);
+    });
+
+    // 每个 cluster 内部的 BVH, 叶子引用 cluster 内连续的三角形
+    std::vector<Cluster> clusters(ranges.size());
+    std::vector<std::vector<char>> payloads(ranges.size());
+    uint64_t offset = sizeof(FileHeader) + clusters.size() * sizeof(Cluster) + topNodes.size() * sizeof(Node);
+    for (size_t c = 0; c < ranges.size(); ++c) {
+        auto [begin, end] = ranges[c];
+        std::vector<Node> nodes;
+        buildNodes(tris, begin, end, kLeafTriangles, nodes, [&](size_t b, size_t e) {
+            return std::make_pair((uint32_t)(b - begin), (uint32_t)(e - b));
+        });
+
+        auto& payload = payloads[c];
+        payload.resize(nodes.size() * sizeof(Node) + (end - begin) * sizeof(PackedTriangle));
+        memcpy(payload.data(), nodes.data(), nodes.size() * sizeof(Node));
+        memcpy(payload.data() + nodes.size() * sizeof(Node), &tris[begin], (end - begin) * sizeof(PackedTriangle));
+
+        Bounds3 b;
+        float area = 0;
+        for (size_t i = begin; i < end; ++i) {
+            b = Union(b, triangleBounds(tris[i]));
+            area += triangleArea(tris[i]);
+        }
+        offset = (offset + kPageSize - 1) / kPageSize * kPageSize;
+        clusters[c].offset = offset;
+        clusters[c].bytes = payload.size();
+        clusters[c].nodeCount = nodes.size();
+        clusters[c].triangleCount = end - begin;
+        setBounds(clusters[c].bmin, clusters[c].bmax, b);
+        clusters[c].area = area;
+        offset += payload.size();
+    }
+
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        perror(tmp.c_str());
+        return false;
+    }
+    FileHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.clusterCount = clusters.size();
+    header.topNodeCount = topNodes.size();
+    header.triangleCount = tris.size();
+    setBounds(header.bmin, header.bmax, totalBounds);
+    header.area = totalArea;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(clusters.data(), sizeof(Cluster), clusters.size(), fp) == clusters.size() &&
+              fwrite(topNodes.data(), sizeof(Node), topNodes.size(), fp) == topNodes.size();
+    for (size_t c = 0; ok && c < clusters.size(); ++c) {
+        ok = fseek(fp, clusters[c].offset, SEEK_SET) == 0 &&
+             fwrite(payloads[c].data(), 1, payloads[c].size(), fp) == payloads[c].size();
+    }
+    ok = fclose(fp) == 0 && ok;
+    // 与 Texture 的缓存文件相同, 先写临时文件再改名, 崩溃或多个进程同时转换时不会留下写了一半的文件
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", path.c_str());
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+OutOfCoreMesh::OutOfCoreMesh(const std::string& path, Material* mt) : m(mt)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+        perror(path.c_str());
+        return;
+    }
+    fileSize = st.st_size;
+    void* p = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+
+    const auto* header = static_cast<const FileHeader*>(p);
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+        fprintf(stderr, "%s: not an out-of-core mesh\n", path.c_str());
+        munmap(p, fileSize);
+        return;
+    }
+    data = static_cast<const char*>(p);
+    // 只在 cluster 被换入时预读, 避免内核按顺序预读把整个文件读进来
+    madvise(p, fileSize, MADV_RANDOM);
+
+    clusterCount = header->clusterCount;
+    clusters = reinterpret_cast<const Cluster*>(data + sizeof(FileHeader));
+    topNodes = reinterpret_cast<const Node*>(clusters + clusterCount);
+    bounds = Bounds3(Vector3f(header->bmin[0], header->bmin[1], header->bmin[2]),
+                     Vector3f(header->bmax[0], header->bmax[1], header->bmax[2]));
+    area = header->area;
+
+    residency = std::make_unique<PageCache::Residency[]>(clusterCount);
+    float sum = 0;
+    for (uint32_t c = 0; c < clusterCount; ++c) {
+        sum += clusters[c].area;
+        clusterCdf.push_back(sum);
+    }
+    printf("Out-of-core mesh %s: %u triangles in %u clusters\n", path.c_str(), header->triangleCount,
+           clusterCount);
+}
+
+OutOfCoreMesh::~OutOfCoreMesh()
+{
+    if (data) {
+        geometryCache().Remove(this);
+        munmap(const_cast<char*>(data), fileSize);
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+void OutOfCoreMesh::ReportCache()
+{
+    geometryCache().Report();
+}
+
+const OutOfCoreMesh::Node* OutOfCoreMesh::acquire(uint32_t c)
+{
+    geometryCache().Touch(this, data, clusters[c].offset, clusters[c].bytes, residency[c]);
+    return reinterpret_cast<const Node*>(data + clusters[c].offset);
+}
+
+void OutOfCoreMesh::intersectCluster(uint32_t c, const Node* nodes, const Ray& ray, Intersection& hit)
+{
+    const auto* tris = reinterpret_cast<const PackedTriangle*>(nodes + clusters[c].nodeCount);
+    float tMax = std::min((float)hit.distance, (float)ray.t_max);
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        float tEnter;
+        if (!hitBox(node, ray, tMax, tEnter))
+            continue;
+        if (node.count == 0) {
+            stack[top++] = node.offset;
+            stack[top++] = &node - nodes + 1;
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            // 与 Triangle::getIntersection 相同的 watertight 求交
+            Vector3f p0 = vertex(tris[i], 0), p1 = vertex(tris[i], 1), p2 = vertex(tris[i], 2);
+            TriangleHit th;
+            if (!intersectTriangle(ray, p0, p1, p2, tMax, m->twoSided, th))
+                continue;
+            tMax = th.t;
+
+            Vector3f normal = normalize(crossProduct(p1 - p0, p2 - p0));
+            hit.happened = true;
+            hit.coords = triangleHitPoint(th, p0, p1, p2);
+            hit.pError = triangleHitError(th, p0, p1, p2);
+            hit.normal = m->twoSided && !m->isSpecular() && dotProduct(ray.direction, normal) > 0 ? -normal : normal;
+            hit.distance = th.t;
+            hit.obj = this;
+            hit.m = m;
+        }
+    }
+}
+
+void OutOfCoreMesh::collectClusters(const Ray& ray, float tMax,
+                                    std::vector<std::pair<float, uint32_t>>& out) const
+{
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = topNodes[stack[--top]];
+        float tEnter;
+        if (!hitBox(node, ray, tMax, tEnter))
+            continue;
+        if (node.count == 0) {
+            stack[top++] = node.offset;
+            stack[top++] = &node - topNodes + 1;
+        }
+        else {
+            for (uint32_t c = node.offset; c < node.offset + node.count; ++c)
+                out.emplace_back(tEnter, c);
+        }
+    }
+}
+
+Intersection OutOfCoreMesh::getIntersection(Ray ray)
+{
+    Intersection hit;
+    if (!data)
+        return hit;
+
+    // 按进入距离从近到远处理 cluster, 找到交点之后更远的 cluster 不会再被换入
+    std::vector<std::pair<float, uint32_t>> candidates;
+    collectClusters(ray, (float)ray.t_max, candidates);
+    std::sort(candidates.begin(), candidates.end());
+    for (auto [tEnter, c] : candidates) {
+        if (tEnter > hit.distance)
+            break;
+        intersectCluster(c, acquire(c), ray, hit);
+    }
+    return hit;
+}
+
+void OutOfCoreMesh::IntersectBatch(const Ray* rays, size_t count, Intersection* hits)
+{
+    std::vector<std::vector<std::pair<float, uint32_t>>> pending(count);
+    std::vector<std::vector<size_t>> queues(clusterCount);
+    std::vector<std::pair<float, uint32_t>> candidates;
+
+    // 第一遍: 只在常驻的 cluster 中求交, 其余的按 cluster 排队
+    for (size_t r = 0; r < count; ++r) {
+        hits[r] = Intersection();
+        candidates.clear();
+        collectClusters(rays[r], (float)rays[r].t_max, candidates);
+        std::sort(candidates.begin(), candidates.end());
+        for (auto [tEnter, c] : candidates) {
+            if (tEnter > hits[r].distance)
+                break;
+            if (residency[c].resident.load(std::memory_order_acquire))
+                intersectCluster(c, acquire(c), rays[r], hits[r]);
+            else
+                pending[r].emplace_back(tEnter, c);
+        }
+        for (auto [tEnter, c] : pending[r])
+            queues[c].push_back(r);
+    }
+
+    // 第二遍: 队列最长的 cluster 先换入, 每次换入处理完它的整个队列
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return queues[a].size() > queues[b].size(); });
+    for (uint32_t c : order) {
+        if (queues[c].empty())
+            break;
+        const Node* nodes = nullptr;
+        for (size_t r : queues[c]) {
+            // 前面处理过的 cluster 可能已经找到了更近的交点
+            auto it = std::find_if(pending[r].begin(), pending[r].end(), [c](auto& p) { return p.second == c; });
+            if (it->first > hits[r].distance)
+                continue;
+            if (!nodes)
+                nodes = acquire(c);
+            intersectCluster(c, nodes, rays[r], hits[r]);
+        }
+    }
+}
+
+void OutOfCoreMesh::Sample(Intersection& pos, float& pdf)
+{
+    float p = get_random_float() * clusterCdf.back();
+    uint32_t c = std::min<uint32_t>(clusterCount - 1,
+                                    std::upper_bound(clusterCdf.begin(), clusterCdf.end(), p) - clusterCdf.begin());
+    const Node* nodes = acquire(c);
+    const auto* tris = reinterpret_cast<const PackedTriangle*>(nodes + clusters[c].nodeCount);
+
+    // cluster 内按面积线性查找
+    float q = get_random_float() * clusters[c].area;
+    uint32_t i = 0;
+    for (; i + 1 < clusters[c].triangleCount; ++i) {
+        q -= triangleArea(tris[i]);
+        if (q <= 0)
+            break;
+    }
+
+    Vector3f v0 = vertex(tris[i], 0), v1 = vertex(tris[i], 1), v2 = vertex(tris[i], 2);
+    float x = std::sqrt(get_random_float()), y = get_random_float();
+    pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+    pos.normal = normalize(crossProduct(v1 - v0, v2 - v0));
+    pos.emit = m->getEmission();
+    // 三角形按面积选择, 再在三角形上均匀采样, 合起来是整个网格上的均匀分布
+    pdf = 1.0f / area;
+}
+
+LightBounds OutOfCoreMesh::getLightBounds()
+{
+    LightBounds lb;
+    lb.bounds = bounds;
+    lb.cosThetaO = -1;
+    lb.cosThetaE = 0;
+    lb.phi = hasEmit() ? luminance(m->getEmission()) * area * M_PI : 0;
+    return lb;
+}
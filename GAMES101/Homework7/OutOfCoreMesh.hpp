@@ -0,0 +1,106 @@
+#ifndef RAYTRACING_OUTOFCOREMESH_H
+#define RAYTRACING_OUTOFCOREMESH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Object.hpp"
+#include "Material.hpp"
+#include "PageCache.hpp"
+
+// 放在磁盘上, 按需换入内存的三角形网格, 用于几何数据超过内存的场景.
+//
+// 文件格式 (所有数据都按内存布局直接存储, 整个文件只读 mmap):
+//
+//   Header
+//   Cluster[clusterCount]        每个 cluster 是一棵子树, 最多 kClusterTriangles 个三角形
+//   Node[topNodeCount]           cluster 之上的顶层 BVH, 常驻内存
+//   ... 每个 cluster 的数据, 按页对齐:  Node[nodeCount] + Triangle[triangleCount]
+//
+// 顶层 BVH 与 cluster 表很小, 一直留在内存中. cluster 的数据在第一次被光线访问时换入,
+// 所有 OutOfCoreMesh 共享一个容量为 residentBudget 的 PageCache, 超出时按 LRU 释放最久未使用的 cluster 的页.
+class OutOfCoreMesh : public Object
+{
+public:
+    // 所有节点 32 字节: 内部节点 count == 0, 左子节点紧跟其后, offset 是右子节点的下标;
+    // 叶子的 offset/count 是三角形 (cluster 内) 或 cluster (顶层) 的范围
+    struct Node {
+        float bmin[3], bmax[3];
+        uint32_t offset, count;
+    };
+    struct PackedTriangle {
+        float v[3][3];
+    };
+    struct Cluster {
+        uint64_t offset, bytes;
+        uint32_t nodeCount, triangleCount;
+        float bmin[3], bmax[3];
+        float area;
+        uint32_t pad;
+    };
+
+    static constexpr int kClusterTriangles = 4096;
+    static constexpr int kLeafTriangles = 4;
+
+    // 把三角形 (每三个顶点一个) 写成磁盘格式. 转换只需要做一次, 可以在内存更大的机器上离线完成
+    static bool Write(const std::string& path, const std::vector<Vector3f>& vertices);
+
+    // 加载时设置, 对之后创建的所有网格生效: 非空时场景中的网格转换为 cacheDirectory 中的文件后按需换入
+    static inline std::string cacheDirectory;
+    static inline size_t residentBudget = 256u << 20;
+
+    // 打印所有网格共享的常驻缓存的换入/换出次数
+    static void ReportCache();
+
+    OutOfCoreMesh(const std::string& path, Material* mt);
+    ~OutOfCoreMesh();
+    bool ok() const { return data != nullptr; }
+
+    bool intersect(const Ray&) { return true; }
+    bool intersect(const Ray&, float&, uint32_t&) const { return false; }
+    Intersection getIntersection(Ray ray);
+    void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&,
+                              Vector3f&, Vector2f&) const {}
+    Vector3f evalDiffuseColor(const Vector2f&) const { return Vector3f(0.5f); }
+    Bounds3 getBounds() { return bounds; }
+    float getArea() { return area; }
+    // 先按面积选 cluster, 再在 cluster 中按面积选三角形, 会换入被选中的 cluster
+    void Sample(Intersection& pos, float& pdf);
+    bool hasEmit() { return m->hasEmission(); }
+    LightBounds getLightBounds() override;
+
+    // 批量求交: 先只在已经常驻的 cluster 中求交, 到达未常驻 cluster 的光线按 cluster 排队,
+    // 每换入一个 cluster 就处理完它的整个队列, 让一次磁盘读取服务尽可能多的光线.
+    // BVHAccel::IntersectBatch 把到达这个网格的光线收集起来一起交给它
+    bool defersBatch() override { return true; }
+    void IntersectBatch(const Ray* rays, size_t count, Intersection* hits) override;
+
+    Material* m;
+
+private:
+    // 保证 cluster c 常驻并更新 LRU, 返回它的节点与三角形
+    const Node* acquire(uint32_t c);
+    // 在 cluster c 中求交, 更新 hit (只接受比 hit 更近的交点)
+    void intersectCluster(uint32_t c, const Node* nodes, const Ray& ray, Intersection& hit);
+    // 沿顶层 BVH 找到光线可能经过的 cluster
+    void collectClusters(const Ray& ray, float tMax, std::vector<std::pair<float, uint32_t>>& out) const;
+
+    int fd = -1;
+    const char* data = nullptr;
+    size_t fileSize = 0;
+    const Cluster* clusters = nullptr;
+    uint32_t clusterCount = 0;
+    const Node* topNodes = nullptr;
+    Bounds3 bounds;
+    float area = 0;
+
+    // 每个 cluster 在全局缓存中的状态
+    std::unique_ptr<PageCache::Residency[]> residency;
+    // 顶层: cluster 面积的前缀和, 用于采样
+    std::vector<float> clusterCdf;
+};
+
+#endif //RAYTRACING_OUTOFCOREMESH_H
@@ -0,0 +1,73 @@
+#include "PageCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/mman.h>
+
+void PageCache::Touch(const void* owner, const char* base, size_t offset, size_t bytes, Residency& state)
+{
+    uint64_t now = clock.load(std::memory_order_relaxed);
+    if (state.lastUse.load(std::memory_order_relaxed) != now)
+        state.lastUse.store(now, std::memory_order_relaxed);
+    if (state.resident.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (state.resident.load(std::memory_order_relaxed))
+        return;
+
+    // 超出容量时一次换出最久未使用的 1/8, 避免每次换入都扫描整个表. 换入的范围很大时可能需要换出几轮
+    while (residentBytes + bytes > budget && !entries.empty()) {
+        size_t count = std::max<size_t>(1, entries.size() / 8);
+        std::nth_element(entries.begin(), entries.begin() + (count - 1), entries.end(),
+                         [](const Entry& a, const Entry& b) {
+                             return a.state->lastUse.load(std::memory_order_relaxed) <
+                                    b.state->lastUse.load(std::memory_order_relaxed);
+                         });
+        for (size_t i = 0; i < count; ++i)
+            evict(entries[i]);
+        entries.erase(entries.begin(), entries.begin() + count);
+    }
+
+    madvise(const_cast<char*>(base) + offset, bytes, MADV_WILLNEED);
+    residentBytes += bytes;
+    TrackMemory(category, bytes);
+    entries.push_back({owner, base, offset, bytes, &state});
+    ++loads;
+    state.lastUse.store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    state.resident.store(true, std::memory_order_release);
+}
+
+void PageCache::Remove(const void* owner)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (size_t i = 0; i < entries.size();) {
+        if (entries[i].owner == owner) {
+            evict(entries[i]);
+            entries[i] = entries.back();
+            entries.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+void PageCache::Report()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (loads == 0)
+        return;
+    printf("%s: %llu %s loads, %llu evictions, %.2f MB resident (budget %.2f MB)\n", name,
+           (unsigned long long)loads, unit, (unsigned long long)evictions, residentBytes / 1048576.0,
+           budget / 1048576.0);
+}
+
+void PageCache::evict(const Entry& e)
+{
+    e.state->resident.store(false, std::memory_order_release);
+    madvise(const_cast<char*>(e.base) + e.offset, e.bytes, MADV_DONTNEED);
+    residentBytes -= e.bytes;
+    TrackMemory(category, -(long long)e.bytes);
+    ++evictions;
+}
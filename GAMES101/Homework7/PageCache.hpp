@@ -0,0 +1,58 @@
+#ifndef RAYTRACING_PAGECACHE_H
+#define RAYTRACING_PAGECACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "MemoryArena.hpp"
+
+// 只读 mmap 文件中按需换入的页的常驻缓存, 由磁盘上的网格 (OutOfCoreMesh 的 cluster) 与纹理 (Texture 的 tile) 共用.
+// 每个使用者 (owner) 把自己的文件映射分成若干个页对齐的范围, 每个范围对应一个 Residency.
+// 换入时 madvise(MADV_WILLNEED), 常驻的总字节数超出 budget 时按 LRU 用 madvise(MADV_DONTNEED) 换出.
+// 被换出的页即使还有线程在读也是安全的, 只读文件映射的页被丢弃后再次访问会从文件重新读入
+class PageCache
+{
+public:
+    struct Residency {
+        std::atomic<bool> resident{false};
+        std::atomic<uint64_t> lastUse{0};
+    };
+
+    // name 与 unit 只用于 Report, budget 在每次换入时读取, 可以在创建缓存之后修改
+    PageCache(const char* name, const char* unit, const size_t& budget, MemoryCategory category)
+        : name(name), unit(unit), budget(budget), category(category)
+    {}
+
+    // 保证 owner 的映射中从 base 开始的 [offset, offset + bytes) 常驻, 并更新它的 LRU 时间. state 是这个范围的状态
+    void Touch(const void* owner, const char* base, size_t offset, size_t bytes, Residency& state);
+    // 换出 owner 的所有范围, owner 解除映射之前调用
+    void Remove(const void* owner);
+    // 打印换入/换出次数, 没有换入过时不打印
+    void Report();
+
+private:
+    struct Entry {
+        const void* owner;
+        const char* base;
+        size_t offset, bytes;
+        Residency* state;
+    };
+
+    void evict(const Entry& e);
+
+    const char* name;
+    const char* unit;
+    const size_t& budget;
+    MemoryCategory category;
+
+    std::mutex mtx;
+    // 时钟只在换入时前进, 命中时不写共享的计数器, 只在范围的时间戳过期时更新它
+    std::atomic<uint64_t> clock{1};
+    std::vector<Entry> entries;
+    size_t residentBytes = 0;
+    uint64_t loads = 0, evictions = 0;
+};
+
+#endif //RAYTRACING_PAGECACHE_H
@@ -0,0 +1,240 @@
+#include <cmath>
+#include "PathGuiding.hpp"
+
+DTree::DTree()
+{
+    nodes.emplace_back();
+}
+
+Vector2f DTree::DirToCanonical(const Vector3f& dir)
+{
+    float cosTheta = clamp(-1, 1, dir.z);
+    float phi = std::atan2(dir.y, dir.x);
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Vector2f(clamp(0, 1, 0.5f * (cosTheta + 1)), clamp(0, 1, phi / (2 * M_PI)));
+}
+
+Vector3f DTree::CanonicalToDir(const Vector2f& p)
+{
+    float cosTheta = 2 * p.x - 1;
+    float phi = 2 * M_PI * p.y;
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+int DTree::quadrant(Vector2f& p)
+{
+    int q = 0;
+    if (p.x >= 0.5f) {
+        q |= 1;
+        p.x = p.x * 2 - 1;
+    }
+    else {
+        p.x *= 2;
+    }
+    if (p.y >= 0.5f) {
+        q |= 2;
+        p.y = p.y * 2 - 1;
+    }
+    else {
+        p.y *= 2;
+    }
+    return q;
+}
+
+float DTree::Total() const
+{
+    return nodes[0].Total();
+}
+
+void DTree::Record(const Vector3f& dir, float value)
+{
+    samples.fetch_add(1, std::memory_order_relaxed);
+    if (!(value > 0) || !std::isfinite(value))
+        return;
+
+    Vector2f p = DirToCanonical(dir);
+    uint32_t n = 0;
+    while (true) {
+        int q = quadrant(p);
+        atomicAdd(nodes[n].sum[q], value);
+        if (!nodes[n].child[q])
+            break;
+        n = nodes[n].child[q];
+    }
+}
+
+Vector3f DTree::Sample() const
+{
+    if (Total() <= 0)
+        return CanonicalToDir(Vector2f(get_random_float(), get_random_float()));
+
+    Vector2f origin(0, 0);
+    float size = 1;
+    uint32_t n = 0;
+    while (true) {
+        const Node& node = nodes[n];
+        float u = get_random_float() * node.Total();
+        int q = 0;
+        for (; q < 3; ++q) {
+            float s = node.sum[q].load(std::memory_order_relaxed);
+            if (u < s)
+                break;
+            u -= s;
+        }
+        size *= 0.5f;
+        origin.x += (q & 1) ? size : 0;
+        origin.y += (q & 2) ? size : 0;
+        if (!node.child[q])
+            break;
+        n = node.child[q];
+    }
+    return CanonicalToDir(origin + Vector2f(get_random_float(), get_random_float()) * size);
+}
+
+float DTree::Pdf(const Vector3f& dir) const
+{
+    if (Total() <= 0)
+        return 1 / (4 * M_PI);
+
+    Vector2f p = DirToCanonical(dir);
+    float result = 1;
+    uint32_t n = 0;
+    while (true) {
+        const Node& node = nodes[n];
+        float total = node.Total();
+        if (total <= 0)
+            return 0;
+        int q = quadrant(p);
+        result *= 4 * node.sum[q].load(std::memory_order_relaxed) / total;
+        if (result <= 0 || !node.child[q])
+            break;
+        n = node.child[q];
+    }
+    return result / (4 * M_PI);
+}
+
+DTree DTree::Refined(float threshold, int maxDepth) const
+{
+    DTree result;
+    float total = Total();
+    if (total <= 0) {
+        // 本轮没有记录到能量, 保留原来的结构
+        result.nodes = nodes;
+        for (auto& node : result.nodes)
+            for (auto& s : node.sum)
+                s.store(0, std::memory_order_relaxed);
+        return result;
+    }
+
+    struct Item {
+        uint32_t node;   // 新树中的节点
+        int old;         // 旧树中对应的节点, -1 表示旧树在这里已经是叶子
+        int depth;
+        float fraction;  // 该节点的能量占比
+    };
+    std::vector<Item> stack = {{0, 0, 1, 1.0f}};
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            // 旧树在这里已经是叶子时, 假设能量在四个子象限中均匀分布
+            float fraction = item.old >= 0
+                ? nodes[item.old].sum[q].load(std::memory_order_relaxed) / total
+                : item.fraction / 4;
+            if (fraction <= threshold || item.depth >= maxDepth)
+                continue;
+
+            uint32_t child = result.nodes.size();
+            result.nodes.emplace_back();
+            result.nodes[item.node].child[q] = child;
+            int old = item.old >= 0 && nodes[item.old].child[q] ? (int)nodes[item.old].child[q] : -1;
+            stack.push_back({child, old, item.depth + 1, fraction});
+        }
+    }
+    return result;
+}
+
+PathGuide::PathGuide(const Bounds3& sceneBounds)
+{
+    // 用包含整个场景的立方体作为根节点, 每次沿坐标轴轮流对半划分
+    Vector3f center = 0.5f * (sceneBounds.pMin + sceneBounds.pMax);
+    Vector3f d = sceneBounds.Diagonal();
+    float half = 0.5f * std::max(d.x, std::max(d.y, d.z)) * 1.01f + 1e-3f;
+    bounds = Bounds3(center - Vector3f(half), center + Vector3f(half));
+
+    nodes.emplace_back();
+    nodes[0].leaf = 0;
+    leaves.emplace_back();
+}
+
+int PathGuide::Lookup(const Vector3f& p) const
+{
+    Vector3f lo = bounds.pMin, hi = bounds.pMax;
+    const float* pc = &p.x;
+    float* loc = &lo.x;
+    float* hic = &hi.x;
+    int n = 0;
+    while (nodes[n].leaf < 0) {
+        int axis = nodes[n].axis;
+        float mid = 0.5f * (loc[axis] + hic[axis]);
+        if (pc[axis] < mid) {
+            hic[axis] = mid;
+            n = nodes[n].child[0];
+        }
+        else {
+            loc[axis] = mid;
+            n = nodes[n].child[1];
+        }
+    }
+    return nodes[n].leaf;
+}
+
+void PathGuide::subdivide(int node, const Bounds3& nodeBounds, uint32_t threshold)
+{
+    if (nodes[node].leaf < 0) {
+        int axis = nodes[node].axis;
+        Bounds3 b0 = nodeBounds, b1 = nodeBounds;
+        float mid = 0.5f * ((&nodeBounds.pMin.x)[axis] + (&nodeBounds.pMax.x)[axis]);
+        (&b0.pMax.x)[axis] = mid;
+        (&b1.pMin.x)[axis] = mid;
+        subdivide(nodes[node].child[0], b0, threshold);
+        subdivide(nodes[node].child[1], b1, threshold);
+        return;
+    }
+
+    // 叶子中的样本过多时一分为二, 两个子节点各继承一份方向树, 样本数视为各占一半
+    uint32_t count = leaves[nodes[node].leaf].building.SampleCount();
+    if (count <= threshold)
+        return;
+
+    int leaf = nodes[node].leaf;
+    int axis = nodes[node].axis;
+    int c0 = nodes.size(), c1 = c0 + 1;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[c0].axis = nodes[c1].axis = (axis + 1) % 3;
+    nodes[c0].leaf = leaf;
+    nodes[c1].leaf = leaves.size();
+    leaves.push_back(leaves[leaf]);
+    nodes[node].leaf = -1;
+    nodes[node].child[0] = c0;
+    nodes[node].child[1] = c1;
+
+    // 继续向下划分, 直到每个叶子的样本数都不超过阈值.
+    // 子节点的样本数记录的仍是父节点的值, 所以把阈值加倍来代替样本数减半
+    subdivide(node, nodeBounds, threshold * 2);
+}
+
+void PathGuide::Refine()
+{
+    ++iteration;
+    uint32_t threshold = (uint32_t)(spatialThreshold * std::sqrt(std::pow(2.0f, (float)iteration)));
+    subdivide(0, bounds, threshold);
+
+    for (auto& leaf : leaves) {
+        leaf.sampling = leaf.building;
+        leaf.building = leaf.sampling.Refined(directionalThreshold, maxDirectionalDepth);
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef RAYTRACING_PATHGUIDING_H
+#define RAYTRACING_PATHGUIDING_H
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include "Bounds3.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+
+// Path guiding: Müller et al. 2017, "Practical Path Guiding for Efficient Light-Transport Simulation".
+//
+// 场景空间用一棵二叉树 (S-tree) 划分, 每个叶子保存一棵方向四叉树 (D-tree),
+// 四叉树定义在单位正方形上, 通过柱面映射 (cosTheta, phi) 与单位球面上的方向一一对应,
+// 且映射保面积, 所以正方形上的 pdf 除以 4 * pi 就是立体角上的 pdf.
+//
+// 渲染分成若干轮: 每一轮用上一轮学到的分布采样间接光方向, 同时把本轮路径上测到的
+// 入射 radiance 记录到 building 四叉树中 (多个线程用原子加同时写入, 不加锁).
+// 一轮结束之后 (单线程) 用记录的数据细分空间树和方向树, 得到下一轮使用的分布.
+
+// 对 std::atomic<float> 做原子加法 (C++17 的 atomic<float> 没有 fetch_add)
+inline void atomicAdd(std::atomic<float>& target, float value)
+{
+    float old = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+        ;
+}
+
+// 方向四叉树
+class DTree
+{
+public:
+    DTree();
+    DTree(const DTree& other) = default;
+    DTree& operator=(const DTree& other) = default;
+
+    // 把方向 dir 上的一次测量 value (radiance / pdf) 累加到对应的叶子以及它的所有祖先上
+    void Record(const Vector3f& dir, float value);
+    // 按记录的能量分布采样一个方向
+    Vector3f Sample() const;
+    // Sample 得到方向 dir 的概率密度 (立体角测度)
+    float Pdf(const Vector3f& dir) const;
+
+    float Total() const;
+    uint32_t SampleCount() const { return samples.load(std::memory_order_relaxed); }
+
+    // 按本轮记录的能量细分或合并节点: 能量占比超过 threshold 的象限继续细分,
+    // 返回新结构的四叉树, 其中的能量清零, 用于下一轮记录
+    DTree Refined(float threshold, int maxDepth) const;
+
+    static Vector2f DirToCanonical(const Vector3f& dir);
+    static Vector3f CanonicalToDir(const Vector2f& p);
+
+private:
+    struct Node {
+        std::array<std::atomic<float>, 4> sum;
+        std::array<uint32_t, 4> child; // 0 表示该象限是叶子
+
+        Node()
+        {
+            for (int i = 0; i < 4; ++i) {
+                sum[i].store(0, std::memory_order_relaxed);
+                child[i] = 0;
+            }
+        }
+        Node(const Node& other) : child(other.child)
+        {
+            for (int i = 0; i < 4; ++i)
+                sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        Node& operator=(const Node& other)
+        {
+            child = other.child;
+            for (int i = 0; i < 4; ++i)
+                sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+        float Total() const
+        {
+            return sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed) +
+                   sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed);
+        }
+    };
+
+    // 象限编号: bit0 表示 x >= 0.5, bit1 表示 y >= 0.5, 并把 p 映射到该象限内的 [0, 1)^2
+    static int quadrant(Vector2f& p);
+
+    std::vector<Node> nodes;
+    // std::atomic 不可拷贝, 用一个可拷贝的包装
+    struct Counter : std::atomic<uint32_t> {
+        Counter() : std::atomic<uint32_t>(0) {}
+        Counter(const Counter& o) : std::atomic<uint32_t>(o.load()) {}
+        Counter& operator=(const Counter& o) { store(o.load()); return *this; }
+    } samples;
+};
+
+class PathGuide
+{
+public:
+    explicit PathGuide(const Bounds3& sceneBounds);
+
+    // 以 bsdfSamplingFraction 的概率按 BSDF 采样, 否则按 D-tree 采样
+    float bsdfSamplingFraction = 0.5f;
+    // S-tree 叶子的样本数超过 spatialThreshold * sqrt(2^iteration) 时一分为二
+    float spatialThreshold = 4000;
+    // D-tree 中能量占比超过该值的象限继续细分
+    float directionalThreshold = 0.01f;
+    int maxDirectionalDepth = 20;
+
+    // 渲染线程是否需要记录 radiance, 只在 Renderer::TrainGuide 的训练轮中打开, 之后的渲染只采样不记录
+    bool training = false;
+    // 至少完成一轮学习之后才能用于采样
+    bool ready() const { return iteration > 0; }
+
+    // 找到包含 p 的 S-tree 叶子
+    int Lookup(const Vector3f& p) const;
+    Vector3f Sample(int leaf) const { return leaves[leaf].sampling.Sample(); }
+    float Pdf(int leaf, const Vector3f& dir) const { return leaves[leaf].sampling.Pdf(dir); }
+    bool CanSample(int leaf) const { return ready() && leaves[leaf].sampling.Total() > 0; }
+    void Record(int leaf, const Vector3f& dir, float value) { leaves[leaf].building.Record(dir, value); }
+
+    // 一轮渲染结束后调用 (不能与渲染线程并发): 本轮数据成为采样分布, 并细分空间树与方向树
+    void Refine();
+
+    int Iteration() const { return iteration; }
+    size_t LeafCount() const { return leaves.size(); }
+
+private:
+    struct SNode {
+        int axis = 0;
+        int child[2] = {-1, -1}; // -1 表示叶子
+        int leaf = -1;           // 叶子节点在 leaves 中的下标
+    };
+    struct Leaf {
+        DTree sampling;
+        DTree building;
+    };
+
+    void subdivide(int node, const Bounds3& bounds, uint32_t threshold);
+
+    Bounds3 bounds;
+    std::vector<SNode> nodes;
+    std::vector<Leaf> leaves;
+    int iteration = 0;
+};
+
+#endif //RAYTRACING_PATHGUIDING_H
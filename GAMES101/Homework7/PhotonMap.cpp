@@ -0,0 +1,221 @@
+#include "PhotonMap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "Scene.hpp"
+#include "SphericalSampling.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+// 光子在镜面之间最多反弹的次数
+constexpr int kMaxPhotonBounces = 16;
+
+// 左平衡完全二叉树中 n 个节点时左子树的节点数
+size_t leftSubtreeSize(size_t n)
+{
+    int h = 0; // 最后一层之上的满层数
+    while (((size_t)2 << h) - 1 <= n)
+        ++h;
+    if (h == 0)
+        return 0;
+    size_t full = ((size_t)1 << h) - 1;          // 前 h 层的节点数
+    size_t lastRow = n - full;                   // 最后一层 (不满) 的节点数
+    size_t half = (size_t)1 << (h - 1);          // 最后一层左半边最多的节点数
+    return (half - 1) + std::min(lastRow, half);
+}
+
+} // namespace
+
+void PhotonMap::Build(const Scene& scene, size_t emitted, int threads)
+{
+    RT_TRACE_SCOPE("PhotonMap::Build");
+    nodes.clear();
+    payloads.clear();
+
+    if (scene.emitterCdf.empty() || scene.emitterCdf.back() <= 0 || emitted == 0)
+        return;
+
+    threads = std::max(1, threads);
+    std::vector<std::vector<Photon>> local(threads);
+    std::vector<std::thread> th;
+    for (int t = 0; t < threads; ++t) {
+        th.emplace_back([&, t]() {
+            SetTraceThreadName("photons " + std::to_string(t));
+            RT_TRACE_SCOPE("emit photons");
+            size_t count = emitted / threads + (t < (int)(emitted % threads) ? 1 : 0);
+            for (size_t i = 0; i < count; ++i) {
+                Intersection pos;
+                float pdf;
+                // 在发光图元上按面积均匀采样
+                scene.sampleLight(pos, pdf);
+                if (pdf <= 0)
+                    continue;
+                // 余弦加权的出射方向, pdf = cos / pi, 与 Le * cos 相除后只剩 pi
+                float u = get_random_float(), v = get_random_float();
+                float sinTheta = std::sqrt(u), cosTheta = std::sqrt(1 - u);
+                Vector3f dir = sphericalDirection(pos.normal, sinTheta, cosTheta, 2 * M_PI * v);
+                Vector3f power = pos.emit * M_PI / pdf / (float)emitted;
+
+                Ray ray(offsetRayOrigin(pos.coords, pos.pError, pos.normal, dir), dir);
+                bool specular = false;
+                for (int bounce = 0; bounce < kMaxPhotonBounces; ++bounce) {
+                    Intersection hit = scene.intersect(ray);
+                    if (!hit.happened || hit.m->hasEmission())
+                        break;
+                    if (!hit.m->isSpecular()) {
+                        if (specular) {
+                            Photon p;
+                            p.node.position[0] = hit.coords.x;
+                            p.node.position[1] = hit.coords.y;
+                            p.node.position[2] = hit.coords.z;
+                            p.node.axis = 0;
+                            p.payload.power = power;
+                            p.payload.direction = ray.direction;
+                            local[t].push_back(p);
+                        }
+                        break;
+                    }
+                    // 按 Fresnel 系数选择反射或折射, 选择概率与系数相消, 能量不变
+                    Vector3f out = hit.m->sample(ray.direction, hit.normal);
+                    if (out.norm() == 0)
+                        break;
+                    out = normalize(out);
+                    ray = Ray(offsetRayOrigin(hit.coords, hit.pError, hit.normal, out), out);
+                    specular = true;
+                }
+            }
+        });
+    }
+    for (auto& t : th)
+        t.join();
+
+    std::vector<Photon> photons;
+    for (auto& l : local)
+        photons.insert(photons.end(), l.begin(), l.end());
+    if (photons.empty())
+        return;
+
+    nodes.resize(photons.size());
+    payloads.resize(photons.size());
+    build(photons, 0, photons.size(), 0);
+    printf(" - Caustic photon map: %zu photons stored of %zu emitted\n\n", nodes.size(), emitted);
+}
+
+void PhotonMap::build(std::vector<Photon>& photons, size_t begin, size_t end, size_t index)
+{
+    size_t n = end - begin;
+    if (n == 0)
+        return;
+
+    // 按包围盒最长的轴划分
+    float lo[3] = {kInfinity, kInfinity, kInfinity}, hi[3] = {-kInfinity, -kInfinity, -kInfinity};
+    for (size_t i = begin; i < end; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::min(lo[a], photons[i].node.position[a]);
+            hi[a] = std::max(hi[a], photons[i].node.position[a]);
+        }
+    }
+    uint32_t axis = 0;
+    for (uint32_t a = 1; a < 3; ++a) {
+        if (hi[a] - lo[a] > hi[axis] - lo[axis])
+            axis = a;
+    }
+
+    // 中位数取在使左子树恰好填满左平衡树左半边的位置
+    size_t median = begin + leftSubtreeSize(n);
+    std::nth_element(photons.begin() + begin, photons.begin() + median, photons.begin() + end,
+                     [axis](const Photon& a, const Photon& b) {
+                         return a.node.position[axis] < b.node.position[axis];
+                     });
+    nodes[index] = photons[median].node;
+    nodes[index].axis = axis;
+    payloads[index] = photons[median].payload;
+
+    build(photons, begin, median, 2 * index + 1);
+    build(photons, median + 1, end, 2 * index + 2);
+}
+
+namespace {
+
+struct Neighbor {
+    float distance2;
+    uint32_t index;
+    bool operator<(const Neighbor& o) const { return distance2 < o.distance2; }
+};
+
+// 最大堆中保存当前最近的 k 个光子, 堆满后搜索半径收缩为堆顶的距离
+struct KnnQuery {
+    size_t k;
+    float radius2;
+    std::vector<Neighbor> heap;
+};
+
+} // namespace
+
+Vector3f PhotonMap::Estimate(const Vector3f& p, const Vector3f& N, const Vector3f& wi, Material* m,
+                             const Vector3f& kd) const
+{
+    if (nodes.empty() || k <= 0)
+        return Vector3f(0);
+
+    float pos[3] = {p.x, p.y, p.z};
+    KnnQuery q{(size_t)k, maxRadius * maxRadius, {}};
+    q.heap.reserve(k + 1);
+
+    // 显式栈的深度优先遍历: 先进入查询点所在的一侧, 另一侧只有与搜索球相交时才访问.
+    // 栈中同时记下到划分平面的距离, 出栈时按已经收缩的半径再检查一次
+    struct Entry {
+        size_t index;
+        float plane2;
+    };
+    Entry stack[64];
+    int top = 0;
+    stack[top++] = {0, 0.0f};
+    while (top > 0) {
+        Entry e = stack[--top];
+        if (e.plane2 >= q.radius2)
+            continue;
+        const Node& node = nodes[e.index];
+        float dx = pos[0] - node.position[0], dy = pos[1] - node.position[1], dz = pos[2] - node.position[2];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < q.radius2) {
+            q.heap.push_back({d2, (uint32_t)e.index});
+            std::push_heap(q.heap.begin(), q.heap.end());
+            if (q.heap.size() > q.k) {
+                std::pop_heap(q.heap.begin(), q.heap.end());
+                q.heap.pop_back();
+            }
+            if (q.heap.size() == q.k)
+                q.radius2 = q.heap.front().distance2;
+        }
+
+        size_t left = 2 * e.index + 1, right = 2 * e.index + 2;
+        float delta = pos[node.axis] - node.position[node.axis];
+        size_t nearChild = delta < 0 ? left : right, farChild = delta < 0 ? right : left;
+        // 树高不超过 64, 每层最多留下一个远侧子树, 栈不会溢出
+        if (farChild < nodes.size())
+            stack[top++] = {farChild, delta * delta};
+        if (nearChild < nodes.size())
+            stack[top++] = {nearChild, 0.0f};
+    }
+
+    if (q.heap.empty())
+        return Vector3f(0);
+
+    // 用搜索半径内的圆盘面积估计通量密度: 找到 k 个光子时半径是第 k 近光子的距离, 不足 k 个时是 maxRadius
+    float radius2 = q.radius2;
+    if (radius2 <= 0)
+        return Vector3f(0);
+    Vector3f sum(0);
+    for (auto& n : q.heap) {
+        const Payload& photon = payloads[n.index];
+        Vector3f wo = -photon.direction;
+        // 只统计从着色面正面入射的光子, 排除薄物体背面的光子
+        if (dotProduct(wo, N) <= 0)
+            continue;
+        sum += m->eval(wi, wo, N, kd) * photon.power;
+    }
+    return sum / (M_PI * radius2);
+}
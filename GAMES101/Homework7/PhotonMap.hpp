@@ -0,0 +1,54 @@
+#ifndef RAYTRACING_PHOTONMAP_H
+#define RAYTRACING_PHOTONMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Vector.hpp"
+
+class Material;
+class Scene;
+
+// 焦散光子图. 从光源发射光子, 只保存经过至少一次镜面反射/折射 (DIELECTRIC) 后落在非镜面上的光子
+// (LS+D 路径). 渲染时在非镜面的着色点上用 k 近邻密度估计这部分入射光, 路径追踪不再计算
+// 从漫反射点出发经过镜面到达光源的路径, 两者不会重复.
+//
+// 光子存放在左平衡的 kd 树中: 节点 i 的子节点是 2i + 1 与 2i + 2, 不需要指针.
+// 遍历只访问 16 字节的位置与划分轴, 能量与入射方向放在另一个数组中, 只在命中时读取
+class PhotonMap
+{
+public:
+    // 从 scene 的光源发射 emitted 个光子, 用 threads 个线程并行追踪. scene 需要已经构建好 BVH
+    void Build(const Scene& scene, size_t emitted, int threads);
+
+    // 在 p 处 (法线 N, 入射方向 wi 与 castRay 相同, 指向着色点) 估计焦散光子贡献的出射 radiance.
+    // 取最近的 k 个光子, 搜索半径不超过 maxRadius
+    Vector3f Estimate(const Vector3f& p, const Vector3f& N, const Vector3f& wi, Material* m,
+                      const Vector3f& kd) const;
+
+    size_t Size() const { return nodes.size(); }
+
+    int k = 50;
+    float maxRadius = 10.0f;
+
+private:
+    struct Node {
+        float position[3];
+        uint32_t axis;
+    };
+    struct Payload {
+        Vector3f power;
+        Vector3f direction; // 光子的传播方向
+    };
+    struct Photon {
+        Node node;
+        Payload payload;
+    };
+
+    void build(std::vector<Photon>& photons, size_t begin, size_t end, size_t index);
+
+    std::vector<Node> nodes;
+    std::vector<Payload> payloads;
+};
+
+#endif //RAYTRACING_PHOTONMAP_H
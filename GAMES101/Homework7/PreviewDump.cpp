@@ -0,0 +1,65 @@
+// 交互模式的简易查看器: 从共享内存读取渲染器发布的图像, 写成 PPM.
+//
+//   ./PreviewDump NAME [--output preview.ppm] [--watch]
+//
+// --watch 时每当画面更新 (样本数或累加代数变化) 就重写一次输出文件, 可以配合自动刷新的图片查看器使用
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LivePreview.hpp"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s NAME [--output FILE] [--watch]\n", argv[0]);
+        return 1;
+    }
+    std::string name = argv[1];
+    std::string output = "preview.ppm";
+    bool watch = false;
+    for (int i = 2; i < argc; ++i) {
+        if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "--watch"))
+            watch = true;
+    }
+
+    PreviewReader reader;
+    while (!reader.Open(name)) {
+        if (!watch) {
+            fprintf(stderr, "No preview /%s\n", name.c_str());
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    std::vector<unsigned char> rgb;
+    PreviewHeader info;
+    uint64_t lastSequence = ~0ull;
+    do {
+        if (!reader.Read(rgb, info))
+            return 1;
+        uint64_t sequence = info.sequence.load(std::memory_order_relaxed);
+        if (sequence != lastSequence) {
+            lastSequence = sequence;
+            FILE* fp = fopen(output.c_str(), "wb");
+            if (!fp) {
+                perror(output.c_str());
+                return 1;
+            }
+            (void)fprintf(fp, "P6\n%d %d\n255\n", info.width, info.height);
+            fwrite(rgb.data(), 1, rgb.size(), fp);
+            fclose(fp);
+            printf("generation %llu, 1/%u resolution, %u spp\n", (unsigned long long)info.generation,
+                   info.blockSize, info.spp);
+            fflush(stdout);
+        }
+        if (watch)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    } while (watch);
+    return 0;
+}
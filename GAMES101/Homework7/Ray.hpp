@@ -4,19 +4,43 @@
 
 #ifndef RAYTRACING_RAY_H
 #define RAYTRACING_RAY_H
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include "Vector.hpp"
+class Object;
 struct Ray{
     //Destination = origin + t*direction
     Vector3f origin;
     Vector3f direction, direction_inv;
     double t;//transportation time,
     double t_min, t_max;
+    // 求交使用的网格细节层次, 0 为原始网格, 越大越粗糙 (没有对应层次的网格使用最粗的一层)
+    int lod = 0;
+    // 光线起点所在的物体与起点所在的网格层次. 起点所在的网格仍按 originLod 求交: 从精细表面出发的光线如果马上改用
+    // 同一网格更粗的一层, 可能立刻击中它的外壳 (--two-sided 时还会击中外壳的背面)
+    const Object* originObject = nullptr;
+    int originLod = 0;
+    // 光线锥: 起点处的宽度与每单位距离的扩张, 距离 t 处的宽度为 coneWidth + coneSpread * t, 用于选择纹理的 mip 层
+    float coneWidth = 0, coneSpread = 0;
+    // watertight 三角形求交 (RayTriangle.hpp) 的坐标变换: 把 direction 绝对值最大的分量换到 kz,
+    // 再错切成 +z 方向. 每条光线只算一次
+    int kx, ky, kz;
+    float shearX, shearY, shearZ;
 
     Ray(const Vector3f& ori, const Vector3f& dir, const double _t = 0.0): origin(ori), direction(dir),t(_t) {
         direction_inv = Vector3f(1./direction.x, 1./direction.y, 1./direction.z);
         t_min = 0.0;
         t_max = std::numeric_limits<double>::max();
 
+        float ax = std::fabs(direction.x), ay = std::fabs(direction.y), az = std::fabs(direction.z);
+        kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        const float* d = &direction.x;
+        shearX = -d[kx] / d[kz];
+        shearY = -d[ky] / d[kz];
+        shearZ = 1.0f / d[kz];
     }
 
     Vector3f operator()(double t) const{return origin+direction*t;}
@@ -26,4 +50,65 @@ struct Ray{
         return os;
     }
 };
+
+// ray 对物体 obj 求交使用的网格层次, 见 Ray::originObject
+inline int intersectLod(const Ray& ray, const Object* obj)
+{
+    return obj && obj == ray.originObject ? ray.originLod : ray.lod;
+}
+
+// 浮点误差分析中 n 次舍入的相对误差上界 (PBRT 的 gamma(n))
+inline constexpr float floatErrorBound(int n)
+{
+    constexpr float kMachineEpsilon = std::numeric_limits<float>::epsilon() * 0.5f;
+    return (n * kMachineEpsilon) / (1 - n * kMachineEpsilon);
+}
+
+// 相邻的下一个/上一个可表示的 float
+inline float nextFloatUp(float v)
+{
+    if (std::isinf(v) && v > 0)
+        return v;
+    if (v == -0.0f)
+        v = 0.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    bits = v >= 0 ? bits + 1 : bits - 1;
+    std::memcpy(&v, &bits, sizeof(bits));
+    return v;
+}
+
+inline float nextFloatDown(float v)
+{
+    if (std::isinf(v) && v < 0)
+        return v;
+    if (v == 0.0f)
+        v = -0.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    bits = v > 0 ? bits - 1 : bits + 1;
+    std::memcpy(&v, &bits, sizeof(bits));
+    return v;
+}
+
+// 从表面上的点 p (法线 N, 每个分量的误差不超过 pError) 沿 dir 发出光线时的起点: 沿法线推到 dir 所在的一侧,
+// 距离恰好超出误差盒在法线上的投影, 再向外舍入一个 ulp, 保证起点不在出发的表面上, 光线不会再击中它
+inline Vector3f offsetRayOrigin(const Vector3f& p, const Vector3f& pError, const Vector3f& N, const Vector3f& dir)
+{
+    float d = std::fabs(N.x) * pError.x + std::fabs(N.y) * pError.y + std::fabs(N.z) * pError.z;
+    Vector3f offset = N * d;
+    if (dotProduct(dir, N) < 0)
+        offset = -offset;
+    Vector3f po = p + offset;
+    for (int i = 0; i < 3; ++i) {
+        float o = (&offset.x)[i];
+        float& c = (&po.x)[i];
+        if (o > 0)
+            c = nextFloatUp(c);
+        else if (o < 0)
+            c = nextFloatDown(c);
+    }
+    return po;
+}
+
 #endif //RAYTRACING_RAY_H
@@ -0,0 +1,100 @@
+#ifndef RAYTRACING_RAYTRIANGLE_H
+#define RAYTRACING_RAYTRIANGLE_H
+
+#include <algorithm>
+#include <cmath>
+#include "Ray.hpp"
+#include "Vector.hpp"
+
+// 光线与三角形求交的结果: 距离与重心坐标 (交点 = b0 * p0 + b1 * p1 + b2 * p2)
+struct TriangleHit {
+    float t;
+    float b0, b1, b2;
+};
+
+// Woop, Benthin, Wald (2013) 的 watertight 单精度求交: 平移到光线起点, 按 Ray::kx/ky/kz 置换坐标轴,
+// 错切成沿 +z 的光线, 再用三条边函数判断原点是否在三角形的投影内. 共享一条边的两个三角形对边上的点
+// 给出符号一致的边函数, 光线不会从两个三角形之间的缝隙漏过去.
+// twoSided 为 false 时剔除背面 (从法线的反方向射入). 只接受 0 < t < tMax 且 t 大于其舍入误差的交点
+inline bool intersectTriangle(const Ray& ray, const Vector3f& p0, const Vector3f& p1, const Vector3f& p2,
+                              float tMax, bool twoSided, TriangleHit& hit)
+{
+    const int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+    Vector3f a = p0 - ray.origin, b = p1 - ray.origin, c = p2 - ray.origin;
+    const float* pa = &a.x;
+    const float* pb = &b.x;
+    const float* pc = &c.x;
+    float ax = pa[kx] + ray.shearX * pa[kz], ay = pa[ky] + ray.shearY * pa[kz];
+    float bx = pb[kx] + ray.shearX * pb[kz], by = pb[ky] + ray.shearY * pb[kz];
+    float cx = pc[kx] + ray.shearX * pc[kz], cy = pc[ky] + ray.shearY * pc[kz];
+
+    float e0 = bx * cy - by * cx;
+    float e1 = cx * ay - cy * ax;
+    float e2 = ax * by - ay * bx;
+    // 原点恰好落在边上时单精度无法判断, 用双精度重新计算
+    if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f) {
+        e0 = (float)((double)bx * cy - (double)by * cx);
+        e1 = (float)((double)cx * ay - (double)cy * ax);
+        e2 = (float)((double)ax * by - (double)ay * bx);
+    }
+    // det = e0 + e1 + e2 与 dot(法线, direction) / direction[kz] 同号, 两者异号时光线从正面 (法线一侧) 射入.
+    // 剔除背面时三条边函数都必须有正面对应的符号, 一次比较同时排除了背面与投影之外的情况
+    if (!twoSided) {
+        float sign = ray.shearZ > 0 ? -1.0f : 1.0f;
+        if (e0 * sign < 0 || e1 * sign < 0 || e2 * sign < 0)
+            return false;
+    }
+    else if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) {
+        return false;
+    }
+    float det = e0 + e1 + e2;
+    if (det == 0)
+        return false;
+
+    float az = ray.shearZ * pa[kz], bz = ray.shearZ * pb[kz], cz = ray.shearZ * pc[kz];
+    float tScaled = e0 * az + e1 * bz + e2 * cz;
+    if (det < 0 && (tScaled >= 0 || tScaled < tMax * det))
+        return false;
+    if (det > 0 && (tScaled <= 0 || tScaled > tMax * det))
+        return false;
+
+    float invDet = 1 / det;
+    float t = tScaled * invDet;
+
+    // t 的舍入误差上界, t 不比它大时交点可能在起点后面, 例如光线从这个三角形上出发
+    float maxZt = std::max({std::fabs(az), std::fabs(bz), std::fabs(cz)});
+    float maxXt = std::max({std::fabs(ax), std::fabs(bx), std::fabs(cx)});
+    float maxYt = std::max({std::fabs(ay), std::fabs(by), std::fabs(cy)});
+    float deltaZ = floatErrorBound(3) * maxZt;
+    float deltaX = floatErrorBound(5) * (maxXt + maxZt);
+    float deltaY = floatErrorBound(5) * (maxYt + maxZt);
+    float deltaE = 2 * (floatErrorBound(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+    float maxE = std::max({std::fabs(e0), std::fabs(e1), std::fabs(e2)});
+    float deltaT = 3 * (floatErrorBound(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * std::fabs(invDet);
+    if (t <= deltaT)
+        return false;
+
+    hit.t = t;
+    hit.b0 = e0 * invDet;
+    hit.b1 = e1 * invDet;
+    hit.b2 = e2 * invDet;
+    return true;
+}
+
+// 用重心坐标插值得到的交点每个分量的误差上界
+inline Vector3f triangleHitError(const TriangleHit& hit, const Vector3f& p0, const Vector3f& p1, const Vector3f& p2)
+{
+    auto absSum = [&](float a, float b, float c) {
+        return std::fabs(hit.b0 * a) + std::fabs(hit.b1 * b) + std::fabs(hit.b2 * c);
+    };
+    return Vector3f(absSum(p0.x, p1.x, p2.x), absSum(p0.y, p1.y, p2.y), absSum(p0.z, p1.z, p2.z)) *
+           floatErrorBound(7);
+}
+
+// 交点本身, 比 origin + t * direction 更精确
+inline Vector3f triangleHitPoint(const TriangleHit& hit, const Vector3f& p0, const Vector3f& p1, const Vector3f& p2)
+{
+    return p0 * hit.b0 + p1 * hit.b1 + p2 * hit.b2;
+}
+
+#endif //RAYTRACING_RAYTRIANGLE_H
@@ -2,15 +2,17 @@
 // Created by goksu on 2/25/20.
 //
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <numeric>
 #include "Scene.hpp"
 #include "Renderer.hpp"
+#include "Trace.hpp"
 
 
 inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
 
-const float EPSILON = 0.00001;
-
 // The main render function. This where we iterate over all pixels in the image,
 // generate primary rays and cast these rays into the scene. The content of the
 // framebuffer is saved to a file.
@@ -24,7 +26,7 @@ void Renderer::Render(const Scene& scene)
     int m = 0;
 
     // change the spp value to change sample ammount
-    int spp = 16;
+    int spp = options.spp;
     std::cout << "SPP: " << spp << "\n";
     for (uint32_t j = 0; j < scene.height; ++j) {
         for (uint32_t i = 0; i < scene.width; ++i) {
@@ -44,7 +46,7 @@ void Renderer::Render(const Scene& scene)
     UpdateProgress(1.f);
 
     // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
+    FILE* fp = fopen(options.output.c_str(), "wb");
     (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
     for (auto i = 0; i < scene.height * scene.width; ++i) {
         static unsigned char color[3];
@@ -56,71 +58,305 @@ void Renderer::Render(const Scene& scene)
     fclose(fp);    
 }
 
+int Renderer::FrameWidth(const Scene& scene) const
+{
+    int width = options.width > 0 ? options.width : scene.width;
+    return std::max(1, (int)std::lround(width * options.resolutionScale));
+}
+
+int Renderer::FrameHeight(const Scene& scene) const
+{
+    int height = options.height > 0 ? options.height : scene.height;
+    return std::max(1, (int)std::lround(height * options.resolutionScale));
+}
+
+Film Renderer::MakeFilm(const Scene& scene) const
+{
+    int w = FrameWidth(scene), h = FrameHeight(scene);
+    if (options.cropX1 <= 0)
+        return Film(0, 0, w, h);
+
+    // 裁剪窗口按分辨率缩放, 向外取整保证缩放后仍覆盖整个窗口
+    float s = options.resolutionScale;
+    int x0 = std::clamp((int)std::floor(options.cropX0 * s), 0, w - 1);
+    int y0 = std::clamp((int)std::floor(options.cropY0 * s), 0, h - 1);
+    int x1 = std::clamp((int)std::ceil(options.cropX1 * s), x0 + 1, w);
+    int y1 = std::clamp((int)std::ceil(options.cropY1 * s), y0 + 1, h);
+    return Film(x0, y0, x1, y1);
+}
+
+void Renderer::WriteOutput(const Scene& scene, const Film& film) const
+{
+    RT_TRACE_SCOPE("write image");
+    if (options.baseImage.empty())
+        film.WritePPM(options.output);
+    else
+        film.WriteIntoPPM(options.baseImage, options.output, FrameWidth(scene), FrameHeight(scene));
+}
+
+const Scene& Renderer::LocalScene(const Scene& scene) const
+{
+    int node = CurrentNumaNode();
+    if (node >= 0 && node < (int)replicas.size() && replicas[node])
+        return *replicas[node];
+    return scene;
+}
+
+long long Renderer::RenderTile(const Scene& sharedScene, const Tile& tile, int spp, TileBuffer& buffer) const
+{
+    RT_TRACE_SCOPE_ARG("tile", tile.index);
+    const Scene& scene = LocalScene(sharedScene);
+    int width = FrameWidth(scene), height = FrameHeight(scene);
+    const Camera& camera = options.camera;
+    float scale = tan(deg2rad(camera.fov * 0.5));
+    float imageAspectRatio = width / (float)height;
+    // 主光线的光线锥: 从相机出发, 每单位距离张开一个像素的宽度
+    float pixelSpread = 2 * scale / height;
+
+    std::unique_ptr<Integrator> integrator = MakeIntegrator(options.integrator, options.aoRadius);
+
+    // 主光线不抖动, 同一像素的所有样本共用一个交点.
+    // 批量模式下先用交错遍历求出整个 tile 的主光线交点, 每个样本从交点继续追踪
+    std::vector<Ray> primary;
+    std::vector<Intersection> hits;
+    if (options.batchedTraversal) {
+        primary.reserve(tile.pixelCount());
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            for (int i = tile.x0; i < tile.x1; ++i) {
+                float x = (2 * (i + 0.5) / (float)width - 1) * imageAspectRatio * scale;
+                float y = (1 - 2 * (j + 0.5) / (float)height) * scale;
+                primary.emplace_back(camera.eye, camera.Direction(x, y)).coneSpread = pixelSpread;
+            }
+        }
+        hits.resize(primary.size());
+        scene.IntersectBatch(primary.data(), primary.size(), hits.data());
+    }
+
+    int m = 0;
+    long long accepted = 0;
+    for (int j = tile.y0; j < tile.y1; ++j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+            // generate primary ray direction
+            float x = (2 * (i + 0.5) / (float)width - 1) *
+                    imageAspectRatio * scale;
+            float y = (1 - 2 * (j + 0.5) / (float)height) * scale;
+
+            Ray ray(camera.eye, camera.Direction(x, y));
+            ray.coneSpread = pixelSpread;
+            Intersection inter = options.batchedTraversal ? hits[m] : scene.intersect(ray);
+            for (int k = 0; k < spp; k++){
+                Vector3f L = integrator->Li(scene, ray, inter);
+                // 个别路径会因为 pdf 为 0 得到 NaN, 丢弃这样的样本, 避免污染整个像素的累加值.
+                // 丢弃的样本不计入样本数, 像素取其余样本的平均, 不会因此变暗
+                if (!std::isfinite(L.x + L.y + L.z))
+                    continue;
+                buffer.sum[m] += L;
+                buffer.sumSq[m] += luminance(L) * luminance(L);
+                buffer.samples[m] += 1;
+                ++accepted;
+            }
+            m++;
+        }
+    }
+    return accepted;
+}
+
+int Renderer::ThreadCount() const
+{
+    if (options.threads > 0)
+        return options.threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void Renderer::ParallelTiles(int count, const std::function<void(int, TileBuffer&)>& func) const
+{
+    std::atomic<int> next(0);
+    auto threadFunc = [&](int index) {
+        // 先绑定再分配 TileBuffer, 累加缓冲的页面在线程所在的节点上
+        PinWorkerThread(options.pinning, index);
+        if (TraceEnabled())
+            SetTraceThreadName("render " + std::to_string(index));
+        TileBuffer buffer;
+        for (int t = next++; t < count; t = next++) {
+            func(t, buffer);
+        }
+    };
+
+    int n = std::min(ThreadCount(), std::max(1, count));
+    std::vector<std::thread> th;
+    for (int i = 0; i < n; ++i) {
+        th.emplace_back(threadFunc, i);
+    }
+    for (auto& t : th) {
+        t.join();
+    }
+}
+
 // 先将成像平面进行分块，然后利用多线程分块地进行 Path Tracing
+// 每个线程从队列中动态地领取 tile, 避免静态划分时各线程负载不均
 void Renderer::MultiThreadRender(const Scene& scene)
 {
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
+    if (scene.guide && options.guidingIterations > 0)
+        TrainGuide(scene);
 
-    float scale = tan(deg2rad(scene.fov * 0.5));
-    float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
+    Film film = MakeFilm(scene);
 
     // change the spp value to change sample ammount
-    int spp = 16;
+    int spp = options.spp;
     std::cout << "SPP: " << spp << "\n";
 
-    int process = 0;
-    auto threadFunc = [&](int lx, int rx, int ly, int ry) {
-        for (uint32_t j = ly; j <= ry; ++j) {
-            int m = j * scene.width + lx;
-            for (uint32_t i = lx; i <= rx; ++i) {
-                // generate primary ray direction
-                float x = (2 * (i + 0.5) / (float)scene.width - 1) *
-                        imageAspectRatio * scale;
-                float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
-
-                Vector3f dir = normalize(Vector3f(-x, y, 1));
-                for (int k = 0; k < spp; k++){
-                    framebuffer[m] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
-                }
-                m++;
-                process++;
-            }
+    std::vector<Tile> tiles = film.Tiles(options.tileSize);
+    int finished = 0;
 
-            std::lock_guard<std::mutex> lock(mtx);
-            UpdateProgress(1.0 * process / scene.width / scene.height);
-        }
+    ParallelTiles(tiles.size(), [&](int t, TileBuffer& buffer) {
+        const Tile& tile = tiles[t];
+        buffer.Reset(tile);
+        RenderTile(scene, tile, spp, buffer);
+
+        // 不同 tile 的像素互不重叠, 合并时无需加锁
+        film.AddTile(tile, buffer);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        UpdateProgress(1.0 * ++finished / tiles.size());
+    });
+
+    UpdateProgress(1.f);
+
+    // save framebuffer to file
+    WriteOutput(scene, film);
+}
+
+void Renderer::TrainGuide(const Scene& scene)
+{
+    PathGuide& guide = *scene.guide;
+    std::vector<Tile> tiles = MakeFilm(scene).Tiles(options.tileSize);
+
+    guide.training = true;
+    for (int it = 0; it < options.guidingIterations; ++it) {
+        int spp = 1 << it;
+        ParallelTiles(tiles.size(), [&](int t, TileBuffer& buffer) {
+            buffer.Reset(tiles[t]);
+            RenderTile(scene, tiles[t], spp, buffer);
+        });
+        guide.Refine();
+        std::cout << "Guiding iteration " << it + 1 << ": " << spp << " spp, "
+                  << guide.LeafCount() << " spatial leaves\n";
+    }
+    guide.training = false;
+}
+
+// 时间预算渲染:
+// 1. 先在均匀分布的一小部分 tile 上用 2 spp 渲染作为校准, 测出每个像素样本的平均耗时
+// 2. 之后每一轮按各 tile 的噪声估计分配样本, 噪声越大的 tile 分到的样本越多,
+//    每一轮大约花掉剩余时间的 1/4, 并根据实测耗时修正单样本耗时
+// 3. 剩余时间连一个 tile 都渲染不完时停止, 输出当前图像和噪声估计
+void Renderer::TimeBudgetRender(const Scene& scene)
+{
+    using clock = std::chrono::steady_clock;
+    auto seconds = [](clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+    // path guiding 的训练轮不计入时间预算
+    if (scene.guide && options.guidingIterations > 0)
+        TrainGuide(scene);
+
+    auto start = clock::now();
+    // 预留一小部分时间用来写输出文件
+    double budget = options.timeBudget * 0.98;
+    auto stopAt = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(budget));
+
+    Film film = MakeFilm(scene);
+    std::vector<Tile> tiles = film.Tiles(options.tileSize);
+    std::cout << "Time budget: " << options.timeBudget << " s\n";
+
+    // 渲染一轮: order 中的 tile 依次以 spp[t] 个样本渲染, 超过截止时间的 tile 直接跳过.
+    // 返回实际完成的像素样本数
+    auto renderPass = [&](const std::vector<int>& order, const std::vector<int>& spp) {
+        std::atomic<long long> done(0);
+        ParallelTiles(order.size(), [&](int k, TileBuffer& buffer) {
+            const Tile& tile = tiles[order[k]];
+            if (clock::now() >= stopAt)
+                return;
+            buffer.Reset(tile);
+            long long samples = RenderTile(scene, tile, spp[tile.index], buffer);
+            film.AddTile(tile, buffer);
+            done += samples;
+        });
+        return done.load();
     };
 
-    int bx = 5, by = 5;
-    int nx = (scene.width + bx - 1) / bx;
-    int ny = (scene.height + by - 1) / by;
-
-    std::thread th[bx * by];
-    int idx = 0;
-    for (int i = 0; i < scene.width; i += nx) {
-        for (int j = 0; j < scene.height; j += ny) {
-            int lx = i, rx = std::min(i+nx, scene.width)-1;
-            int ly = j, ry = std::min(j+ny, scene.height)-1;
-            th[idx++] = std::thread(threadFunc, lx, rx, ly, ry);
+    std::vector<int> order(tiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<int> spp(tiles.size(), 2);
+
+    // 校准轮, 大约使用 1/16 的 tile, 但至少保证每个线程都有 tile 可做
+    int stride = std::max(1, std::min(16, (int)tiles.size() / ThreadCount()));
+    std::vector<int> calibration;
+    for (int t = 0; t < (int)tiles.size(); t += stride)
+        calibration.push_back(t);
+    auto t0 = clock::now();
+    long long done = renderPass(calibration, spp);
+    double secondsPerSample = seconds(clock::now() - t0) / std::max(1LL, done);
+    std::cout << "Calibration: " << secondsPerSample * 1e6 << " us per sample\n";
+
+    std::vector<float> noise(tiles.size());
+    for (int pass = 1; ; ++pass) {
+        double remaining = seconds(stopAt - clock::now());
+        if (remaining <= 0)
+            break;
+
+        float meanNoise = 0;
+        for (auto& tile : tiles) {
+            noise[tile.index] = film.TileNoise(tile);
+            meanNoise += noise[tile.index] / tiles.size();
+        }
+        // 噪声大的 tile 先渲染, 这样截止时间到达时被跳过的是最不重要的 tile
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return noise[a] > noise[b]; });
+
+        // 每个 tile 的权重与其相对噪声成正比, 限制在 [0.25, 4] 之间避免极端分配
+        std::vector<double> weight(tiles.size());
+        double unitCost = 0;
+        for (auto& tile : tiles) {
+            weight[tile.index] = clamp(0.25f, 4.0f, noise[tile.index] / std::max(meanNoise, 1e-6f));
+            unitCost += tile.pixelCount() * weight[tile.index] * secondsPerSample;
+        }
+        double target = 0.25 * remaining;
+        double base = target / unitCost;
+
+        double cost = 0;
+        for (int t : order) {
+            spp[t] = (int)(base * weight[t] + 0.5);
+            cost += tiles[t].pixelCount() * spp[t] * secondsPerSample;
+        }
+        // 本轮预算不够所有 tile 都分到样本时, 按噪声从大到小给 tile 各一个样本,
+        // 直到用完本轮预算. 至少要放得下一个 tile, 否则结束渲染
+        if (cost == 0) {
+            for (int t : order) {
+                double c = tiles[t].pixelCount() * secondsPerSample;
+                spp[t] = (cost == 0 && c <= remaining) || cost + c <= target ? 1 : 0;
+                cost += spp[t] * c;
+            }
+            if (cost == 0)
+                break;
         }
-    }
 
-    for (int i = 0; i < bx * by; ++i) {
-        th[i].join();
+        auto passStart = clock::now();
+        done = renderPass(order, spp);
+        double elapsed = seconds(clock::now() - passStart);
+        if (done > 0)
+            secondsPerSample = 0.5 * secondsPerSample + 0.5 * elapsed / done;
+
+        std::cout << "Pass " << pass << ": " << done << " samples in " << elapsed
+                  << " s, mean noise " << meanNoise << "\n";
     }
 
-    UpdateProgress(1.f);
+    float meanNoise = 0;
+    for (int i = 0; i < film.width * film.height; ++i)
+        meanNoise += film.Noise(i) / (film.width * film.height);
+    std::cout << "Finished after " << seconds(clock::now() - start) << " s, mean relative error "
+              << meanNoise << "\n";
 
     // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
-        color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
-        color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
-        color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
-        fwrite(color, 1, 3, fp);
-    }
-    fclose(fp);    
+    WriteOutput(scene, film);
+    std::string noiseFile = options.output.substr(0, options.output.find_last_of('.')) + "_noise.pfm";
+    film.WriteNoisePFM(noiseFile);
 }
@@ -2,7 +2,11 @@
 // Created by goksu on 2/25/20.
 //
 #include "Scene.hpp"
+#include "Film.hpp"
+#include "Options.hpp"
+#include <functional>
 #include <mutex>
+#include <string>
 #include <thread>
 
 #pragma once
@@ -17,8 +21,38 @@ struct hit_payload
 class Renderer
 {
 public:
+    explicit Renderer(const RenderOptions& options = RenderOptions()) : options(options) {}
+
     void Render(const Scene& scene);
     void MultiThreadRender(const Scene& scene);
+    // 由 coordinator 进程把 tile 分发给 fork 出来的 worker 进程渲染
+    void MultiProcessRender(const Scene& scene);
+    // 在 options.timeBudget 秒内尽可能提高画质, 样本优先分配给噪声最大的 tile
+    void TimeBudgetRender(const Scene& scene);
+    // 交互模式: 图像发布到共享内存, 从命令管道读取相机与参数的修改, 修改后从低分辨率重新开始累加
+    void InteractiveRender(const Scene& scene);
+    // 渐进地渲染若干轮来训练 scene.guide, 训练轮的图像不参与最终结果
+    void TrainGuide(const Scene& scene);
+
+    // 对一个 tile 中的每个像素发射 spp 条光线, 结果累加到 buffer 中. 返回累加的样本数, 不含丢弃的非有限样本
+    long long RenderTile(const Scene& scene, const Tile& tile, int spp, TileBuffer& buffer) const;
+
+    // 只覆盖裁剪窗口的 film
+    Film MakeFilm(const Scene& scene) const;
+    void WriteOutput(const Scene& scene, const Film& film) const;
+
+    RenderOptions options;
+    // replicas[i] 是 NUMA 节点 i 上的场景副本, 绑定到该节点的线程用它代替传入的场景渲染
+    std::vector<const Scene*> replicas;
 private:
+    const Scene& LocalScene(const Scene& scene) const;
+    // 按 resolutionScale 缩放后的整幅图像尺寸, 相机的投影按这个尺寸计算.
+    // options.width / height 为 0 时使用 scene 的分辨率
+    int FrameWidth(const Scene& scene) const;
+    int FrameHeight(const Scene& scene) const;
+
+    int ThreadCount() const;
+    // 用 ThreadCount() 个线程处理编号为 [0, count) 的任务, 每个线程有自己的 TileBuffer
+    void ParallelTiles(int count, const std::function<void(int, TileBuffer&)>& func) const;
     std::mutex mtx;
 };
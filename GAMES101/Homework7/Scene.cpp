@@ -2,12 +2,44 @@
 // Created by Göksu Güvendiren on 2019-05-14.
 //
 
+#include <algorithm>
 #include "Scene.hpp"
+#include "Trace.hpp"
+
+const float EPSILON = 0.00001;
+// 每次反弹后光线锥额外张开的角度 (弧度). 漫反射反弹后看到的纹理只影响低频的间接光, 不需要精细的 mip 层
+const float kBounceSpread = 0.1f;
+
+// 从 ray 与场景的交点 inter 发出的光线 out 对其它物体按 lod 求交, 对交点所在的网格保持交点所在的层次
+static void setRayLod(Ray &out, const Ray &ray, const Intersection &inter, int lod)
+{
+    out.lod = lod;
+    out.originObject = inter.obj;
+    out.originLod = intersectLod(ray, inter.obj);
+}
 
 
 void Scene::buildBVH() {
+    RT_TRACE_SCOPE("Scene::buildBVH");
     printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    if (splitMethod == BVHAccel::SplitMethod::NAIVE) {
+        this->bvh = std::make_unique<BVHAccel>(objects, 1, splitMethod);
+    }
+    else {
+        std::vector<Object*> prims;
+        for (auto* obj : objects)
+            obj->getPrimitives(prims);
+        this->bvh = std::make_unique<BVHAccel>(prims, 1, splitMethod);
+    }
+
+    emitters.clear();
+    for (auto* obj : objects)
+        obj->getEmitters(emitters);
+    emitterCdf.clear();
+    float emit_area_sum = 0;
+    for (auto* obj : emitters)
+        emitterCdf.push_back(emit_area_sum += obj->getArea());
+    this->lightBVH = std::make_unique<LightBVH>(emitters);
 }
 
 // 求一条光线与场景的交点
@@ -16,26 +48,64 @@ Intersection Scene::intersect(const Ray &ray) const
     return this->bvh->Intersect(ray);
 }
 
+bool Scene::IntersectP(const Ray &ray) const
+{
+    return this->bvh->IntersectP(ray);
+}
+
+Object* Scene::pickEmitter() const
+{
+    if (emitterCdf.empty() || emitterCdf.back() <= 0)
+        return nullptr;
+    float p = get_random_float() * emitterCdf.back();
+    size_t k = std::upper_bound(emitterCdf.begin(), emitterCdf.end(), p) - emitterCdf.begin();
+    return emitters[std::min(k, emitters.size() - 1)];
+}
+
 // 在场景的所有光源上按面积 uniform 地 sample 一个点，并计算该 sample 的概率密度
 void Scene::sampleLight(Intersection &pos, float &pdf) const
 {
-    float emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-        }
+    Object *light = pickEmitter();
+    if (!light) {
+        pdf = 0;
+        return;
     }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-            if (p <= emit_area_sum){
-                objects[k]->Sample(pos, pdf);
-                break;
-            }
+    light->Sample(pos, pdf);
+    pdf *= light->getArea() / emitterCdf.back();
+}
+
+void Scene::sampleLight(const Intersection &ref, Intersection &pos, float &pdf) const
+{
+    Object *light = nullptr;
+    float pmf = 0;
+    if (!useLightBVH || !lightBVH) {
+        light = pickEmitter();
+        if (!light) {
+            pdf = 0;
+            return;
         }
+        pmf = lightPmf(ref, light);
+    }
+    else if (!lightBVH->Sample(ref.coords, ref.normal, light, pmf)) {
+        pdf = 0;
+        return;
     }
+
+    if (solidAngleSampling)
+        light->SampleSolidAngle(ref.coords, pos, pdf);
+    else
+        light->Sample(pos, pdf);
+    pdf *= pmf;
+}
+
+float Scene::lightPmf(const Intersection &ref, Object *light) const
+{
+    if (!useLightBVH || !lightBVH) {
+        if (emitterCdf.empty() || emitterCdf.back() <= 0)
+            return 0;
+        return light->getArea() / emitterCdf.back();
+    }
+    return lightBVH->Pmf(ref.coords, ref.normal, light);
 }
 
 bool Scene::trace(
@@ -59,23 +129,35 @@ bool Scene::trace(
     return (*hitObject != nullptr);
 }
 
+void Scene::IntersectBatch(const Ray *rays, size_t count, Intersection *hits) const
+{
+    this->bvh->IntersectBatch(rays, count, hits);
+}
+
 // Implementation of Path Tracing
 Vector3f Scene::castRay(const Ray &ray, int depth) const
+{
+    return castRay(ray, depth, intersect(ray));
+}
+
+Vector3f Scene::castRay(const Ray &ray, int depth, const Intersection &inter, bool specular,
+                        bool afterDiffuse) const
 {
     // TO DO Implement Path Tracing Algorithm here
     Vector3f L_dir(0, 0, 0);
     Vector3f L_indir(0, 0, 0);
 
-    Intersection inter = intersect(ray);
-    
-    // 如果从像素发出的ray没有打到物体(即没有交点), 直接返回(0, 0, 0)
+
+    // 如果从像素发出的ray没有打到物体(即没有交点), 返回环境光, 没有环境光时返回(0, 0, 0).
+    // 间接光线击中环境光的贡献在上一层计算 (需要 MIS 权重), 镜面反弹没有环境光采样, 直接计入
     if (!inter.happened) {
-        return Vector3f(0, 0, 0);
+        return environment && (0 == depth || specular) ? environment->Le(ray.direction) : Vector3f(0, 0, 0);
     }
 
-    // 如果从像素发出的ray打到光源, 返回光源信息
+    // 如果从像素发出的ray打到光源, 返回光源信息. 光源采样的阴影光线穿不过镜面, 镜面反弹击中光源时也要计入,
+    // 除非这是非镜面点之后的焦散路径并且已经由光子图估计
     if (inter.m->hasEmission()) {
-        if (0 == depth) {
+        if (0 == depth || (specular && !(afterDiffuse && causticMap))) {
             return inter.m->getEmission();
         }
         else {
@@ -83,13 +165,34 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
         }
     }
 
+    // 镜面只能沿 sample 给出的方向继续, 按 Fresnel 系数选择反射或折射的概率与系数相消
+    if (inter.m->isSpecular()) {
+        if (get_random_float() >= RussianRoulette)
+            return Vector3f(0, 0, 0);
+        Vector3f outDir = inter.m->sample(ray.direction, inter.normal);
+        if (outDir.norm() == 0)
+            return Vector3f(0, 0, 0);
+        outDir = outDir.normalized();
+        Ray outRay(offsetRayOrigin(inter.coords, inter.pError, inter.normal, outDir), outDir);
+        setRayLod(outRay, ray, inter, lodForDepth(depth + 1));
+        outRay.coneWidth = ray.coneWidth + ray.coneSpread * (float)inter.distance;
+        outRay.coneSpread = ray.coneSpread;
+        return castRay(outRay, depth + 1, intersect(outRay), true, afterDiffuse) / RussianRoulette;
+    }
+
     // 如果从像素发出的ray打到物体
 
+    // 漫反射颜色: 光线锥在交点处的宽度换算成纹理坐标下的宽度来选择 mip 层.
+    // 简化网格没有纹理坐标, 在简化网格上的交点直接取纹理的平均颜色
+    float footprint = intersectLod(ray, inter.obj) > 0 ? std::numeric_limits<float>::infinity()
+                                  : ray.coneWidth + ray.coneSpread * (float)inter.distance;
+    Vector3f kd = inter.m->getColorAt(inter.tcoords.x, inter.tcoords.y, footprint * inter.uvScale);
+
     // 1. Contribution from the light source
     // 随机sample灯光, 用该sample的结果判断射线是否击中光源
     Intersection lightInter;
     float pdf_light = 0.0f;
-    sampleLight(lightInter, pdf_light);
+    sampleLight(inter, lightInter, pdf_light);
 
     auto& N = inter.normal;        // 物体表面的法线
     auto& NN = lightInter.normal;  // 灯光表面的法线
@@ -101,32 +204,93 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
     auto obj2LightDir = obj2Light.normalized();
     float obj2LightDistance = obj2Light.norm();  // 物体到光源的距离
 
-    // 再次发出一条光线, 判断物体与光源中间是否有遮挡
-    Ray light(objPos, obj2LightDir);
-    Intersection obj2LightInter = intersect(light);
+    // 再次发出一条光线, 判断物体与光源中间是否有遮挡. 光线只检查到光源采样点之前, 有交点就是被遮挡.
+    // 遮挡光线与着色点所在的表面使用同一层网格, 换成更粗的一层时着色点可能落在那一层表面的背后, 被自己遮挡
+    Ray light(offsetRayOrigin(objPos, inter.pError, N, obj2LightDir), obj2LightDir);
+    setRayLod(light, ray, inter, ray.lod);
+    light.t_max = obj2LightDistance * (1 - kShadowEpsilon);
 
-    // 如果反射光线击中光源
-    if (obj2LightInter.happened && (obj2LightInter.coords - lightPos).norm() < 1e-2)
+    // path guiding: 着色点所在的空间树叶子
+    int guideLeaf = guide ? guide->Lookup(objPos) : -1;
+
+    // 如果光源采样点的正面朝向着色点, 并且没有被遮挡
+    if (pdf_light > 0 && dotProduct(-obj2LightDir, NN) > 0 && !IntersectP(light))
     {
-        Vector3f f_r = inter.m->eval(ray.direction, obj2LightDir, N);
+        Vector3f f_r = inter.m->eval(ray.direction, obj2LightDir, N, kd);
         L_dir = lightInter.emit * f_r * dotProduct(obj2LightDir, N) * dotProduct(-obj2LightDir, NN) / std::pow(obj2LightDistance, 2) / pdf_light;
+
+        // 把光源方向的入射 radiance 也记录下来, pdf 换算成立体角测度
+        float cosLight = std::fabs(dotProduct(-obj2LightDir, NN));
+        if (guideLeaf >= 0 && guide->training && cosLight > 0) {
+            float pdf_sa = pdf_light * obj2LightDistance * obj2LightDistance / cosLight;
+            guide->Record(guideLeaf, obj2LightDir, luminance(lightInter.emit) / pdf_sa);
+        }
     }
 
+    // 开启 path guiding 时, 间接光以一定概率改为按学到的入射 radiance 分布采样, pdf 取两者的混合
+    bool guided = guideLeaf >= 0 && guide->CanSample(guideLeaf);
+    float alpha = guide ? guide->bsdfSamplingFraction : 1.0f;
+
+    // 环境光按亮度采样一个方向, 与间接光的方向采样之间用 power heuristic 做 MIS
+    if (environment) {
+        Vector3f envDir;
+        float pdf_env = 0.0f;
+        Vector3f Le = environment->Sample(envDir, pdf_env);
+        float cosTheta = dotProduct(envDir, N);
+        if (pdf_env > 0 && cosTheta > 0) {
+            Ray envRay(offsetRayOrigin(objPos, inter.pError, N, envDir), envDir);
+            setRayLod(envRay, ray, inter, ray.lod);
+            if (!IntersectP(envRay)) {
+                float pdf_bsdf = inter.m->pdf(ray.direction, envDir, N);
+                if (guided)
+                    pdf_bsdf = alpha * pdf_bsdf + (1 - alpha) * guide->Pdf(guideLeaf, envDir);
+                float w = pdf_env * pdf_env / (pdf_env * pdf_env + pdf_bsdf * pdf_bsdf);
+                L_dir += Le * inter.m->eval(ray.direction, envDir, N, kd) * cosTheta / pdf_env * w;
+                if (guideLeaf >= 0 && guide->training)
+                    guide->Record(guideLeaf, envDir, luminance(Le) / pdf_env);
+            }
+        }
+    }
+
+    // 经过镜面到达光源的入射光由光子图估计
+    if (causticMap)
+        L_dir += causticMap->Estimate(objPos, N, ray.direction, inter.m, kd);
+
     // 2. Contribution from other reflectors
     float P_RR = get_random_float();
     if (P_RR < RussianRoulette)
     {
         // 按照该材质的性质，给定入射方向与法向量，用某种分布采样一个出射方向
-        Vector3f outDir = inter.m->sample(ray.direction, N).normalized();
-        Ray outRay(objPos, outDir);
+        Vector3f outDir = guided && get_random_float() >= alpha
+            ? guide->Sample(guideLeaf)
+            : inter.m->sample(ray.direction, N).normalized();
+        // 给定一对入射、出射方向与法向量，计算 sample 方法得到该出射方向的概率密度
+        float pdf = inter.m->pdf(ray.direction, outDir, N);
+        if (guided)
+            pdf = alpha * pdf + (1 - alpha) * guide->Pdf(guideLeaf, outDir);
+
+        Ray outRay(offsetRayOrigin(objPos, inter.pError, N, outDir), outDir);
+        setRayLod(outRay, ray, inter, lodForDepth(depth + 1));
+        outRay.coneWidth = footprint;
+        outRay.coneSpread = ray.coneSpread + kBounceSpread;
         Intersection outInter = intersect(outRay);
         // outRay打到另一个物体
-        if (outInter.happened && !outInter.m->hasEmission()) 
+        if (pdf > 0 && outInter.happened && !outInter.m->hasEmission()) 
+        {
+            Vector3f f_r = inter.m->eval(ray.direction, outDir, N, kd);
+            Vector3f L_i = castRay(outRay, depth+1, outInter, false, true);
+            L_indir = L_i * f_r * dotProduct(outDir, N) / pdf / RussianRoulette;
+
+            if (guideLeaf >= 0 && guide->training)
+                guide->Record(guideLeaf, outDir, luminance(L_i) / pdf);
+        }
+        // outRay飞向无穷远, 取环境光, 权重与上面的环境光采样对应
+        else if (pdf > 0 && !outInter.happened && environment)
         {
-            // 给定一对入射、出射方向与法向量，计算 sample 方法得到该出射方向的概率密度
-            float pdf = inter.m->pdf(ray.direction, outDir, N);
-            Vector3f f_r = inter.m->eval(ray.direction, outDir, N);
-            L_indir = castRay(outRay, depth+1) * f_r * dotProduct(outDir, N) / pdf / RussianRoulette;
+            float pdf_env = environment->Pdf(outDir);
+            float w = pdf * pdf / (pdf * pdf + pdf_env * pdf_env);
+            Vector3f f_r = inter.m->eval(ray.direction, outDir, N, kd);
+            L_indir = environment->Le(outDir) * f_r * dotProduct(outDir, N) / pdf / RussianRoulette * w;
         }
     }
 
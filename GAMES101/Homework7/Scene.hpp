@@ -4,14 +4,23 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Vector.hpp"
 #include "Object.hpp"
 #include "Light.hpp"
 #include "AreaLight.hpp"
 #include "BVH.hpp"
+#include "EnvironmentLight.hpp"
+#include "LightBVH.hpp"
+#include "PathGuiding.hpp"
+#include "PhotonMap.hpp"
 #include "Ray.hpp"
 
+// 阴影光线在到达光源采样点之前的这一比例处结束, 不会击中光源本身
+inline constexpr float kShadowEpsilon = 1e-4f;
 
 class Scene
 {
@@ -23,20 +32,79 @@ public:
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 1;
     float RussianRoulette = 0.8;
+    // 用 light BVH 按光源对着色点的重要性选择光源, 关闭时按面积均匀选择
+    bool useLightBVH = true;
+    // 在选中的光源上按着色点看去的立体角采样 (Object::SampleSolidAngle), 关闭时按面积采样
+    bool solidAngleSampling = true;
+    // 顶层 BVH 的构建方法. 非 NAIVE 时把网格展开成三角形, 在同一棵树中划分,
+    // 这样 SAH / SBVH 才能切开墙面地面这样横跨整个场景的大三角形
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE;
+    // 加载网格时生成的简化层数 (MeshTriangle::BuildLods)
+    int lodLevels = 0;
+    // 路径上第 lodDepth 次及之后的反弹光线改用简化网格求交, 每多反弹一次用更粗一层, 0 表示不使用 LOD.
+    // 光线对起点所在的网格仍使用起点所在的层次 (Ray::originObject)
+    int lodDepth = 0;
+    int lodForDepth(int depth) const { return lodDepth > 0 && depth >= lodDepth ? depth - lodDepth + 1 : 0; }
 
     Scene(int w, int h) : width(w), height(h)
     {}
 
+    // 在场景的 arena 中创建材质与物体, 它们与场景同生命周期, 场景析构时一并释放
+    template <typename... Args>
+    Material* CreateMaterial(Args&&... args)
+    {
+        return materialArena.New<Material>(std::forward<Args>(args)...);
+    }
+    template <typename T, typename... Args>
+    T* Create(Args&&... args)
+    {
+        return objectArena.New<T>(std::forward<Args>(args)...);
+    }
+
     void Add(Object *object) { objects.push_back(object); }
+    // 具名的物体可以在命令行或批量任务中按名字替换材质, material 是它原本使用的材质
+    void Add(Object *object, const std::string &name, Material *material)
+    {
+        objects.push_back(object);
+        namedObjects[name] = {object, material};
+    }
     void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
 
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
+    // ray 在 t_max 之前是否被遮挡 (BVHAccel::IntersectP)
+    bool IntersectP(const Ray& ray) const;
+    // 批量求交 (BVHAccel::IntersectBatch)
+    void IntersectBatch(const Ray* rays, size_t count, Intersection* hits) const;
+    std::unique_ptr<BVHAccel> bvh;
+    // 重复调用时会释放上一次构建的 BVH
     void buildBVH();
     Vector3f castRay(const Ray &ray, int depth) const;
+    // inter 是已经求得的 ray 与场景的交点, 例如批量求交得到的主光线交点.
+    // specular 表示 ray 由镜面 (DIELECTRIC) 反射/折射产生, afterDiffuse 表示路径上已经经过非镜面的着色点
+    Vector3f castRay(const Ray &ray, int depth, const Intersection &inter, bool specular = false,
+                     bool afterDiffuse = false) const;
+    std::unique_ptr<LightBVH> lightBVH;
+    // 所有发光图元 (网格展开成三角形) 与它们面积的前缀和, 在 buildBVH 中与 lightBVH 一起求出
+    std::vector<Object*> emitters;
+    std::vector<float> emitterCdf;
+    // 非空时用学到的入射 radiance 分布引导间接光的采样方向, 由 Renderer 负责训练
+    PathGuide *guide = nullptr;
+    // 非空时没有击中物体的光线取环境光, 着色点对它做重要性采样并与 BSDF 采样做 MIS.
+    // 只读, 可以在多个场景 (批量任务, NUMA 副本) 之间共享
+    std::shared_ptr<const EnvironmentLight> environment;
+    // 非空时非镜面着色点上经过镜面到达光源的入射光 (焦散) 由光子图估计, 路径追踪不再计算这部分.
+    // 只读, 与 environment 一样可以共享
+    std::shared_ptr<const PhotonMap> causticMap;
+    // 按面积选择一个发光图元, 没有发光图元时返回空
+    Object* pickEmitter() const;
+    // 在所有发光图元上按面积均匀采样一点, pdf 为面积测度下的概率密度
     void sampleLight(Intersection &pos, float &pdf) const;
+    // 为着色点 ref 采样光源上的一点, pdf 为面积测度下的概率密度 (包含选择光源的概率)
+    void sampleLight(const Intersection &ref, Intersection &pos, float &pdf) const;
+    // 从着色点 ref 出发, sampleLight 选中发光图元 light 的概率, 用于 MIS
+    float lightPmf(const Intersection &ref, Object *light) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -47,6 +115,16 @@ public:
     std::vector<Object* > objects;
     std::vector<std::unique_ptr<Light> > lights;
 
+    struct NamedObject {
+        Object *object;
+        Material *material;
+    };
+    std::map<std::string, NamedObject> namedObjects;
+    std::map<std::string, Material*> namedMaterials;
+
+    MemoryArena materialArena{MemoryCategory::Materials, 4096};
+    MemoryArena objectArena{MemoryCategory::Objects, 4096};
+
     // Compute reflection direction
     Vector3f reflect(const Vector3f &I, const Vector3f &N) const
     {
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <sys/stat.h>
+#include "OutOfCoreMesh.hpp"
+#include "Scenes.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+
+namespace {
+
+// 四种材质与左右墙/地面/光源在两个场景中相同, 只是材质类型不同
+struct CornellMaterials {
+    Material *red, *green, *white, *light;
+};
+
+CornellMaterials createMaterials(Scene& scene, MaterialType type)
+{
+    Material* red = scene.CreateMaterial(type, Vector3f(0.0f));
+    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
+    Material* green = scene.CreateMaterial(type, Vector3f(0.0f));
+    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
+    Material* white = scene.CreateMaterial(type, Vector3f(0.0f));
+    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
+    Material* light = scene.CreateMaterial(type, (8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
+    light->Kd = Vector3f(0.65f);
+
+    scene.namedMaterials["red"] = red;
+    scene.namedMaterials["green"] = green;
+    scene.namedMaterials["white"] = white;
+    scene.namedMaterials["light"] = light;
+    return {red, green, white, light};
+}
+
+// 加载网格. 设置了 OutOfCoreMesh::cacheDirectory 时改用磁盘上按需换入的格式:
+// 缓存文件按模型名与变换命名, 不存在或比模型旧时先完整加载一次再转换. 转换或加载失败时退回常驻内存的网格.
+// 常驻内存的网格按 scene.lodLevels 生成简化层次, 磁盘上的网格不生成.
+// OBJ 的材质指定了漫反射纹理时复制 mt 并加上纹理; 磁盘上的网格没有纹理坐标, 不使用纹理
+Object* loadMesh(Scene& scene, const std::string& filename, Material* mt,
+                 Vector3f trans = Vector3f(0.0, 0.0, 0.0), Vector3f scale = Vector3f(1.0, 1.0, 1.0))
+{
+    auto inCore = [&]() {
+        auto* mesh = scene.Create<MeshTriangle>(filename, mt, trans, scale);
+        mesh->BuildLods(scene.lodLevels);
+        if (!mesh->diffuseMap.empty()) {
+            std::string error;
+            if (auto texture = Texture::Load(mesh->diffuseMap, error)) {
+                Material* textured = scene.CreateMaterial(*mt);
+                textured->diffuseTexture = texture;
+                mesh->SetMaterial(textured);
+            }
+            else {
+                fprintf(stderr, "%s\n", error.c_str());
+            }
+        }
+        return mesh;
+    };
+    const std::string& dir = OutOfCoreMesh::cacheDirectory;
+    if (dir.empty())
+        return inCore();
+
+    std::string stem = filename.substr(filename.find_last_of('/') + 1);
+    stem = stem.substr(0, stem.find_last_of('.'));
+    char suffix[128];
+    snprintf(suffix, sizeof(suffix), "_%g_%g_%g_%g_%g_%g.ooc", trans.x, trans.y, trans.z, scale.x, scale.y,
+             scale.z);
+    std::string path = dir + "/" + stem + suffix;
+
+    // 模型比缓存文件新时重新转换
+    struct stat src, st;
+    if (stat(path.c_str(), &st) != 0 || (stat(filename.c_str(), &src) == 0 && st.st_mtime < src.st_mtime)) {
+        mkdir(dir.c_str(), 0755);
+        MeshTriangle mesh(filename, mt, trans, scale);
+        std::vector<Vector3f> vertices;
+        for (auto& tri : mesh.triangles) {
+            vertices.push_back(tri.v0);
+            vertices.push_back(tri.v1);
+            vertices.push_back(tri.v2);
+        }
+        if (!OutOfCoreMesh::Write(path, vertices))
+            return inCore();
+    }
+
+    auto* mesh = scene.Create<OutOfCoreMesh>(path, mt);
+    if (mesh->ok())
+        return mesh;
+    return inCore();
+}
+
+} // namespace
+
+void BuildCornellBox(Scene& scene)
+{
+    CornellMaterials mt = createMaterials(scene, DIFFUSE);
+
+    auto* floor = loadMesh(scene, "../models/cornellbox/floor.obj", mt.white);
+    auto* shortbox = loadMesh(scene, "../models/cornellbox/shortbox.obj", mt.white);
+    auto* tallbox = loadMesh(scene, "../models/cornellbox/tallbox.obj", mt.white);
+    auto* left = loadMesh(scene, "../models/cornellbox/left.obj", mt.red);
+    auto* right = loadMesh(scene, "../models/cornellbox/right.obj", mt.green);
+    auto* light_ = loadMesh(scene, "../models/cornellbox/light.obj", mt.light);
+
+    scene.Add(floor, "floor", mt.white);
+    scene.Add(shortbox, "shortbox", mt.white);
+    scene.Add(tallbox, "tallbox", mt.white);
+    scene.Add(left, "left", mt.red);
+    scene.Add(right, "right", mt.green);
+    scene.Add(light_, "light", mt.light);
+}
+
+void BuildBunnyScene(Scene& scene)
+{
+    CornellMaterials mt = createMaterials(scene, MICROFACET);
+
+    auto* floor = loadMesh(scene, "../models/cornellbox/floor.obj", mt.white);
+    auto* bunny = loadMesh(scene, "../models/bunny/bunny.obj", mt.white, Vector3f(300,0,300), Vector3f(2000,2000,2000));
+    auto* left = loadMesh(scene, "../models/cornellbox/left.obj", mt.red);
+    auto* right = loadMesh(scene, "../models/cornellbox/right.obj", mt.green);
+    auto* light_ = loadMesh(scene, "../models/cornellbox/light.obj", mt.light);
+
+    scene.Add(floor, "floor", mt.white);
+    scene.Add(bunny, "bunny", mt.white);
+    scene.Add(left, "left", mt.red);
+    scene.Add(right, "right", mt.green);
+    scene.Add(light_, "light", mt.light);
+}
+
+void BuildCausticScene(Scene& scene)
+{
+    CornellMaterials mt = createMaterials(scene, DIFFUSE);
+    Material* glass = scene.CreateMaterial(DIELECTRIC, Vector3f(0.0f));
+    glass->ior = 1.5f;
+    scene.namedMaterials["glass"] = glass;
+
+    auto* floor = loadMesh(scene, "../models/cornellbox/floor.obj", mt.white);
+    auto* tallbox = loadMesh(scene, "../models/cornellbox/tallbox.obj", mt.white);
+    auto* left = loadMesh(scene, "../models/cornellbox/left.obj", mt.red);
+    auto* right = loadMesh(scene, "../models/cornellbox/right.obj", mt.green);
+    auto* light_ = loadMesh(scene, "../models/cornellbox/light.obj", mt.light);
+    // 三角形网格只能从正面求交, 玻璃用解析的球体
+    auto* sphere = scene.Create<Sphere>(Vector3f(185, 90, 170), 90, glass);
+
+    scene.Add(floor, "floor", mt.white);
+    scene.Add(tallbox, "tallbox", mt.white);
+    scene.Add(left, "left", mt.red);
+    scene.Add(right, "right", mt.green);
+    scene.Add(light_, "light", mt.light);
+    scene.Add(sphere, "sphere", glass);
+}
+
+bool BuildScene(const std::string& name, Scene& scene)
+{
+    if (name == "cornellbox")
+        BuildCornellBox(scene);
+    else if (name == "bunny")
+        BuildBunnyScene(scene);
+    else if (name == "caustics")
+        BuildCausticScene(scene);
+    else
+        return false;
+    return true;
+}
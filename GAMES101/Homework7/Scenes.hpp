@@ -0,0 +1,18 @@
+#ifndef RAYTRACING_SCENES_H
+#define RAYTRACING_SCENES_H
+
+#include "Scene.hpp"
+
+// 作业中使用的场景, 由渲染器与 BVH 分析工具共用.
+// 只添加材质和物体, 调用者设置好 Scene 的选项之后再调用 buildBVH
+
+// 原始的 Cornell Box, 漫反射材质
+void BuildCornellBox(Scene& scene);
+// Cornell Box 中放一只 Stanford bunny, 微表面材质
+void BuildBunnyScene(Scene& scene);
+// Cornell Box 中放一个玻璃球, 用于焦散 (--caustic-photons)
+void BuildCausticScene(Scene& scene);
+// 按名字 (cornellbox, bunny, caustics) 构建场景, 未知的名字返回 false
+bool BuildScene(const std::string& name, Scene& scene);
+
+#endif //RAYTRACING_SCENES_H
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <tuple>
+#include "Simplify.hpp"
+
+namespace {
+
+// 对称 4x4 矩阵, 只存上三角: 点 v 的误差为 [v 1] Q [v 1]^T
+struct Quadric {
+    double a[10] = {};
+
+    // 平面 n.x + d = 0 的距离平方误差, 乘以权重 w
+    static Quadric Plane(const Vector3f& n, double d, double w)
+    {
+        Quadric q;
+        double p[4] = {n.x, n.y, n.z, d};
+        int k = 0;
+        for (int i = 0; i < 4; ++i)
+            for (int j = i; j < 4; ++j)
+                q.a[k++] = w * p[i] * p[j];
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& o)
+    {
+        for (int i = 0; i < 10; ++i)
+            a[i] += o.a[i];
+        return *this;
+    }
+
+    double Error(const Vector3f& v) const
+    {
+        double x = v.x, y = v.y, z = v.z;
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x + a[4] * y * y +
+               2 * a[5] * y * z + 2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    }
+
+    // 误差最小的位置: 解 A v = -b, A 接近奇异时返回 false
+    bool Minimize(Vector3f& v) const
+    {
+        double m[3][3] = {{a[0], a[1], a[2]}, {a[1], a[4], a[5]}, {a[2], a[5], a[7]}};
+        double b[3] = {-a[3], -a[6], -a[8]};
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                     m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                     m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double scale = std::fabs(m[0][0]) + std::fabs(m[1][1]) + std::fabs(m[2][2]);
+        if (std::fabs(det) <= 1e-10 * scale * scale * scale)
+            return false;
+        // Cramer 法则
+        double r[3];
+        for (int c = 0; c < 3; ++c) {
+            double t[3][3];
+            for (int i = 0; i < 3; ++i)
+                for (int j = 0; j < 3; ++j)
+                    t[i][j] = j == c ? b[i] : m[i][j];
+            r[c] = (t[0][0] * (t[1][1] * t[2][2] - t[1][2] * t[2][1]) -
+                    t[0][1] * (t[1][0] * t[2][2] - t[1][2] * t[2][0]) +
+                    t[0][2] * (t[1][0] * t[2][1] - t[1][1] * t[2][0])) / det;
+        }
+        v = Vector3f(r[0], r[1], r[2]);
+        return true;
+    }
+};
+
+struct Candidate {
+    double cost;
+    int v0, v1;
+    uint32_t stamp0, stamp1;
+    Vector3f position;
+
+    bool operator<(const Candidate& o) const { return cost > o.cost; }
+};
+
+class Simplifier
+{
+public:
+    explicit Simplifier(const std::vector<Vector3f>& triangles)
+    {
+        // 合并位置相同的顶点
+        std::map<std::tuple<float, float, float>, int> index;
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+            std::array<int, 3> f;
+            for (int k = 0; k < 3; ++k) {
+                const Vector3f& p = triangles[i + k];
+                auto [it, inserted] = index.emplace(std::make_tuple(p.x, p.y, p.z), (int)positions.size());
+                if (inserted)
+                    positions.push_back(p);
+                f[k] = it->second;
+            }
+            if (f[0] != f[1] && f[1] != f[2] && f[0] != f[2])
+                faces.push_back(f);
+        }
+
+        size_t n = positions.size();
+        quadrics.resize(n);
+        vertexFaces.resize(n);
+        stamps.assign(n, 0);
+        removed.assign(n, false);
+        faceRemoved.assign(faces.size(), false);
+        alive = faces.size();
+
+        std::map<std::pair<int, int>, int> edgeFaces;
+        for (size_t f = 0; f < faces.size(); ++f) {
+            Vector3f n = faceNormal(faces[f]);
+            double len = n.norm();
+            if (len > 0) {
+                // 按三角形面积加权
+                Vector3f unit = n / len;
+                Quadric q = Quadric::Plane(unit, -dotProduct(unit, positions[faces[f][0]]), len * 0.5);
+                for (int v : faces[f])
+                    quadrics[v] += q;
+            }
+            for (int k = 0; k < 3; ++k) {
+                vertexFaces[faces[f][k]].push_back(f);
+                int a = faces[f][k], b = faces[f][(k + 1) % 3];
+                ++edgeFaces[std::minmax(a, b)];
+            }
+        }
+
+        // 边界边: 加上过该边, 垂直于三角形的平面, 权重取较大值使边界几乎不移动
+        for (size_t f = 0; f < faces.size(); ++f) {
+            Vector3f n = faceNormal(faces[f]);
+            if (n.norm() <= 0)
+                continue;
+            for (int k = 0; k < 3; ++k) {
+                int a = faces[f][k], b = faces[f][(k + 1) % 3];
+                if (edgeFaces[std::minmax(a, b)] != 1)
+                    continue;
+                Vector3f e = positions[b] - positions[a];
+                Vector3f p = crossProduct(e, n);
+                if (p.norm() <= 0)
+                    continue;
+                p = normalize(p);
+                Quadric q = Quadric::Plane(p, -dotProduct(p, positions[a]), 1000 * dotProduct(e, e));
+                quadrics[a] += q;
+                quadrics[b] += q;
+            }
+        }
+
+        for (auto& [edge, count] : edgeFaces)
+            push(edge.first, edge.second);
+    }
+
+    void Run(size_t target)
+    {
+        while (alive > target && !heap.empty()) {
+            Candidate c = heap.top();
+            heap.pop();
+            if (removed[c.v0] || removed[c.v1] || stamps[c.v0] != c.stamp0 || stamps[c.v1] != c.stamp1)
+                continue;
+            collapse(c);
+        }
+    }
+
+    std::vector<Vector3f> Result() const
+    {
+        std::vector<Vector3f> out;
+        out.reserve(alive * 3);
+        for (size_t f = 0; f < faces.size(); ++f) {
+            if (faceRemoved[f])
+                continue;
+            for (int k = 0; k < 3; ++k)
+                out.push_back(positions[faces[f][k]]);
+        }
+        return out;
+    }
+
+private:
+    Vector3f faceNormal(const std::array<int, 3>& f) const
+    {
+        return crossProduct(positions[f[1]] - positions[f[0]], positions[f[2]] - positions[f[0]]);
+    }
+
+    void push(int v0, int v1)
+    {
+        Quadric q = quadrics[v0];
+        q += quadrics[v1];
+        Candidate c;
+        c.v0 = v0;
+        c.v1 = v1;
+        c.stamp0 = stamps[v0];
+        c.stamp1 = stamps[v1];
+        // 最优位置不可解时在两个端点与中点之间取误差最小的
+        if (!q.Minimize(c.position)) {
+            Vector3f options[3] = {positions[v0], positions[v1], 0.5f * (positions[v0] + positions[v1])};
+            c.position = options[0];
+            for (auto& p : options)
+                if (q.Error(p) < q.Error(c.position))
+                    c.position = p;
+        }
+        c.cost = std::max(0.0, q.Error(c.position));
+        heap.push(c);
+    }
+
+    // 把 v 移动到 p 之后, v 周围不会被删除的三角形是否有翻转
+    bool flips(int v, int other, const Vector3f& p) const
+    {
+        for (int f : vertexFaces[v]) {
+            if (faceRemoved[f])
+                continue;
+            const auto& face = faces[f];
+            if (face[0] == other || face[1] == other || face[2] == other)
+                continue;
+            Vector3f before = faceNormal(face);
+            Vector3f q[3];
+            for (int k = 0; k < 3; ++k)
+                q[k] = face[k] == v ? p : positions[face[k]];
+            Vector3f after = crossProduct(q[1] - q[0], q[2] - q[0]);
+            if (dotProduct(before, after) <= 0.2f * before.norm() * after.norm())
+                return true;
+        }
+        return false;
+    }
+
+    void collapse(const Candidate& c)
+    {
+        int v0 = c.v0, v1 = c.v1;
+        if (flips(v0, v1, c.position) || flips(v1, v0, c.position))
+            return;
+
+        positions[v0] = c.position;
+        quadrics[v0] += quadrics[v1];
+        removed[v1] = true;
+        ++stamps[v0];
+
+        for (int f : vertexFaces[v1]) {
+            if (faceRemoved[f])
+                continue;
+            auto& face = faces[f];
+            if (face[0] == v0 || face[1] == v0 || face[2] == v0) {
+                faceRemoved[f] = true;
+                --alive;
+                continue;
+            }
+            for (int& k : face)
+                if (k == v1)
+                    k = v0;
+            vertexFaces[v0].push_back(f);
+        }
+        vertexFaces[v1].clear();
+
+        // 压缩 v0 的三角形列表, 并为所有相邻顶点重新计算折叠代价
+        auto& list = vertexFaces[v0];
+        list.erase(std::remove_if(list.begin(), list.end(), [this](int f) { return faceRemoved[f]; }), list.end());
+        std::vector<int> neighbors;
+        for (int f : list)
+            for (int k : faces[f])
+                if (k != v0)
+                    neighbors.push_back(k);
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (int n : neighbors)
+            push(v0, n);
+    }
+
+    std::vector<Vector3f> positions;
+    std::vector<std::array<int, 3>> faces;
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<int>> vertexFaces;
+    std::vector<uint32_t> stamps;
+    std::vector<bool> removed, faceRemoved;
+    size_t alive = 0;
+    std::priority_queue<Candidate> heap;
+};
+
+} // namespace
+
+std::vector<Vector3f> SimplifyMesh(const std::vector<Vector3f>& triangles, size_t targetTriangles)
+{
+    Simplifier simplifier(triangles);
+    simplifier.Run(targetTriangles);
+    return simplifier.Result();
+}
@@ -0,0 +1,15 @@
+#ifndef RAYTRACING_SIMPLIFY_H
+#define RAYTRACING_SIMPLIFY_H
+
+#include <vector>
+#include "Vector.hpp"
+
+// 基于二次误差度量 (Garland & Heckbert 1997, "Surface Simplification Using Quadric Error Metrics")
+// 的网格简化: 反复折叠误差最小的边, 直到三角形数不超过 targetTriangles.
+//
+// 输入与输出都是三角形列表, 每三个顶点一个三角形. 位置完全相同的顶点视为同一个顶点,
+// 只属于一个三角形的边 (网格的边界) 额外加上垂直于该三角形的平面误差, 保持边界形状.
+// 折叠会使某个相邻三角形翻转时放弃这次折叠
+std::vector<Vector3f> SimplifyMesh(const std::vector<Vector3f>& triangles, size_t targetTriangles);
+
+#endif //RAYTRACING_SIMPLIFY_H
@@ -9,6 +9,7 @@
 #include "Vector.hpp"
 #include "Bounds3.hpp"
 #include "Material.hpp"
+#include "SphericalSampling.hpp"
 
 class Sphere : public Object{
 public:
@@ -16,7 +17,7 @@ public:
     float radius, radius2;
     Material *m;
     float area;
-    Sphere(const Vector3f &c, const float &r, Material* mt = new Material()) : center(c), radius(r), radius2(r * r), m(mt), area(4 * M_PI *r *r) {}
+    Sphere(const Vector3f &c, const float &r, Material* mt = DefaultMaterial()) : center(c), radius(r), radius2(r * r), m(mt), area(4 * M_PI *r *r) {}
     bool intersect(const Ray& ray) {
         // analytic solution
         Vector3f L = ray.origin - center;
@@ -49,18 +50,32 @@ public:
     Intersection getIntersection(Ray ray){
         Intersection result;
         result.happened = false;
+        // 判别式用球心到光线的垂足距离计算, 避免 b^2 - 4ac 在光线远离球心时的相减误差
         Vector3f L = ray.origin - center;
         float a = dotProduct(ray.direction, ray.direction);
         float b = 2 * dotProduct(ray.direction, L);
         float c = dotProduct(L, L) - radius2;
-        float t0, t1;
-        if (!solveQuadratic(a, b, c, t0, t1)) return result;
-        if (t0 < 0) t0 = t1;
-        if (t0 < 0) return result;
+        float len = (L - ray.direction * (b / (2 * a))).norm();
+        float discrim = 4 * a * (radius + len) * (radius - len);
+        if (discrim < 0) return result;
+        float root = std::sqrt(discrim);
+        float q = b < 0 ? -0.5f * (b - root) : -0.5f * (b + root);
+        if (q == 0) return result;
+        float t0 = q / a, t1 = c / q;
+        if (t0 > t1) std::swap(t0, t1);
+        // 比舍入误差还小的根可能在起点后面, 例如光线从这个球面上出发, 不接受
+        float tError = floatErrorBound(7) * (L.norm() + radius) / std::sqrt(a);
+        if (t0 <= tError) t0 = t1;
+        if (t0 <= tError || t0 >= ray.t_max) return result;
         result.happened=true;
 
-        result.coords = Vector3f(ray.origin + ray.direction * t0);
-        result.normal = normalize(Vector3f(result.coords - center));
+        // 交点投影回球面上, 误差只剩投影本身的舍入
+        Vector3f local = ray.direction * t0 + L;
+        local = local * (radius / local.norm());
+        result.coords = center + local;
+        result.pError = (Vector3f(std::fabs(local.x), std::fabs(local.y), std::fabs(local.z)) +
+                         Vector3f(std::fabs(center.x), std::fabs(center.y), std::fabs(center.z))) * floatErrorBound(5);
+        result.normal = local / radius;
         result.m = this->m;
         result.obj = this;
         result.distance = t0;
@@ -81,16 +96,64 @@ public:
         float theta = 2.0 * M_PI * get_random_float(), phi = M_PI * get_random_float();
         Vector3f dir(std::cos(phi), std::sin(phi)*std::cos(theta), std::sin(phi)*std::sin(theta));
         pos.coords = center + radius * dir;
+        pos.pError = Vector3f(std::fabs(pos.coords.x), std::fabs(pos.coords.y), std::fabs(pos.coords.z)) * floatErrorBound(5);
         pos.normal = dir;
         pos.emit = m->getEmission();
         pdf = 1.0f / area;
     }
+    void SampleSolidAngle(const Vector3f &ref, Intersection &pos, float &pdf) override
+    {
+        Vector3f wc = center - ref;
+        float dc2 = dotProduct(wc, wc);
+        // 着色点在球内时整个球面都可见, 按面积采样
+        if (dc2 <= radius2) {
+            Sample(pos, pdf);
+            return;
+        }
+        // 在球对着色点张成的圆锥内均匀采样方向 theta, 直接换算成球面上对应点的球心角 alpha,
+        // 避免求光线与球面交点时在轮廓附近的相减误差. 很小的圆锥用 sin^2 的线性近似
+        float dc = std::sqrt(dc2);
+        float sin2ThetaMax = radius2 / dc2, sinThetaMax = std::sqrt(sin2ThetaMax);
+        float u0 = get_random_float(), u1 = get_random_float();
+        float oneMinusCos, cosTheta, sin2Theta;
+        if (sin2ThetaMax < 0.00068523f) { // sin^2(1.5 度)
+            oneMinusCos = sin2ThetaMax / 2;
+            sin2Theta = sin2ThetaMax * u0;
+            cosTheta = std::sqrt(1 - sin2Theta);
+        }
+        else {
+            oneMinusCos = 1 - std::sqrt(1 - sin2ThetaMax);
+            cosTheta = 1 - u0 * oneMinusCos;
+            sin2Theta = 1 - cosTheta * cosTheta;
+        }
+        float cosAlpha = sin2Theta / sinThetaMax +
+                         cosTheta * std::sqrt(std::max(0.0f, 1 - sin2Theta / sin2ThetaMax));
+        float sinAlpha = std::sqrt(std::max(0.0f, 1 - cosAlpha * cosAlpha));
+        Vector3f n = sphericalDirection((ref - center) / dc, sinAlpha, cosAlpha, 2 * M_PI * u1);
+        pos.coords = center + radius * n;
+        pos.normal = n;
+        pos.emit = m->getEmission();
+        // 立体角测度 1 / (2 pi (1 - cos(thetaMax))) 换算成面积测度
+        Vector3f d = pos.coords - ref;
+        float dist2 = dotProduct(d, d);
+        pdf = std::fabs(dotProduct(n, d)) / std::sqrt(dist2) / (2 * M_PI * oneMinusCos * dist2);
+    }
     float getArea(){
         return area;
     }
     bool hasEmit(){
         return m->hasEmission();
     }
+    LightBounds getLightBounds() override
+    {
+        // 球面上的法线朝向所有方向
+        LightBounds lb;
+        lb.bounds = getBounds();
+        lb.cosThetaO = -1;
+        lb.cosThetaE = 0;
+        lb.phi = hasEmit() ? luminance(m->getEmission()) * area * M_PI : 0;
+        return lb;
+    }
 };
 
 
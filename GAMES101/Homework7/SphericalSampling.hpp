@@ -0,0 +1,70 @@
+#ifndef RAYTRACING_SPHERICALSAMPLING_H
+#define RAYTRACING_SPHERICALSAMPLING_H
+
+#include <cmath>
+#include "Vector.hpp"
+#include "global.hpp"
+
+// 立体角过小时 Arvo 方法的数值误差很大, 过大时 (接近整个半球) 三个顶角接近 pi, 两种情况都退回按面积采样
+constexpr float kMinSphericalTriangleArea = 3e-4f;
+constexpr float kMaxSphericalTriangleArea = 6.22f;
+
+// 两个单位向量之间的夹角, 比 acos(dot) 在夹角接近 0 或 pi 时精确
+inline float angleBetween(const Vector3f& a, const Vector3f& b)
+{
+    if (dotProduct(a, b) < 0)
+        return M_PI - 2 * std::asin(clamp(-1, 1, (a + b).norm() / 2));
+    return 2 * std::asin(clamp(-1, 1, (b - a).norm() / 2));
+}
+
+// 以单位向量 a, b, c 为顶点的球面三角形的面积 (立体角) 与三个顶角. 退化时返回 0
+inline float sphericalTriangleArea(const Vector3f& a, const Vector3f& b, const Vector3f& c,
+                                   float& alpha, float& beta, float& gamma)
+{
+    Vector3f nab = crossProduct(a, b), nbc = crossProduct(b, c), nca = crossProduct(c, a);
+    if (nab.norm() == 0 || nbc.norm() == 0 || nca.norm() == 0)
+        return 0;
+    nab = normalize(nab);
+    nbc = normalize(nbc);
+    nca = normalize(nca);
+    // 顶角是相邻两条大圆弧所在平面的二面角
+    alpha = angleBetween(nab, -nca);
+    beta = angleBetween(nbc, -nab);
+    gamma = angleBetween(nca, -nbc);
+    return std::max(0.0f, alpha + beta + gamma - M_PI);
+}
+
+// Arvo (1995) 的球面三角形均匀采样: 先按面积比例 u0 确定子三角形的第三个顶点 c',
+// 再在大圆弧 b-c' 上按 u1 取点. 返回的方向在球面三角形 abc 内均匀分布, 立体角上的 pdf 为 1 / area
+inline Vector3f sampleSphericalTriangle(const Vector3f& a, const Vector3f& b, const Vector3f& c,
+                                        float alpha, float area, float u0, float u1)
+{
+    float areaPrime = u0 * area;
+    float s = std::sin(areaPrime - alpha), t = std::cos(areaPrime - alpha);
+    float cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+    float u = t - cosAlpha;
+    float v = s + sinAlpha * dotProduct(a, b);
+    float q = ((v * t - u * s) * cosAlpha - v) / ((v * s + u * t) * sinAlpha);
+    q = clamp(-1, 1, q);
+
+    Vector3f cPerp = c - dotProduct(c, a) * a;
+    Vector3f cPrime = q * a + std::sqrt(std::max(0.0f, 1 - q * q)) * normalize(cPerp);
+
+    float z = 1 - u1 * (1 - dotProduct(cPrime, b));
+    z = clamp(-1, 1, z);
+    Vector3f perp = cPrime - dotProduct(cPrime, b) * b;
+    if (perp.norm() == 0)
+        return b;
+    return normalize(z * b + std::sqrt(std::max(0.0f, 1 - z * z)) * normalize(perp));
+}
+
+// 以 axis 为 z 轴的局部坐标系中, 极角 (sinTheta, cosTheta), 方位角 phi 的方向
+inline Vector3f sphericalDirection(const Vector3f& axis, float sinTheta, float cosTheta, float phi)
+{
+    Vector3f t = std::fabs(axis.x) > 0.9f ? Vector3f(0, 1, 0) : Vector3f(1, 0, 0);
+    Vector3f x = normalize(crossProduct(t, axis));
+    Vector3f y = crossProduct(axis, x);
+    return sinTheta * std::cos(phi) * x + sinTheta * std::sin(phi) * y + cosTheta * axis;
+}
+
+#endif //RAYTRACING_SPHERICALSAMPLING_H
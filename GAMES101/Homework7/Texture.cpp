@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "MemoryArena.hpp"
+#include "PageCache.hpp"
+#include "Texture.hpp"
+#include "global.hpp"
+
+namespace {
+
+constexpr char kMagic[8] = "RTTEX01";
+constexpr uint64_t kPageSize = 4096;
+constexpr int kTileBytes = Texture::kTileSize * Texture::kTileSize * 4;
+static_assert(kTileBytes == kPageSize, "a tile should fill exactly one page");
+
+struct Level {
+    uint32_t width, height, tilesX, firstTile;
+};
+
+float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t linearToSrgb8(float c)
+{
+    c = clamp(0, 1, c);
+    float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+    return (uint8_t)(s * 255 + 0.5f);
+}
+
+// 8 位 sRGB 到线性值的查找表
+const float* srgbTable()
+{
+    static const auto table = []() {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; ++i)
+            t[i] = srgbToLinear(i / 255.0f);
+        return t;
+    }();
+    return table.data();
+}
+
+// 二进制 PPM (P6, maxval <= 255), 转换为线性 RGB, 第 0 行在最上面
+bool readPPM(const std::string& filename, std::vector<Vector3f>& pixels, int& width, int& height,
+             std::string& error)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        error = "Cannot open " + filename;
+        return false;
+    }
+    char magic[3] = {};
+    int maxval = 0;
+    auto skipComments = [&]() {
+        int c;
+        while ((c = fgetc(fp)) != EOF) {
+            if (c == '#') {
+                while ((c = fgetc(fp)) != EOF && c != '\n') {}
+            }
+            else if (!isspace(c)) {
+                ungetc(c, fp);
+                break;
+            }
+        }
+    };
+    bool ok = fscanf(fp, "%2s", magic) == 1 && !strcmp(magic, "P6");
+    skipComments();
+    ok = ok && fscanf(fp, "%d", &width) == 1;
+    skipComments();
+    ok = ok && fscanf(fp, "%d", &height) == 1;
+    skipComments();
+    ok = ok && fscanf(fp, "%d", &maxval) == 1 && fgetc(fp) != EOF;
+    if (!ok || width <= 0 || height <= 0 || maxval <= 0 || maxval > 255) {
+        error = filename + ": only binary 8-bit PPM (P6) textures are supported";
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<uint8_t> raw((size_t)width * height * 3);
+    ok = fread(raw.data(), 1, raw.size(), fp) == raw.size();
+    fclose(fp);
+    if (!ok) {
+        error = filename + ": truncated PPM";
+        return false;
+    }
+    pixels.resize((size_t)width * height);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = Vector3f(srgbToLinear(raw[3 * i] / (float)maxval), srgbToLinear(raw[3 * i + 1] / (float)maxval),
+                             srgbToLinear(raw[3 * i + 2] / (float)maxval));
+    }
+    return true;
+}
+
+} // namespace
+
+struct Texture::Header {
+    char magic[8];
+    uint32_t width, height, levels, tileCount;
+    Level level[kMaxLevels];
+};
+
+namespace {
+
+using Header = Texture::Header;
+
+// 生成 mip 金字塔 (线性空间中 2x2 盒式滤波, 奇数边长时最后一行/列重复), 按 tile 写成缓存文件
+bool writeTiled(const std::string& path, std::vector<Vector3f> pixels, int width, int height)
+{
+    Header header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.width = width;
+    header.height = height;
+
+    std::vector<std::vector<uint8_t>> tiles;
+    for (int w = width, h = height;; ) {
+        Level& level = header.level[header.levels++];
+        level.width = w;
+        level.height = h;
+        level.tilesX = (w + Texture::kTileSize - 1) / Texture::kTileSize;
+        level.firstTile = tiles.size();
+        int tilesY = (h + Texture::kTileSize - 1) / Texture::kTileSize;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < (int)level.tilesX; ++tx) {
+                auto& tile = tiles.emplace_back(kTileBytes, 0);
+                for (int y = 0; y < Texture::kTileSize && ty * Texture::kTileSize + y < h; ++y) {
+                    for (int x = 0; x < Texture::kTileSize && tx * Texture::kTileSize + x < w; ++x) {
+                        const Vector3f& p = pixels[(size_t)(ty * Texture::kTileSize + y) * w + tx * Texture::kTileSize + x];
+                        uint8_t* out = &tile[4 * (y * Texture::kTileSize + x)];
+                        out[0] = linearToSrgb8(p.x);
+                        out[1] = linearToSrgb8(p.y);
+                        out[2] = linearToSrgb8(p.z);
+                        out[3] = 255;
+                    }
+                }
+            }
+        }
+        if ((w == 1 && h == 1) || header.levels == Texture::kMaxLevels)
+            break;
+
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<Vector3f> next((size_t)nw * nh);
+        for (int y = 0; y < nh; ++y) {
+            for (int x = 0; x < nw; ++x) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                next[(size_t)y * nw + x] = (pixels[(size_t)y0 * w + x0] + pixels[(size_t)y0 * w + x1] +
+                                            pixels[(size_t)y1 * w + x0] + pixels[(size_t)y1 * w + x1]) * 0.25f;
+            }
+        }
+        pixels = std::move(next);
+        w = nw;
+        h = nh;
+    }
+    header.tileCount = tiles.size();
+
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+        return false;
+    static_assert(sizeof(Header) <= kPageSize, "header should fit in the first page");
+    std::vector<uint8_t> first(kPageSize, 0);
+    memcpy(first.data(), &header, sizeof(header));
+    bool ok = fwrite(first.data(), 1, first.size(), fp) == first.size();
+    for (auto& tile : tiles)
+        ok = ok && fwrite(tile.data(), 1, tile.size(), fp) == tile.size();
+    ok = fclose(fp) == 0 && ok;
+    // 先写临时文件再改名, 多个进程同时转换同一张纹理时不会读到写了一半的文件
+    return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace
+
+// 所有纹理共享的常驻 tile 缓存
+static PageCache& textureCache()
+{
+    static PageCache cache("Texture cache", "tile", Texture::residentBudget, MemoryCategory::Textures);
+    return cache;
+}
+
+// 同一个文件的纹理只加载一次
+struct TextureRegistry {
+    std::mutex mtx;
+    std::map<std::string, std::weak_ptr<const Texture>> textures;
+};
+
+static TextureRegistry& textureRegistry()
+{
+    static TextureRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<const Texture> Texture::Load(const std::string& filename, std::string& error)
+{
+    auto& registry = textureRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    if (auto existing = registry.textures[filename].lock())
+        return existing;
+
+    struct stat src;
+    if (stat(filename.c_str(), &src) != 0) {
+        error = "Cannot open " + filename;
+        return nullptr;
+    }
+
+    // 缓存文件按图像名与完整路径的散列命名, 图像比缓存文件新时重新转换
+    std::string stem = filename.substr(filename.find_last_of('/') + 1);
+    stem = stem.substr(0, stem.find_last_of('.'));
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%016zx.tex", std::hash<std::string>()(filename));
+    std::string path = cacheDirectory + "/" + stem + suffix;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_mtime < src.st_mtime) {
+        std::vector<Vector3f> pixels;
+        int width, height;
+        if (!readPPM(filename, pixels, width, height, error))
+            return nullptr;
+        mkdir(cacheDirectory.c_str(), 0755);
+        if (!writeTiled(path, std::move(pixels), width, height)) {
+            error = "Cannot write texture cache " + path;
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<Texture> texture(new Texture);
+    if (!texture->open(path)) {
+        error = path + ": not a texture cache file";
+        return nullptr;
+    }
+    printf("Texture %s: %dx%d, %d levels, %u tiles\n", filename.c_str(), texture->Width(), texture->Height(),
+           texture->Levels(), texture->tileCount);
+    registry.textures[filename] = texture;
+    return texture;
+}
+
+void Texture::ReportCache()
+{
+    textureCache().Report();
+}
+
+bool Texture::open(const std::string& path)
+{
+    fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < kPageSize)
+        return false;
+    fileSize = st.st_size;
+    void* p = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    data = static_cast<const char*>(p);
+    header = static_cast<const Header*>(p);
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->levels == 0 ||
+        header->levels > kMaxLevels || fileSize < kPageSize * (header->tileCount + 1)) {
+        munmap(p, fileSize);
+        data = nullptr;
+        return false;
+    }
+    // 只在 tile 被换入时预读
+    madvise(p, fileSize, MADV_RANDOM);
+    tileCount = header->tileCount;
+    residency = std::make_unique<PageCache::Residency[]>(tileCount);
+    return true;
+}
+
+Texture::~Texture()
+{
+    if (data) {
+        textureCache().Remove(this);
+        munmap(const_cast<char*>(data), fileSize);
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+int Texture::Width() const { return header->width; }
+int Texture::Height() const { return header->height; }
+int Texture::Levels() const { return header->levels; }
+
+const uint8_t* Texture::acquire(uint32_t tile) const
+{
+    textureCache().Touch(this, data, kPageSize * (tile + 1), kTileBytes, residency[tile]);
+    return reinterpret_cast<const uint8_t*>(data + kPageSize * (tile + 1));
+}
+
+Vector3f Texture::bilinear(int l, float u, float v) const
+{
+    const Level& level = header->level[l];
+    int w = level.width, h = level.height;
+    float x = (u - std::floor(u)) * w - 0.5f;
+    float y = (1 - (v - std::floor(v))) * h - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+
+    const float* table = srgbTable();
+    // 2x2 个像素通常落在同一个 tile 中, 只在 tile 变化时重新获取
+    uint32_t lastTile = ~0u;
+    const uint8_t* pixels = nullptr;
+    Vector3f result;
+    for (int k = 0; k < 4; ++k) {
+        int px = x0 + (k & 1), py = y0 + (k >> 1);
+        px = ((px % w) + w) % w;
+        py = ((py % h) + h) % h;
+        uint32_t tile = level.firstTile + (py / kTileSize) * level.tilesX + px / kTileSize;
+        if (tile != lastTile) {
+            pixels = acquire(tile);
+            lastTile = tile;
+        }
+        const uint8_t* p = pixels + 4 * ((py % kTileSize) * kTileSize + px % kTileSize);
+        float weight = (k & 1 ? fx : 1 - fx) * (k >> 1 ? fy : 1 - fy);
+        result += Vector3f(table[p[0]], table[p[1]], table[p[2]]) * weight;
+    }
+    return result;
+}
+
+Vector3f Texture::Lookup(float u, float v, float width) const
+{
+    int top = header->levels - 1;
+    float lod = width > 0 ? std::log2(width * std::max(header->width, header->height)) : width == 0 ? 0 : top;
+    if (!(lod < top))
+        return bilinear(top, u, v);
+    if (lod <= 0)
+        return bilinear(0, u, v);
+    int l0 = (int)lod;
+    float f = lod - l0;
+    return bilinear(l0, u, v) * (1 - f) + bilinear(l0 + 1, u, v) * f;
+}
@@ -0,0 +1,65 @@
+#ifndef RAYTRACING_TEXTURE_H
+#define RAYTRACING_TEXTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "PageCache.hpp"
+#include "Vector.hpp"
+
+// 漫反射颜色纹理, 以 mip 金字塔的分块 (tile) 格式存放在磁盘上, 按需换入内存.
+//
+// 第一次加载图像时转换为缓存文件 (cacheDirectory 下, 之后直接复用):
+//
+//   Header                       每一层的宽高与第一个 tile 的下标
+//   Tile[...]                    按页对齐, 每个 tile 是 kTileSize x kTileSize 个 sRGB 的 RGBA8 像素 (正好一页)
+//
+// 文件只读 mmap, 所有纹理共享一个容量为 residentBudget 的 PageCache, 超出时按 LRU 释放最久未使用的 tile.
+// 一次查找只访问相邻两层中的 2x2 个像素,
+// 远处或多次反弹后的查找落在很小的高层上, 所以常驻的 tile 数量与场景中纹理的总大小无关
+class Texture
+{
+public:
+    static constexpr int kTileSize = 32;
+    static constexpr int kMaxLevels = 16;
+
+    // 加载时设置, 对之后加载的所有纹理生效
+    static inline std::string cacheDirectory = "/tmp";
+    static inline size_t residentBudget = 64u << 20;
+
+    // 读取二进制 PPM (P6) 图像, 同一个文件只加载一次, 由所有引用它的材质共享. 失败时返回空并设置 error
+    static std::shared_ptr<const Texture> Load(const std::string& filename, std::string& error);
+    // 打印所有纹理共享的 tile 缓存的换入/换出次数, 没有换入过 tile 时不打印
+    static void ReportCache();
+
+    ~Texture();
+
+    // (u, v) 处的线性 RGB, 纹理坐标按 OBJ 的约定 (v 朝上), 超出 [0, 1) 时重复.
+    // width 是查找区域在纹理坐标下的宽度, 决定使用的 mip 层, 在相邻两层之间三线性插值;
+    // width 为无穷大 (或 NaN) 时返回整张纹理的平均颜色
+    Vector3f Lookup(float u, float v, float width) const;
+
+    int Width() const;
+    int Height() const;
+    int Levels() const;
+
+    // 缓存文件的文件头
+    struct Header;
+
+private:
+    Texture() = default;
+    bool open(const std::string& path);
+    // 保证 tile 常驻并更新 LRU, 返回它的像素
+    const uint8_t* acquire(uint32_t tile) const;
+    Vector3f bilinear(int level, float u, float v) const;
+
+    int fd = -1;
+    const char* data = nullptr;
+    size_t fileSize = 0;
+    const Header* header = nullptr;
+    uint32_t tileCount = 0;
+    std::unique_ptr<PageCache::Residency[]> residency;
+};
+
+#endif //RAYTRACING_TEXTURE_H
@@ -0,0 +1,147 @@
+#include "Trace.hpp"
+
+#ifdef RAYTRACING_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char* name;
+    int64_t arg;
+    uint64_t start, duration; // 纳秒, 相对于 StartTrace
+};
+
+// 每个线程最多保留的事件数, 超出后覆盖最早的事件
+constexpr size_t kRingCapacity = 1 << 16;
+
+struct ThreadBuffer {
+    int tid;
+    std::string name;
+    // 按需增长到 kRingCapacity, 短命的线程只占用实际记录的事件大小
+    std::vector<Event> events;
+    uint64_t count = 0;
+};
+
+std::atomic<bool> enabled{false};
+std::chrono::steady_clock::time_point origin;
+
+// 线程结束后缓冲仍由注册表持有, 直到 WriteTrace
+std::mutex registryMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+ThreadBuffer& localBuffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+        auto b = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        b->tid = registry.size();
+        b->name = b->tid == 0 ? "main" : "thread " + std::to_string(b->tid);
+        registry.push_back(b);
+        return b;
+    }();
+    return *buffer;
+}
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void writeEscaped(FILE* fp, const char* s)
+{
+    fputc('"', fp);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+} // namespace
+
+void StartTrace()
+{
+    origin = std::chrono::steady_clock::now();
+    localBuffer();
+    enabled.store(true, std::memory_order_release);
+}
+
+bool TraceEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void SetTraceThreadName(const std::string& name)
+{
+    if (TraceEnabled())
+        localBuffer().name = name;
+}
+
+TraceScope::TraceScope(const char* name, int64_t arg) : name(name), arg(arg), start(0)
+{
+    if (TraceEnabled())
+        start = now() + 1; // 0 表示未开始记录
+}
+
+TraceScope::~TraceScope()
+{
+    if (start == 0)
+        return;
+    uint64_t begin = start - 1;
+    Event e{name, arg, begin, now() - begin};
+    ThreadBuffer& b = localBuffer();
+    if (b.events.size() < kRingCapacity)
+        b.events.push_back(e);
+    else
+        b.events[b.count % kRingCapacity] = e;
+    ++b.count;
+}
+
+bool WriteTrace(const std::string& path, std::string& error)
+{
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        error = "Cannot open " + path;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    uint64_t dropped = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (auto& b : registry) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                first ? "" : ",\n", b->tid);
+        writeEscaped(fp, b->name.c_str());
+        fprintf(fp, "}}");
+        first = false;
+
+        dropped += b->count - b->events.size();
+        for (auto& e : b->events) {
+            fprintf(fp, ",\n{\"name\":");
+            writeEscaped(fp, e.name);
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", b->tid, e.start / 1000.0,
+                    e.duration / 1000.0);
+            if (e.arg >= 0)
+                fprintf(fp, ",\"args\":{\"arg\":%lld}", (long long)e.arg);
+            fprintf(fp, "}");
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    bool ok = fclose(fp) == 0;
+    if (!ok)
+        error = "Cannot write " + path;
+    else if (dropped > 0)
+        printf("Trace: %llu oldest events were overwritten\n", (unsigned long long)dropped);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef RAYTRACING_TRACE_H
+#define RAYTRACING_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Chrome trace-event 格式的时间线 (chrome://tracing 或 Perfetto 打开), 用于查看加载, BVH 构建,
+// 各线程渲染 tile 与输出各自花了多少时间, 以及线程之间的负载是否均衡.
+//
+//   RT_TRACE_SCOPE("scene BVH");          记录所在作用域的耗时
+//   RT_TRACE_SCOPE_ARG("tile", index);    同上, 附带一个整数参数
+//
+// 每个线程把事件写进自己的环形缓冲 (写满后覆盖最早的事件), 不需要加锁; WriteTrace 在所有线程结束后
+// 合并输出. 只有用 -DRAYTRACING_TRACE=ON 构建时才会记录, 否则这些宏展开为空, 函数都是空的内联函数
+#ifdef RAYTRACING_TRACE
+
+constexpr bool kTraceCompiled = true;
+
+// 开始记录, 之前的作用域不会被记录
+void StartTrace();
+bool TraceEnabled();
+// 当前线程在时间线上显示的名字
+void SetTraceThreadName(const std::string& name);
+// 把所有线程记录的事件写成 JSON, 失败时设置 error
+bool WriteTrace(const std::string& path, std::string& error);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name, int64_t arg = -1);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name; // 必须是字符串字面量, 只保存指针
+    int64_t arg;
+    uint64_t start;
+};
+
+#define RT_TRACE_CONCAT_(a, b) a##b
+#define RT_TRACE_CONCAT(a, b) RT_TRACE_CONCAT_(a, b)
+#define RT_TRACE_SCOPE(name) TraceScope RT_TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define RT_TRACE_SCOPE_ARG(name, arg) TraceScope RT_TRACE_CONCAT(traceScope_, __LINE__)(name, (int64_t)(arg))
+
+#else
+
+constexpr bool kTraceCompiled = false;
+
+inline void StartTrace() {}
+inline bool TraceEnabled() { return false; }
+inline void SetTraceThreadName(const std::string&) {}
+inline bool WriteTrace(const std::string&, std::string& error)
+{
+    error = "tracing is disabled in this build (configure with -DRAYTRACING_TRACE=ON)";
+    return false;
+}
+
+#define RT_TRACE_SCOPE(name) ((void)0)
+#define RT_TRACE_SCOPE_ARG(name, arg) ((void)0)
+
+#endif
+
+#endif //RAYTRACING_TRACE_H
@@ -5,6 +5,10 @@
 #include "Material.hpp"
 #include "OBJ_Loader.hpp"
 #include "Object.hpp"
+#include "RayTriangle.hpp"
+#include "Simplify.hpp"
+#include "SphericalSampling.hpp"
+#include "Trace.hpp"
 #include "Triangle.hpp"
 #include <cassert>
 #include <array>
@@ -74,30 +78,100 @@ public:
     Bounds3 getBounds() override;
     void Sample(Intersection &pos, float &pdf){
         float x = std::sqrt(get_random_float()), y = get_random_float();
-        pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+        TriangleHit b{0, 1.0f - x, x * (1.0f - y), x * y};
+        pos.coords = triangleHitPoint(b, v0, v1, v2);
+        pos.pError = triangleHitError(b, v0, v1, v2);
         pos.normal = this->normal;
+        pos.emit = m->getEmission();
         pdf = 1.0f / area;
     }
+    void SampleSolidAngle(const Vector3f &ref, Intersection &pos, float &pdf) override
+    {
+        // 单面发光, 着色点在背面时看不到光源
+        float height = dotProduct(ref - v0, normal);
+        if (height <= 0) {
+            pdf = 0;
+            return;
+        }
+        Vector3f a = normalize(v0 - ref), b = normalize(v1 - ref), c = normalize(v2 - ref);
+        float alpha, beta, gamma;
+        float solidAngle = sphericalTriangleArea(a, b, c, alpha, beta, gamma);
+        if (solidAngle < kMinSphericalTriangleArea || solidAngle > kMaxSphericalTriangleArea) {
+            Sample(pos, pdf);
+            return;
+        }
+        // 按立体角采样方向, 再与三角形所在平面求交
+        Vector3f dir = sampleSphericalTriangle(a, b, c, alpha, solidAngle, get_random_float(), get_random_float());
+        float cosLight = -dotProduct(dir, normal);
+        if (cosLight <= 0) {
+            pdf = 0;
+            return;
+        }
+        float t = height / cosLight;
+        pos.coords = ref + dir * t;
+        pos.normal = this->normal;
+        pos.emit = m->getEmission();
+        // 立体角测度 1 / solidAngle 换算成面积测度
+        pdf = cosLight / (t * t * solidAngle);
+    }
     float getArea(){
         return area;
     }
     bool hasEmit(){
         return m->hasEmission();
     }
+    LightBounds getLightBounds() override
+    {
+        // 单面发光, 法线圆锥退化为法线本身
+        LightBounds lb;
+        lb.bounds = getBounds();
+        lb.axis = normal;
+        lb.cosThetaO = 1;
+        lb.cosThetaE = 0;
+        lb.phi = hasEmit() ? luminance(m->getEmission()) * area * M_PI : 0;
+        return lb;
+    }
+    void splitBounds(int axis, float position, Bounds3& left, Bounds3& right) override
+    {
+        // 沿三条边走一圈: 顶点归入所在的一侧, 边与切分平面的交点同时归入两侧
+        left = right = Bounds3();
+        const Vector3f* v[3] = {&v0, &v1, &v2};
+        for (int i = 0; i < 3; ++i) {
+            const Vector3f& a = *v[i];
+            const Vector3f& b = *v[(i + 1) % 3];
+            float pa = (&a.x)[axis], pb = (&b.x)[axis];
+            if (pa <= position)
+                left = Union(left, a);
+            if (pa >= position)
+                right = Union(right, a);
+            if ((pa < position && position < pb) || (pb < position && position < pa)) {
+                float t = clamp(0, 1, (position - pa) / (pb - pa));
+                Vector3f p = lerp(a, b, t);
+                (&p.x)[axis] = position;
+                left = Union(left, p);
+                right = Union(right, p);
+            }
+        }
+    }
 };
 
 class MeshTriangle : public Object
 {
 public:
-    MeshTriangle(const std::string& filename, Material *mt = new Material(),
+    MeshTriangle(const std::string& filename, Material *mt = DefaultMaterial(),
         Vector3f trans = Vector3f(0.0,0.0,0.0), Vector3f scale = Vector3f(1.0,1.0,1.0))
     {
+        RT_TRACE_SCOPE("MeshTriangle");
         objl::Loader loader;
-        loader.LoadFile(filename);
+        {
+            RT_TRACE_SCOPE("OBJ load");
+            loader.LoadFile(filename);
+        }
         area = 0;
         m = mt;
         assert(loader.LoadedMeshes.size() == 1);
         auto mesh = loader.LoadedMeshes[0];
+        triangles.reserve(mesh.Vertices.size() / 3);
 
         Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
                                      std::numeric_limits<float>::infinity(),
@@ -107,6 +181,7 @@ public:
                                      -std::numeric_limits<float>::infinity()};
         for (int i = 0; i < mesh.Vertices.size(); i += 3) {
             std::array<Vector3f, 3> face_vertices;
+            std::array<Vector3f, 3> face_tcoords;
 
             for (int j = 0; j < 3; j++) {
                 auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
@@ -115,6 +190,8 @@ public:
                 
                 vert = scale * vert + trans;
                 face_vertices[j] = vert;
+                face_tcoords[j] = Vector3f(mesh.Vertices[i + j].TextureCoordinate.X,
+                                           mesh.Vertices[i + j].TextureCoordinate.Y, 0);
 
                 min_vert = Vector3f(std::min(min_vert.x, vert.x),
                                     std::min(min_vert.y, vert.y),
@@ -124,18 +201,85 @@ public:
                                     std::max(max_vert.z, vert.z));
             }
 
-            triangles.emplace_back(face_vertices[0], face_vertices[1],
-                                   face_vertices[2], mt);
+            auto& tri = triangles.emplace_back(face_vertices[0], face_vertices[1],
+                                               face_vertices[2], mt);
+            tri.t0 = face_tcoords[0];
+            tri.t1 = face_tcoords[1];
+            tri.t2 = face_tcoords[2];
+        }
+
+        // .mtl 中的漫反射纹理, 路径相对于 .obj 所在的目录
+        if (mesh.MeshMaterial && !mesh.MeshMaterial->map_Kd.empty()) {
+            size_t slash = filename.find_last_of('/');
+            diffuseMap = (slash == std::string::npos ? "" : filename.substr(0, slash + 1)) +
+                         mesh.MeshMaterial->map_Kd;
         }
 
         bounding_box = Bounds3(min_vert, max_vert);
 
+        TrackMemory(MemoryCategory::Triangles, triangles.capacity() * sizeof(Triangle));
+
         std::vector<Object*> ptrs;
+        areaCdf.reserve(triangles.size());
         for (auto& tri : triangles){
             ptrs.push_back(&tri);
             area += tri.area;
+            areaCdf.push_back(area);
+        }
+        bvh = std::make_unique<BVHAccel>(ptrs);
+    }
+
+    ~MeshTriangle()
+    {
+        TrackMemory(MemoryCategory::Triangles, -(long long)(triangles.capacity() * sizeof(Triangle)));
+        for (auto& lod : lods)
+            TrackMemory(MemoryCategory::Triangles, -(long long)(lod.triangles.capacity() * sizeof(Triangle)));
+    }
+
+    // 额外生成 levels 层简化网格, 每一层的三角形数是上一层的一半.
+    // 三角形数少于 minTriangles 的网格与光源不生成: 光源采样与 MIS 需要光线击中的正是被采样的三角形
+    void BuildLods(int levels, size_t minTriangles = 1000)
+    {
+        if (levels <= 0 || triangles.size() < minTriangles || m->hasEmission())
+            return;
+        RT_TRACE_SCOPE("BuildLods");
+
+        std::vector<Vector3f> vertices;
+        vertices.reserve(triangles.size() * 3);
+        for (auto& tri : triangles) {
+            vertices.push_back(tri.v0);
+            vertices.push_back(tri.v1);
+            vertices.push_back(tri.v2);
+        }
+
+        lods.reserve(levels);
+        for (int level = 0; level < levels; ++level) {
+            vertices = SimplifyMesh(vertices, vertices.size() / 6);
+            if (vertices.empty())
+                break;
+
+            Lod& lod = lods.emplace_back();
+            lod.triangles.reserve(vertices.size() / 3);
+            for (size_t i = 0; i < vertices.size(); i += 3)
+                lod.triangles.emplace_back(vertices[i], vertices[i + 1], vertices[i + 2], m);
+            TrackMemory(MemoryCategory::Triangles, lod.triangles.capacity() * sizeof(Triangle));
+
+            std::vector<Object*> ptrs;
+            for (auto& tri : lod.triangles)
+                ptrs.push_back(&tri);
+            lod.bvh = std::make_unique<BVHAccel>(ptrs);
         }
-        bvh = new BVHAccel(ptrs);
+    }
+
+    // 替换所有三角形 (包括简化层次) 的材质, 例如换成带 diffuseMap 纹理的材质
+    void SetMaterial(Material* mt)
+    {
+        m = mt;
+        for (auto& tri : triangles)
+            tri.m = mt;
+        for (auto& lod : lods)
+            for (auto& tri : lod.triangles)
+                tri.m = mt;
     }
 
     bool intersect(const Ray& ray) { return true; }
@@ -191,23 +335,87 @@ public:
     {
         Intersection intersec;
 
-        if (bvh) {
+        int lod = intersectLod(ray, this);
+        if (lod > 0 && !lods.empty()) {
+            intersec = lods[std::min<size_t>(lod, lods.size()) - 1].bvh->Intersect(ray);
+        }
+        else if (bvh) {
             intersec = bvh->Intersect(ray);
         }
+        // 有 LOD 的网格在场景 BVH 中是一个图元, 交点记在网格上,
+        // 从交点发出的光线由此知道起点所在的网格 (Ray::originObject)
+        if (intersec.happened && !lods.empty())
+            intersec.obj = this;
 
         return intersec;
     }
+    bool IntersectP(const Ray& ray) override
+    {
+        int lod = intersectLod(ray, this);
+        if (lod > 0 && !lods.empty())
+            return lods[std::min<size_t>(lod, lods.size()) - 1].bvh->IntersectP(ray);
+        return bvh && bvh->IntersectP(ray);
+    }
     
+    // 按面积选一个三角形, 在它上面均匀采样. pdf 乘上选中这个三角形的概率, 是整个网格上的面积测度
     void Sample(Intersection &pos, float &pdf){
-        bvh->Sample(pos, pdf);
+        if (triangles.empty() || area <= 0) {
+            pdf = 0;
+            return;
+        }
+        Triangle& tri = pickTriangle();
+        tri.Sample(pos, pdf);
+        pdf *= tri.area / area;
+        pos.emit = m->getEmission();
+    }
+    // 与 Sample 相同地选择三角形, 在它上面按立体角采样
+    void SampleSolidAngle(const Vector3f &ref, Intersection &pos, float &pdf) override
+    {
+        if (triangles.empty() || area <= 0) {
+            pdf = 0;
+            return;
+        }
+        Triangle& tri = pickTriangle();
+        tri.SampleSolidAngle(ref, pos, pdf);
+        pdf *= tri.area / area;
         pos.emit = m->getEmission();
     }
+    // 按面积的前缀和选一个三角形, 选中的概率是 tri.area / area
+    Triangle& pickTriangle()
+    {
+        size_t i = std::upper_bound(areaCdf.begin(), areaCdf.end(), get_random_float() * area) - areaCdf.begin();
+        return triangles[std::min(i, triangles.size() - 1)];
+    }
     float getArea(){
         return area;
     }
     bool hasEmit(){
         return m->hasEmission();
     }
+    LightBounds getLightBounds() override
+    {
+        LightBounds lb;
+        for (auto& tri : triangles)
+            lb = Union(lb, tri.getLightBounds());
+        return lb;
+    }
+    void getEmitters(std::vector<Object*>& emitters) override
+    {
+        if (!hasEmit())
+            return;
+        for (auto& tri : triangles)
+            emitters.push_back(&tri);
+    }
+    void getPrimitives(std::vector<Object*>& prims) override
+    {
+        // 有 LOD 的网格在场景 BVH 中保持为一个图元, 由 getIntersection 按光线选择层次
+        if (!lods.empty()) {
+            prims.push_back(this);
+            return;
+        }
+        for (auto& tri : triangles)
+            prims.push_back(&tri);
+    }
 
     Bounds3 bounding_box;
     std::unique_ptr<Vector3f[]> vertices;
@@ -217,10 +425,22 @@ public:
 
     std::vector<Triangle> triangles;
 
-    BVHAccel* bvh;
+    std::unique_ptr<BVHAccel> bvh;
     float area;
+    // triangles 面积的前缀和, 用于 Sample 与 SampleSolidAngle 按面积选择三角形
+    std::vector<float> areaCdf;
 
     Material* m;
+    // OBJ 的材质指定的漫反射纹理, 空表示没有
+    std::string diffuseMap;
+
+    // 简化后的网格, lods[i] 对应 Ray::lod == i + 1
+    struct Lod {
+        std::vector<Triangle> triangles;
+        std::unique_ptr<BVHAccel> bvh;
+    };
+    std::vector<Lod> lods;
+
 };
 
 inline bool Triangle::intersect(const Ray& ray) { return true; }
@@ -236,36 +456,21 @@ inline Intersection Triangle::getIntersection(Ray ray)
 {
     Intersection inter;
 
-    if (dotProduct(ray.direction, normal) > 0)
+    TriangleHit hit;
+    if (!intersectTriangle(ray, v0, v1, v2, (float)ray.t_max, m->twoSided, hit))
         return inter;
-    double u, v, t_tmp = 0;
-    Vector3f pvec = crossProduct(ray.direction, e2);
-    double det = dotProduct(e1, pvec);
-    if (fabs(det) < EPSILON)
-        return inter;
-
-    double det_inv = 1. / det;
-    Vector3f tvec = ray.origin - v0;
-    u = dotProduct(tvec, pvec) * det_inv;
-    if (u < 0 || u > 1)
-        return inter;
-    Vector3f qvec = crossProduct(tvec, e1);
-    v = dotProduct(ray.direction, qvec) * det_inv;
-    if (v < 0 || u + v > 1)
-        return inter;
-    t_tmp = dotProduct(e2, qvec) * det_inv;
-
-    // TODO find ray triangle intersection
-    if (t_tmp < 0) {
-        return inter;
-    }
 
     inter.happened = true;
-    inter.coords = ray(t_tmp);
-    inter.normal = normal;
-    inter.distance = t_tmp;
+    inter.coords = triangleHitPoint(hit, v0, v1, v2);
+    inter.pError = triangleHitError(hit, v0, v1, v2);
+    inter.normal = m->twoSided && !m->isSpecular() && dotProduct(ray.direction, normal) > 0 ? -normal : normal;
+    inter.distance = hit.t;
     inter.obj = this;
     inter.m = m;
+    inter.tcoords = t0 * hit.b0 + t1 * hit.b1 + t2 * hit.b2;
+    // 纹理坐标面积与三角形面积之比的平方根
+    float uvArea = std::fabs((t1.x - t0.x) * (t2.y - t0.y) - (t2.x - t0.x) * (t1.y - t0.y)) * 0.5f;
+    inter.uvScale = std::sqrt(uvArea / area);
 
     return inter;
 }
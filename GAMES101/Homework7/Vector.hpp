@@ -90,5 +90,7 @@ inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b)
 }
 
 
+inline float luminance(const Vector3f &c)
+{ return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
 
 #endif //RAYTRACING_VECTOR_H
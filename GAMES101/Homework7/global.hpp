@@ -28,14 +28,24 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
     return true;
 }
 
+// 每个线程独立的随机数引擎, 避免多个渲染线程争用同一个引擎
+inline std::mt19937& get_random_engine()
+{
+    static thread_local std::mt19937 rng(std::random_device{}());
+    return rng;
+}
+
+// 用固定种子重置当前线程的随机数序列, 使同一个 tile 无论由哪个进程渲染结果都相同
+inline void seed_random(uint32_t seed)
+{
+    get_random_engine().seed(seed);
+}
+
 inline float get_random_float()
 {
-    // 改成static, 避免每次调用都需要创建对象
-    static std::random_device dev;
-    static std::mt19937 rng(dev());
-    static std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
+    static thread_local std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [0, 1]
 
-    return dist(rng);
+    return dist(get_random_engine());
 }
 
 inline void UpdateProgress(float progress)
@@ -1,10 +1,34 @@
+#include "Batch.hpp"
+#include "OutOfCoreMesh.hpp"
 #include "Renderer.hpp"
 #include "Scene.hpp"
-#include "Triangle.hpp"
-#include "Sphere.hpp"
+#include "Scenes.hpp"
+#include "Trace.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// 解析命令行参数, 例如: ./RayTracing --spp 64 --workers 8 --output bunny.ppm
+static RenderOptions ParseOptions(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (std::find(args.begin(), args.end(), "--help") != args.end()) {
+        PrintUsage(argv[0]);
+        exit(0);
+    }
+    RenderOptions options;
+    std::string error;
+    if (!ParseOptions(args, options, error)) {
+        std::cerr << error << "\n";
+        PrintUsage(argv[0]);
+        exit(1);
+    }
+    return options;
+}
 
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
@@ -16,30 +40,10 @@ int main_cornellbox(int argc, char** argv)
     // Change the definition here to change resolution
     Scene scene(784, 784);
 
-    Material* red = new Material(DIFFUSE, Vector3f(0.0f));
-    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
-    Material* green = new Material(DIFFUSE, Vector3f(0.0f));
-    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
-    Material* white = new Material(DIFFUSE, Vector3f(0.0f));
-    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
-    Material* light = new Material(DIFFUSE, (8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
-    light->Kd = Vector3f(0.65f);
-
-    MeshTriangle floor("../models/cornellbox/floor.obj", white);
-    MeshTriangle shortbox("../models/cornellbox/shortbox.obj", white);
-    MeshTriangle tallbox("../models/cornellbox/tallbox.obj", white);
-    MeshTriangle left("../models/cornellbox/left.obj", red);
-    MeshTriangle right("../models/cornellbox/right.obj", green);
-    MeshTriangle light_("../models/cornellbox/light.obj", light);
-
-    scene.Add(&floor);
-    scene.Add(&shortbox);
-    scene.Add(&tallbox);
-    scene.Add(&left);
-    scene.Add(&right);
-    scene.Add(&light_);
+    BuildCornellBox(scene);
 
     scene.buildBVH();
+    ReportMemory();
 
     Renderer r;
 
@@ -60,38 +64,157 @@ int main_cornellbox(int argc, char** argv)
 
 int main(int argc, char** argv)
 {
+    RenderOptions options = ParseOptions(argc, argv);
+    if (!options.traceFile.empty()) {
+        if (kTraceCompiled)
+            StartTrace();
+        else
+            std::cerr << "--trace ignored: tracing is disabled in this build (configure with -DRAYTRACING_TRACE=ON)\n";
+    }
+    auto finishTrace = [&]() {
+        std::string error;
+        if (TraceEnabled() && !WriteTrace(options.traceFile, error))
+            std::cerr << error << "\n";
+    };
+
+    BVHAccel::defaultLayout = options.bvhLayout;
+    BVHAccel::defaultCompression = options.bvhCompression;
+    BVHAccel::defaultLazy = options.bvhLazy;
+    OutOfCoreMesh::cacheDirectory = options.outOfCoreDir;
+    OutOfCoreMesh::residentBudget = (size_t)std::max(1, options.outOfCoreBudgetMB) << 20;
+    Texture::cacheDirectory = options.textureCacheDir;
+    Texture::residentBudget = (size_t)std::max(1, options.textureBudgetMB) << 20;
+
+    std::shared_ptr<const EnvironmentLight> environment;
+    if (!options.environment.empty()) {
+        std::string error;
+        environment = EnvironmentLight::Load(options.environment, options.environmentScale,
+                                             options.environmentRotation, error);
+        if (!environment) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        std::cout << "Environment map " << environment->Width() << "x" << environment->Height() << "\n";
+    }
+
+    auto loadScene = [&](Scene& scene) {
+        scene.useLightBVH = options.useLightBVH;
+        scene.solidAngleSampling = options.solidAngleSampling;
+        scene.splitMethod = options.bvhSplit;
+        scene.lodLevels = options.lodLevels;
+        scene.lodDepth = options.lodDepth;
+        scene.environment = environment;
+
+        RT_TRACE_SCOPE("load scene");
+        BuildScene(options.sceneName, scene);
+        for (auto& name : options.twoSidedMaterials) {
+            auto it = scene.namedMaterials.find(name);
+            if (it != scene.namedMaterials.end())
+                it->second->twoSided = true;
+            else
+                std::cerr << "--two-sided: unknown material " << name << "\n";
+        }
+
+        scene.buildBVH();
+    };
+
+    // 绑定线程时主线程留在节点 0 上加载场景, 这样场景的内存在节点 0,
+    // 开启复制时其他节点各自在绑定的线程中加载一份
+    if (options.pinning != ThreadPinning::NONE)
+        PinWorkerThread(ThreadPinning::NODE, 0);
+
     // Change the definition here to change resolution
     Scene scene(784, 784);
-
-    Material* red = new Material(MICROFACET, Vector3f(0.0f));
-    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
-    Material* green = new Material(MICROFACET, Vector3f(0.0f));
-    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
-    Material* white = new Material(MICROFACET, Vector3f(0.0f));
-    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
-    Material* light = new Material(MICROFACET, (8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
-    light->Kd = Vector3f(0.65f);
-
-    MeshTriangle floor("../models/cornellbox/floor.obj", white);
-    MeshTriangle bunny("../models/bunny/bunny.obj", white, Vector3f(300,0,300), Vector3f(2000,2000,2000));
-    MeshTriangle left("../models/cornellbox/left.obj", red);
-    MeshTriangle right("../models/cornellbox/right.obj", green);
-    MeshTriangle light_("../models/cornellbox/light.obj", light);
-
-    scene.Add(&floor);
-    scene.Add(&bunny);
-    scene.Add(&left);
-    scene.Add(&right);
-    scene.Add(&light_);
-
-    scene.buildBVH();
-
-    Renderer r;
+    loadScene(scene);
+
+    std::vector<std::unique_ptr<Scene>> replicas;
+    if (options.replicateScene && options.pinning != ThreadPinning::NONE) {
+        int nodes = NumaTopology::Get().NodeCount();
+        for (int node = 1; node < nodes; ++node) {
+            RunOnNode(node, [&]() {
+                auto replica = std::make_unique<Scene>(784, 784);
+                loadScene(*replica);
+                replicas.push_back(std::move(replica));
+            });
+        }
+        std::cout << "Scene replicated on " << nodes << " NUMA nodes\n";
+    }
+    // 焦散光子图只读, 副本与批量任务共享同一份
+    auto buildCausticMap = [&](const Scene& target) -> std::shared_ptr<const PhotonMap> {
+        if (options.causticPhotons <= 0)
+            return nullptr;
+        auto map = std::make_shared<PhotonMap>();
+        map->k = options.causticK;
+        map->maxRadius = options.causticRadius;
+        int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        map->Build(target, options.causticPhotons, threads);
+        return map;
+    };
+    scene.causticMap = buildCausticMap(scene);
+    for (auto& replica : replicas)
+        replica->causticMap = scene.causticMap;
+    ReportMemory();
+
+    // 批量模式下网格与 BVH 只构建一次, 所有任务共享
+    if (!options.batchFile.empty()) {
+        std::vector<RenderOptions> jobs;
+        std::string error;
+        if (!LoadBatch(options.batchFile, options, jobs, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        auto start = std::chrono::system_clock::now();
+        RenderBatch(scene, jobs, options.threads, options.pinning);
+        auto stop = std::chrono::system_clock::now();
+        std::cout << "Batch complete: " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count()
+                  << " seconds\n";
+        finishTrace();
+        return 0;
+    }
+
+    // 替换了材质时, 在共享原有网格的新场景中渲染
+    std::unique_ptr<Scene> overridden;
+    if (!options.materialOverrides.empty()) {
+        std::string error;
+        overridden = MakeJobScene(scene, options, error);
+        if (!overridden) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+    Scene& target = overridden ? *overridden : scene;
+    // 替换了材质的场景重新发射光子, 镜面可能被替换掉或者换成了镜面
+    if (overridden)
+        target.causticMap = buildCausticMap(target);
+
+    PathGuide guide(target.bvh->WorldBound());
+    // 交互模式没有固定的训练阶段, 相机与参数随时会变, 不使用 path guiding
+    if (options.guidingIterations > 0 && !options.interactive.empty())
+        std::cerr << "--guiding is ignored in interactive mode\n";
+    else if (options.guidingIterations > 0)
+        target.guide = &guide;
+
+    Renderer r(options);
+    // 副本与 scene 相同, 替换了材质时不使用副本
+    if (!replicas.empty() && !overridden) {
+        r.replicas.push_back(&scene);
+        for (auto& replica : replicas) {
+            replica->guide = scene.guide;
+            r.replicas.push_back(replica.get());
+        }
+    }
 
     auto start = std::chrono::system_clock::now();
 
     //r.Render(scene);
-    r.MultiThreadRender(scene);
+    if (!options.interactive.empty())
+        r.InteractiveRender(target);
+    else if (options.timeBudget > 0)
+        r.TimeBudgetRender(target);
+    else if (options.workers > 0)
+        r.MultiProcessRender(target);
+    else
+        r.MultiThreadRender(target);
     
     auto stop = std::chrono::system_clock::now();
 
@@ -99,6 +222,10 @@ int main(int argc, char** argv)
     std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
+    if (!options.outOfCoreDir.empty())
+        OutOfCoreMesh::ReportCache();
+    Texture::ReportCache();
+    finishTrace();
 
     return 0;
 }
\ No newline at end of file